@@ -0,0 +1,582 @@
+#include <string.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "Common.h"
+#include "Chip8.h"
+#include "Profiler.h"
+#include "Analysis.h"
+
+#define PROGRAM_START 0x200
+
+// a BNNN table holds at most one jump per even V0
+#define MAX_TABLE_ENTRIES 128
+
+// must follow the order of enum 'flow_exits'
+static const char *exit_names[NUMBER_OF_FLOW_EXITS] = { "fall", "jump", "call", "return", "skip", "table", "stop" };
+
+rom_analysis::rom_analysis()
+	: rom_hash(0), machine(chip8::MACHINE_CHIP8), program_end(PROGRAM_START)
+{
+}
+
+/**
+ * analysis
+ *
+*/
+
+void rom_analysis::analyze(chip8 &chip, size_t size, uint64 hash)
+{
+	rom_hash = hash;
+	machine = chip.machine;
+	program_end = (uint32_t)std::min<size_t>(PROGRAM_START + size, chip8::MEMORY_SIZE);
+
+	kinds.assign(chip8::MEMORY_SIZE, BYTE_UNKNOWN);
+	pending.clear();
+	flow.clear();
+	calls.clear();
+	regions.clear();
+	indirect.clear();
+
+	addTarget(PROGRAM_START);
+	while (!pending.empty()) {
+		uint16 entry = pending.back();
+		pending.pop_back();
+		walk(chip, entry);
+	}
+
+	split(chip);
+	findRegions();
+	std::sort(calls.begin(), calls.end(),
+		[](const flow_subroutine &a, const flow_subroutine &b) { return a.address < b.address; });
+}
+
+void rom_analysis::addTarget(uint16 target)
+{
+	if (target >= chip8::MEMORY_SIZE - 1) {
+		return;
+	}
+	kinds[target] |= BYTE_LEADER;
+	if (!(kinds[target] & BYTE_CODE)) {
+		pending.push_back(target);
+	}
+}
+
+void rom_analysis::addCall(uint16 target, uint16 site)
+{
+	addTarget(target);
+	for (size_t i = 0; i < calls.size(); ++i) {
+		if (calls[i].address == target) {
+			calls[i].callers.push_back(site);
+			return;
+		}
+	}
+	flow_subroutine subroutine;
+	subroutine.address = target;
+	subroutine.callers.push_back(site);
+	calls.push_back(subroutine);
+}
+
+// one straight run from 'entry' up to its first control flow instruction (or code already walked)
+void rom_analysis::walk(chip8 &chip, uint16 entry)
+{
+	// registers holding a known constant (6XNN / 7XNN) along the run, -1 = unknown
+	int known[chip8::REGISTER_COUNT];
+	for (int r = 0; r < chip8::REGISTER_COUNT; ++r) {
+		known[r] = -1;
+	}
+
+	uint32_t address = entry;
+	while (address < chip8::MEMORY_SIZE - 1) {
+		// ran into a path walked before, which now has to start a block here
+		if (kinds[address] & BYTE_CODE) {
+			kinds[address] |= BYTE_LEADER;
+			return;
+		}
+
+		chip8::decoded_instruction instruction;
+		if (!chip.decodeInstruction((uint16)address, instruction)) {
+			return;
+		}
+		// the emulator calls 0NNN like 2NNN, anywhere outside the program it is a path into data
+		if (instruction.opcode == chip8::_0x0NNN && (instruction.nnn < PROGRAM_START || instruction.nnn >= program_end)) {
+			return;
+		}
+
+		uint32_t length = (instruction.opcode == chip8::_0xF000) ? 4 : 2;
+		kinds[address] |= BYTE_CODE;
+		for (uint32_t i = 1; i < length; ++i) {
+			kinds[(address + i) & (chip8::MEMORY_SIZE - 1)] |= BYTE_OPERAND;
+		}
+		uint16 next = (uint16)(address + length);
+		uint8 x = instruction.x;
+
+		switch (instruction.opcode) {
+		case chip8::_0x1NNN:
+			addTarget(instruction.nnn);
+			return;
+
+		case chip8::_0x2NNN:
+		case chip8::_0x0NNN:
+			addCall(instruction.nnn, (uint16)address);
+			addTarget(next);
+			return;
+
+		case chip8::_0x00EE:
+		case chip8::_0x00FD:
+			return;
+
+		case chip8::_0x3XNN:
+		case chip8::_0x4XNN:
+		case chip8::_0x5XY0:
+		case chip8::_0x9XY0:
+		case chip8::_0xEX9E:
+		case chip8::_0xEXA1:
+			addTarget(next);
+			addTarget((uint16)(address + instruction.skip));
+			return;
+
+		case chip8::_0xBNNN: {
+			std::vector<uint16> &targets = indirect[(uint16)address];
+			int offset = known[chip.quirks.jump_uses_vx ? x : 0];
+			if (offset >= 0) {
+				targets.push_back((uint16)(instruction.nnn + offset));
+			}
+			else {
+				// a table of jumps, one per even offset
+				for (int entry_index = 0; entry_index < MAX_TABLE_ENTRIES; ++entry_index) {
+					uint16 target = (uint16)(instruction.nnn + entry_index * 2);
+					if (target >= chip8::MEMORY_SIZE - 1 || (chip.memory[target] & 0xF0) != 0x10) {
+						break;
+					}
+					targets.push_back(target);
+				}
+				if (targets.empty()) {
+					targets.push_back(instruction.nnn);
+				}
+			}
+			for (size_t i = 0; i < targets.size(); ++i) {
+				addTarget(targets[i]);
+			}
+			return;
+		}
+
+		case chip8::_0xANNN:
+			kinds[instruction.nnn] |= BYTE_DATA_LABEL;
+			break;
+
+		case chip8::_0xF000:
+			kinds[(uint16)(chip.memory[(address + 2) & (chip8::MEMORY_SIZE - 1)] << 8 |
+				chip.memory[(address + 3) & (chip8::MEMORY_SIZE - 1)])] |= BYTE_DATA_LABEL;
+			break;
+
+		// what the run knows about the registers
+		case chip8::_0x6XNN:
+			known[x] = instruction.nn;
+			break;
+		case chip8::_0x7XNN:
+			known[x] = (known[x] < 0) ? -1 : ((known[x] + instruction.nn) & 0xFF);
+			break;
+		case chip8::_0x8XY0: case chip8::_0x8XY1: case chip8::_0x8XY2: case chip8::_0x8XY3: case chip8::_0x8XY4:
+		case chip8::_0x8XY5: case chip8::_0x8XY6: case chip8::_0x8XY7: case chip8::_0x8XYE:
+			known[x] = -1;
+			known[0xF] = -1;
+			break;
+		case chip8::_0xCXNN:
+		case chip8::_0xFX07:
+		case chip8::_0xFX0A:
+			known[x] = -1;
+			break;
+		case chip8::_0xDXYN:
+		case chip8::_0xFX1E:
+			known[0xF] = -1;
+			break;
+		case chip8::_0xFX65:
+		case chip8::_0xFX85:
+		case chip8::_0x5XY3:
+			for (int r = 0; r < chip8::REGISTER_COUNT; ++r) {
+				known[r] = -1;
+			}
+			break;
+		default:
+			break;
+		}
+
+		address = next;
+	}
+}
+
+// the blocks:  from every leader up to its control flow instruction or the next leader
+void rom_analysis::split(chip8 &chip)
+{
+	for (uint32_t start = 0; start < chip8::MEMORY_SIZE - 1; ++start) {
+		if (!(kinds[start] & BYTE_LEADER) || !(kinds[start] & BYTE_CODE)) {
+			continue;
+		}
+
+		flow_block block;
+		block.start = (uint16)start;
+		uint32_t address = start;
+		for (;;) {
+			chip8::decoded_instruction instruction;
+			chip.decodeInstruction((uint16)address, instruction);
+			uint32_t next = address + ((instruction.opcode == chip8::_0xF000) ? 4 : 2);
+			block.end = next;
+
+			if (instruction.opcode == chip8::_0x1NNN) {
+				block.exit = FLOW_JUMP;
+				block.successors.push_back(instruction.nnn);
+			}
+			else if (instruction.opcode == chip8::_0x2NNN || instruction.opcode == chip8::_0x0NNN) {
+				block.exit = FLOW_CALL;
+				block.successors.push_back(instruction.nnn);
+				block.successors.push_back((uint16)next);
+			}
+			else if (instruction.opcode == chip8::_0x00EE) {
+				block.exit = FLOW_RETURN;
+			}
+			else if (instruction.opcode == chip8::_0x00FD) {
+				block.exit = FLOW_STOP;
+			}
+			else if (instruction.opcode == chip8::_0x3XNN || instruction.opcode == chip8::_0x4XNN ||
+				instruction.opcode == chip8::_0x5XY0 || instruction.opcode == chip8::_0x9XY0 ||
+				instruction.opcode == chip8::_0xEX9E || instruction.opcode == chip8::_0xEXA1) {
+				block.exit = FLOW_SKIP;
+				block.successors.push_back((uint16)next);
+				block.successors.push_back((uint16)(address + instruction.skip));
+			}
+			else if (instruction.opcode == chip8::_0xBNNN) {
+				block.exit = FLOW_TABLE;
+				block.successors = indirect[(uint16)address];
+			}
+			else if (next >= chip8::MEMORY_SIZE - 1 || !(kinds[next] & BYTE_CODE)) {
+				block.exit = FLOW_STOP;
+			}
+			else if (kinds[next] & BYTE_LEADER) {
+				block.exit = FLOW_FALL;
+				block.successors.push_back((uint16)next);
+			}
+			else {
+				address = next;
+				continue;
+			}
+			break;
+		}
+		flow.push_back(block);
+	}
+}
+
+// the parts of the program no path reached
+void rom_analysis::findRegions()
+{
+	uint32_t address = PROGRAM_START;
+	while (address < program_end) {
+		if (kinds[address] & (BYTE_CODE | BYTE_OPERAND)) {
+			++address;
+			continue;
+		}
+		flow_region region;
+		region.start = (uint16)address;
+		while (address < program_end && !(kinds[address] & (BYTE_CODE | BYTE_OPERAND))) {
+			++address;
+		}
+		region.end = address;
+		regions.push_back(region);
+	}
+}
+
+/**
+ * flow file
+ *
+*/
+
+bool rom_analysis::save(const char *path) const
+{
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		return false;
+	}
+
+	fprintf(out, "# chip8_analyze flow file, see Analysis.h\n");
+	fprintf(out, "rom %016llx %s\n", (unsigned long long)rom_hash, chip8::machineName(machine));
+	for (size_t i = 0; i < flow.size(); ++i) {
+		fprintf(out, "block %03x %03x %s", flow[i].start, flow[i].end, exit_names[flow[i].exit]);
+		for (size_t s = 0; s < flow[i].successors.size(); ++s) {
+			fprintf(out, " %03x", flow[i].successors[s]);
+		}
+		fprintf(out, "\n");
+	}
+	for (size_t i = 0; i < calls.size(); ++i) {
+		fprintf(out, "sub %03x", calls[i].address);
+		for (size_t c = 0; c < calls[i].callers.size(); ++c) {
+			fprintf(out, " %03x", calls[i].callers[c]);
+		}
+		fprintf(out, "\n");
+	}
+	for (size_t i = 0; i < regions.size(); ++i) {
+		fprintf(out, "data %03x %03x\n", regions[i].start, regions[i].end);
+	}
+
+	bool written = (ferror(out) == 0);
+	fclose(out);
+	return written;
+}
+
+static bool parse_address(const std::string &token, uint32_t limit, uint32_t &address)
+{
+	char *end = NULL;
+	unsigned long value = strtoul(token.c_str(), &end, 16);
+	if (token.empty() || *end != '\0' || value > limit) {
+		return false;
+	}
+	address = (uint32_t)value;
+	return true;
+}
+
+bool rom_analysis::load(const char *path, uint64 expected_hash, chip8::Machine expected_machine)
+{
+	std::ifstream input(path);
+	if (!input) {
+		return false;
+	}
+
+	flow.clear();
+	calls.clear();
+	regions.clear();
+	kinds.clear();
+	bool matched = false;
+
+	std::string line;
+	while (std::getline(input, line)) {
+		line = line.substr(0, line.find('#'));
+		std::stringstream tokens(line);
+		std::string kind;
+		if (!(tokens >> kind)) {
+			continue;
+		}
+
+		std::string token;
+		std::vector<uint32_t> addresses;
+		if (kind == "rom") {
+			std::string name;
+			if (!(tokens >> token >> name) || !chip8::parseMachine(name.c_str(), machine)) {
+				return false;
+			}
+			rom_hash = strtoull(token.c_str(), NULL, 16);
+			matched = (rom_hash == expected_hash && machine == expected_machine);
+			if (!matched) {
+				return false;
+			}
+		}
+		else if (kind == "block") {
+			flow_block block;
+			uint32_t start;
+			std::string exit;
+			if (!(tokens >> token) || !parse_address(token, chip8::MEMORY_SIZE - 2, start) ||
+				!(tokens >> token) || !parse_address(token, chip8::MEMORY_SIZE, block.end) || !(tokens >> exit)) {
+				return false;
+			}
+			block.start = (uint16)start;
+			const char **name = std::find(exit_names, exit_names + NUMBER_OF_FLOW_EXITS, exit);
+			if (name == exit_names + NUMBER_OF_FLOW_EXITS) {
+				return false;
+			}
+			block.exit = (FlowExit)(name - exit_names);
+			uint32_t successor;
+			while (tokens >> token) {
+				if (!parse_address(token, chip8::MEMORY_SIZE - 1, successor)) {
+					return false;
+				}
+				block.successors.push_back((uint16)successor);
+			}
+			flow.push_back(block);
+		}
+		else if (kind == "sub") {
+			flow_subroutine subroutine;
+			uint32_t address;
+			if (!(tokens >> token) || !parse_address(token, chip8::MEMORY_SIZE - 1, address)) {
+				return false;
+			}
+			subroutine.address = (uint16)address;
+			while (tokens >> token) {
+				if (!parse_address(token, chip8::MEMORY_SIZE - 1, address)) {
+					return false;
+				}
+				subroutine.callers.push_back((uint16)address);
+			}
+			calls.push_back(subroutine);
+		}
+		else if (kind == "data") {
+			flow_region region;
+			uint32_t start;
+			if (!(tokens >> token) || !parse_address(token, chip8::MEMORY_SIZE - 1, start) ||
+				!(tokens >> token) || !parse_address(token, chip8::MEMORY_SIZE, region.end)) {
+				return false;
+			}
+			region.start = (uint16)start;
+			regions.push_back(region);
+		}
+		else {
+			return false;
+		}
+	}
+	return matched;
+}
+
+/**
+ * listing
+ *
+*/
+
+const flow_subroutine *rom_analysis::subroutineAt(uint16 address) const
+{
+	for (size_t i = 0; i < calls.size(); ++i) {
+		if (calls[i].address == address) {
+			return &calls[i];
+		}
+	}
+	return NULL;
+}
+
+void rom_analysis::label(uint16 address, char *out, size_t size) const
+{
+	if (address == PROGRAM_START) {
+		snprintf(out, size, "start");
+	}
+	else if (subroutineAt(address) != NULL) {
+		snprintf(out, size, "sub_%03X", address);
+	}
+	else if (!kinds.empty() && (kinds[address] & BYTE_LEADER) && (kinds[address] & BYTE_CODE)) {
+		snprintf(out, size, "label_%03X", address);
+	}
+	else if (!kinds.empty() && (kinds[address] & BYTE_DATA_LABEL)) {
+		snprintf(out, size, "data_%03X", address);
+	}
+	else {
+		snprintf(out, size, "0x%03X", address);
+	}
+}
+
+// operands from the opcode's pattern:  X / Y = registers, a run of N = the value of those nibbles
+void rom_analysis::formatOperands(const chip8 &chip, const chip8::decoded_instruction &instruction, uint16 address, char *out, size_t size) const
+{
+	char target[32];
+	out[0] = '\0';
+
+	switch (instruction.opcode) {
+	case chip8::_0x1NNN:
+	case chip8::_0x2NNN:
+	case chip8::_0x0NNN:
+		label(instruction.nnn, out, size);
+		return;
+	case chip8::_0xANNN:
+		label(instruction.nnn, target, sizeof(target));
+		snprintf(out, size, "I, %s", target);
+		return;
+	case chip8::_0xBNNN:
+		snprintf(out, size, "V%X + 0x%03X", chip.quirks.jump_uses_vx ? instruction.x : 0, instruction.nnn);
+		return;
+	case chip8::_0xF000:
+		label((uint16)(chip.memory[(address + 2) & (chip8::MEMORY_SIZE - 1)] << 8 | chip.memory[(address + 3) & (chip8::MEMORY_SIZE - 1)]),
+			target, sizeof(target));
+		snprintf(out, size, "I, %s", target);
+		return;
+	default:
+		break;
+	}
+
+	const char *pattern = chip8_profile::opcodeName(instruction.opcode);
+	size_t used = 0;
+	for (int nibble = 0; nibble < 4 && used < size; ++nibble) {
+		char letter = pattern[nibble];
+		const char *separator = (used == 0) ? "" : ", ";
+		if (letter == 'X' || letter == 'Y') {
+			used += snprintf(out + used, size - used, "%sV%X", separator, (instruction.raw >> (12 - nibble * 4)) & 0xF);
+		}
+		else if (letter == 'N') {
+			int last = nibble;
+			while (last < 3 && pattern[last + 1] == 'N') {
+				++last;
+			}
+			int value = (instruction.raw >> (12 - last * 4)) & ((1 << ((last - nibble + 1) * 4)) - 1);
+			used += snprintf(out + used, size - used, (last == nibble) ? "%s%d" : "%s0x%02X", separator, value);
+			nibble = last;
+		}
+	}
+}
+
+void rom_analysis::disassemble(chip8 &chip, FILE *out) const
+{
+	uint32_t end = program_end;
+	for (size_t i = 0; i < flow.size(); ++i) {
+		end = std::max(end, flow[i].end);
+	}
+	size_t data_bytes = 0;
+	for (size_t i = 0; i < regions.size(); ++i) {
+		data_bytes += regions[i].end - regions[i].start;
+	}
+
+	fprintf(out, "; rom %016llx  machine %s  %u bytes\n", (unsigned long long)rom_hash, chip8::machineName(machine),
+		(unsigned)(program_end - PROGRAM_START));
+	fprintf(out, "; %u blocks, %u subroutines, %u jump tables, %u data regions (%u bytes)\n",
+		(unsigned)flow.size(), (unsigned)calls.size(), (unsigned)indirect.size(), (unsigned)regions.size(), (unsigned)data_bytes);
+
+	char name[32];
+	char operands[64];
+	uint32_t address = PROGRAM_START;
+	while (address < end) {
+		if (!(kinds[address] & BYTE_CODE)) {
+			// data, 8 bytes a line, a new line at every label
+			if (kinds[address] & BYTE_DATA_LABEL) {
+				label((uint16)address, name, sizeof(name));
+				fprintf(out, "\n%s:\n", name);
+			}
+			fprintf(out, "%04X  ", address);
+			int count = 0;
+			do {
+				fprintf(out, " %02X", chip.memory[address]);
+				++address;
+				++count;
+			} while (count < 8 && address < end && !(kinds[address] & (BYTE_CODE | BYTE_DATA_LABEL)));
+			fprintf(out, "\n");
+			continue;
+		}
+
+		const flow_subroutine *subroutine = subroutineAt((uint16)address);
+		if (subroutine != NULL || (kinds[address] & BYTE_LEADER)) {
+			label((uint16)address, name, sizeof(name));
+			fprintf(out, "\n%s:", name);
+			if (subroutine != NULL) {
+				fprintf(out, "%*s; called from", (int)(36 - strlen(name)), "");
+				for (size_t c = 0; c < subroutine->callers.size(); ++c) {
+					fprintf(out, " %03X", subroutine->callers[c]);
+				}
+			}
+			fprintf(out, "\n");
+		}
+
+		chip8::decoded_instruction instruction;
+		chip.decodeInstruction((uint16)address, instruction);
+		uint32_t length = (instruction.opcode == chip8::_0xF000) ? 4 : 2;
+		formatOperands(chip, instruction, (uint16)address, operands, sizeof(operands));
+
+		char raw[16];
+		if (length == 4) {
+			snprintf(raw, sizeof(raw), "%04X %02X%02X", instruction.raw, chip.memory[(address + 2) & (chip8::MEMORY_SIZE - 1)],
+				chip.memory[(address + 3) & (chip8::MEMORY_SIZE - 1)]);
+		}
+		else {
+			snprintf(raw, sizeof(raw), "%04X", instruction.raw);
+		}
+		fprintf(out, "%04X  %-9s  %-4s  %-18s ; %s", address, raw, chip8_profile::opcodeName(instruction.opcode), operands,
+			chip.opcodes[instruction.opcode].description);
+
+		std::map<uint16, std::vector<uint16> >::const_iterator table = indirect.find((uint16)address);
+		if (table != indirect.end()) {
+			fprintf(out, "  [%u target%s]", (unsigned)table->second.size(), table->second.size() == 1 ? "" : "s");
+		}
+		fprintf(out, "\n");
+		address += length;
+	}
+}
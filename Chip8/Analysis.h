@@ -0,0 +1,121 @@
+#pragma once
+#ifndef _ANALYSIS_H
+#define _ANALYSIS_H
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "Common.h"
+#include "Chip8.h"
+
+/**
+ * Static ROM analysis - the program's control flow, recovered without running it.
+ *
+ * analyze() walks the program from 0x200 through the machine's own decoder (a chip8 with the ROM loaded)
+ *  and follows every path:
+ *      1NNN            jump
+ *      2NNN / 0NNN     call, the target is a subroutine and the path continues after the call
+ *                      (0NNN only into the program, anywhere else it is taken for data)
+ *      00EE / 00FD     return / exit
+ *      skips           the next instruction and the one after it (F000 NNNN as a whole on XO-CHIP)
+ *      BNNN            a jump table:  with V0 (VX under the jump quirk) set by 6XNN earlier in the run
+ *                      the one target, otherwise the run of 1NNN jumps from NNN on (one per even V0)
+ *      ANNN / F000     the new I is a data reference
+ *  Invalid opcodes end a path.
+ *
+ * Whatever was reached is code, the rest of the ROM is data. Blocks are split at every target, so a
+ *  block is only ever entered at its start and ends at its first control flow instruction.
+ *
+ * The flow file (<rom>.flow, written by chip8_analyze) keeps the result next to the ROM:
+ *      rom <hash> <machine>
+ *      block <start> <end> <exit> [successor ...]     hex addresses, end exclusive
+ *      sub <address> [call site ...]
+ *      data <start> <end>
+ *  chip8::prewarm() takes it to fill the decode cache, and on the JIT to compile every block, before
+ *  the first instruction runs. A flow file for another ROM (hash) or machine is refused by load().
+*/
+
+enum flow_exits {
+	FLOW_FALL = 0,      // runs into the next block
+	FLOW_JUMP,
+	FLOW_CALL,
+	FLOW_RETURN,
+	FLOW_SKIP,
+	FLOW_TABLE,         // BNNN
+	FLOW_STOP,          // exit, invalid opcode or a path into data
+	NUMBER_OF_FLOW_EXITS
+};
+
+typedef enum flow_exits FlowExit;
+
+struct flow_block {
+	uint16 start;
+	uint32_t end;
+	FlowExit exit;
+	std::vector<uint16> successors;
+};
+
+struct flow_subroutine {
+	uint16 address;
+	std::vector<uint16> callers;
+};
+
+struct flow_region {
+	uint16 start;
+	uint32_t end;
+};
+
+class rom_analysis {
+public:
+	rom_analysis();
+
+	// 'chip' has the ROM of 'size' bytes (content hash 'hash') loaded on the machine it is meant for
+	void analyze(chip8 &chip, size_t size, uint64 hash);
+
+	bool save(const char *path) const;
+	// false when the file can't be read or belongs to another ROM or machine
+	bool load(const char *path, uint64 expected_hash, chip8::Machine expected_machine);
+
+	// annotated listing:  labels, operands, the opcode table's description, data as hex bytes
+	void disassemble(chip8 &chip, FILE *out) const;
+
+	const std::vector<flow_block> &blocks() const { return flow; }
+	const std::vector<flow_subroutine> &subroutines() const { return calls; }
+	const std::vector<flow_region> &data() const { return regions; }
+
+	// where chip8_analyze writes the flow file of a ROM and the emulators look for it
+	static std::string flowPath(const std::string &rom) { return rom + ".flow"; }
+
+private:
+	// per byte of memory
+	enum byte_kinds {
+		BYTE_UNKNOWN = 0,
+		BYTE_CODE = 1,          // first byte of an instruction
+		BYTE_OPERAND = 2,       // any other byte of an instruction
+		BYTE_LEADER = 4,        // an instruction that starts a block
+		BYTE_DATA_LABEL = 8     // ANNN / F000 point here
+	};
+
+	void walk(chip8 &chip, uint16 entry);
+	void split(chip8 &chip);
+	void findRegions();
+	void addTarget(uint16 target);
+	void addCall(uint16 target, uint16 site);
+	const flow_subroutine *subroutineAt(uint16 address) const;
+	void label(uint16 address, char *out, size_t size) const;
+	void formatOperands(const chip8 &chip, const chip8::decoded_instruction &instruction, uint16 address, char *out, size_t size) const;
+
+	uint64 rom_hash;
+	chip8::Machine machine;
+	uint32_t program_end;
+
+	std::vector<uint8> kinds;
+	std::vector<uint16> pending;
+	std::vector<flow_block> flow;
+	std::vector<flow_subroutine> calls;
+	std::vector<flow_region> regions;
+	std::map<uint16, std::vector<uint16> > indirect;   // targets of every BNNN reached
+};
+
+#endif
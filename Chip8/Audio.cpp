@@ -0,0 +1,279 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "Common.h"
+#include "Chip8.h"
+#include "Audio.h"
+
+#define PATTERN_BITS 128
+#define PATTERN_BASE_RATE 4000.0
+#define PATTERN_BASE_PITCH 64
+
+// the CHIP-8 / SCHIP beep:  4 bits on, 4 off at the base rate = a 500Hz square wave
+static const uint8 square_pattern[16] = {
+	0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0
+};
+
+/**
+ * wav_sink
+ *
+*/
+
+static void put16(uint8 *out, uint32_t value)
+{
+	out[0] = (uint8)value;
+	out[1] = (uint8)(value >> 8);
+}
+
+static void put32(uint8 *out, uint32_t value)
+{
+	put16(out, value & 0xFFFF);
+	put16(out + 2, value >> 16);
+}
+
+// RIFF header, the two sizes are patched by close()
+#define WAV_HEADER_SIZE 44
+
+wav_sink::wav_sink()
+	: file(NULL), samples_written(0)
+{
+}
+
+wav_sink::~wav_sink()
+{
+	close();
+}
+
+bool wav_sink::open(const char *path, int sample_rate)
+{
+	close();
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+
+	uint8 header[WAV_HEADER_SIZE];
+	memcpy(header, "RIFF", 4);
+	put32(header + 4, 0);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put32(header + 16, 16);                         // fmt chunk size
+	put16(header + 20, 1);                          // PCM
+	put16(header + 22, 1);                          // mono
+	put32(header + 24, (uint32_t)sample_rate);
+	put32(header + 28, (uint32_t)sample_rate * 2);  // bytes per second
+	put16(header + 32, 2);                          // bytes per frame
+	put16(header + 34, 16);                         // bits per sample
+	memcpy(header + 36, "data", 4);
+	put32(header + 40, 0);
+	fwrite(header, 1, sizeof(header), file);
+
+	samples_written = 0;
+	return true;
+}
+
+bool wav_sink::write(const int16_t *samples, size_t count)
+{
+	if (file == NULL) {
+		return false;
+	}
+
+	// little endian on disk whatever the host
+	uint8 bytes[chip8_audio::BLOCK_SAMPLES * 2];
+	while (count != 0) {
+		size_t chunk = std::min(count, (size_t)chip8_audio::BLOCK_SAMPLES);
+		for (size_t i = 0; i < chunk; ++i) {
+			put16(bytes + i * 2, (uint16)samples[i]);
+		}
+		if (fwrite(bytes, 2, chunk, file) != chunk) {
+			return false;
+		}
+		samples_written += chunk;
+		samples += chunk;
+		count -= chunk;
+	}
+	return true;
+}
+
+void wav_sink::close()
+{
+	if (file == NULL) {
+		return;
+	}
+
+	uint8 size[4];
+	uint32_t data_bytes = (uint32_t)(samples_written * 2);
+	put32(size, WAV_HEADER_SIZE - 8 + data_bytes);
+	fseek(file, 4, SEEK_SET);
+	fwrite(size, 1, 4, file);
+	put32(size, data_bytes);
+	fseek(file, 40, SEEK_SET);
+	fwrite(size, 1, 4, file);
+
+	fclose(file);
+	file = NULL;
+}
+
+/**
+ * chip8_audio
+ *
+*/
+
+chip8_audio::chip8_audio(audio_sink *sink, int sample_rate)
+	: sink(sink), sample_rate(sample_rate), stopping(false), ticks(0), tick_cycle(0), tick_sample(0), clock(0),
+	  dropped_events(0), has_pending(false), rendered(0), phase(0), step(0), block_used(0)
+{
+	memset(&last, 0, sizeof(last));
+	last.pitch = PATTERN_BASE_PITCH;
+	memcpy(last.pattern, square_pattern, sizeof(last.pattern));
+	apply(last);
+}
+
+chip8_audio::~chip8_audio()
+{
+	stop();
+	delete sink;
+}
+
+void chip8_audio::start()
+{
+	if (!thread.joinable()) {
+		stopping.store(false, std::memory_order_release);
+		thread = std::thread(&chip8_audio::run, this);
+	}
+}
+
+void chip8_audio::stop()
+{
+	if (!thread.joinable()) {
+		return;
+	}
+	// the frame the last tick started plays to its end in the state it was left in
+	clock.store(std::max(clock.load(std::memory_order_relaxed), (ticks + 1) * (uint64)sample_rate / SCREEN_REFRESH_RATE),
+		std::memory_order_release);
+	stopping.store(true, std::memory_order_release);
+	thread.join();
+	sink->close();
+}
+
+void chip8_audio::tick(const chip8 &chip)
+{
+	// tick n closes emulated frame n (counting from 1)
+	++ticks;
+	tick_cycle = chip.cycle;
+	tick_sample = ticks * (uint64)sample_rate / SCREEN_REFRESH_RATE;
+	send(chip, tick_sample);
+
+	// the next frame's instructions may still change the tone (see edge), the audio thread renders up to here
+	clock.store(tick_sample, std::memory_order_release);
+}
+
+void chip8_audio::edge(const chip8 &chip, uint64 at)
+{
+	// the same share of the frame's samples as of its cycles
+	uint64 frame_cycles = (chip.cycles_per_frame > 0) ? (uint64)chip.cycles_per_frame : 1;
+	uint64 into = (at > tick_cycle) ? std::min(at - tick_cycle, frame_cycles) : 0;
+	uint64 next_sample = (ticks + 1) * (uint64)sample_rate / SCREEN_REFRESH_RATE;
+	uint64 sample = tick_sample + into * (next_sample - tick_sample) / frame_cycles;
+	send(chip, sample);
+
+	// instructions run in order, nothing before this one can change the tone any more
+	clock.store(sample, std::memory_order_release);
+}
+
+void chip8_audio::send(const chip8 &chip, uint64 sample)
+{
+	// zeroed first, the padding at the end is compared too
+	audio_event state;
+	memset(&state, 0, sizeof(state));
+	state.sample = sample;
+	state.sounding = (chip.sound_timer > 0) ? 1 : 0;
+	state.use_pattern = (chip.machine == chip8::MACHINE_XOCHIP) ? 1 : 0;
+	state.pitch = state.use_pattern ? chip.pitch : PATTERN_BASE_PITCH;
+	memcpy(state.pattern, state.use_pattern ? chip.audio_pattern : square_pattern, sizeof(state.pattern));
+
+	// everything but the time stamp, a dropped change is sent again on the next tick
+	if (memcmp(&state.sounding, &last.sounding, sizeof(audio_event) - offsetof(audio_event, sounding)) != 0) {
+		if (events.push(state)) {
+			last = state;
+		}
+		else {
+			dropped_events.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+void chip8_audio::run()
+{
+	const std::chrono::microseconds poll(BLOCK_SAMPLES * 1000000LL / sample_rate / 2);
+
+	for (;;) {
+		// stop first, the clock read after it covers every tick
+		bool stop = stopping.load(std::memory_order_acquire);
+		if (!render(clock.load(std::memory_order_acquire))) {
+			return;
+		}
+		if (stop) {
+			break;
+		}
+		std::this_thread::sleep_for(poll);
+	}
+
+	if (block_used != 0) {
+		sink->write(block, block_used);
+		block_used = 0;
+	}
+}
+
+void chip8_audio::apply(const audio_event &event)
+{
+	current = event;
+	double bits_per_second = PATTERN_BASE_RATE * pow(2.0, (event.pitch - PATTERN_BASE_PITCH) / 48.0);
+	step = (uint32_t)(bits_per_second * 65536.0 / sample_rate);
+}
+
+bool chip8_audio::render(uint64 until)
+{
+	while (rendered < until) {
+		// apply the events due at this sample
+		for (;;) {
+			if (!has_pending) {
+				has_pending = events.pop(pending);
+			}
+			if (!has_pending || pending.sample > rendered) {
+				break;
+			}
+			apply(pending);
+			has_pending = false;
+		}
+
+		// then run to the next event, the end of the block or 'until'
+		uint64 end = std::min<uint64>(until, rendered + (BLOCK_SAMPLES - block_used));
+		if (has_pending && pending.sample < end) {
+			end = pending.sample;
+		}
+
+		int16_t *out = block + block_used;
+		size_t count = (size_t)(end - rendered);
+		if (current.sounding) {
+			for (size_t i = 0; i < count; ++i) {
+				uint32_t bit = (phase >> 16) & (PATTERN_BITS - 1);
+				out[i] = ((current.pattern[bit >> 3] >> (7 - (bit & 0x7))) & 0x1) ? AMPLITUDE : -AMPLITUDE;
+				phase = (phase + step) & ((PATTERN_BITS << 16) - 1);
+			}
+		}
+		else {
+			memset(out, 0, count * sizeof(int16_t));
+		}
+		block_used += count;
+		rendered = end;
+
+		if (block_used == BLOCK_SAMPLES) {
+			if (!sink->write(block, BLOCK_SAMPLES)) {
+				return false;
+			}
+			block_used = 0;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#ifndef _AUDIO_H
+#define _AUDIO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include "Common.h"
+#include "SpscQueue.h"
+
+class chip8;
+
+/**
+ * Audio - sound_timer (and the XO-CHIP pattern / pitch) turned into PCM.
+ *
+ * The emulation thread calls tick() from every updateTimers() and edge() right after every FX18
+ *  (chip8::soundTimerWritten, each engine passes the cycle it ended at). Both compare the machine's
+ *  audio state with the last one sent and, when it changed, push an audio_event into a lock-free
+ *  ring, then publish the new clock. A tick's event is stamped with the tick's sample position, an
+ *  edge's with the sample of its cycle within the frame - a tone starts and stops with the
+ *  instruction, not up to a frame (16.7ms) later. The XO-CHIP pattern and pitch (F002, FX3A) go out
+ *  with the next tick or edge. Nothing on that side allocates, locks or waits, a full ring drops the
+ *  event and counts it.
+ *
+ * The audio thread renders BLOCK_SAMPLES at a time into a fixed buffer, applying each event at its
+ *  own sample, and hands full blocks to the sink. It never renders past the published clock (the last
+ *  tick or edge), so a headless run faster than real time still produces audio on the emulated timeline.
+ *  One block is 5.8ms at 44.1kHz, the thread polls twice per block:  a real time sink is at most
+ *  about a block and a half behind the emulation.
+ *
+ * Tone:  CHIP-8 and SCHIP play a square wave while sound_timer > 0, XO-CHIP plays its 128 bit
+ *  pattern (F002) at 4000 * 2^((pitch - 64) / 48) bits per second (FX3A).
+*/
+
+// the machine's audio state from a tick on
+struct audio_event {
+	uint64 sample;
+	uint8 sounding;
+	uint8 use_pattern;          // XO-CHIP, otherwise the fixed square wave
+	uint8 pitch;
+	uint8 reserved;
+	uint8 pattern[16];
+};
+
+// where rendered blocks go
+class audio_sink {
+public:
+	virtual ~audio_sink() {}
+
+	// mono signed 16 bit samples, false stops the rendering
+	virtual bool write(const int16_t *samples, size_t count) = 0;
+	virtual void close() {}
+};
+
+// 16 bit mono PCM .wav, the sizes in the header are filled in by close()
+class wav_sink : public audio_sink {
+public:
+	wav_sink();
+	~wav_sink();
+
+	bool open(const char *path, int sample_rate);
+	bool write(const int16_t *samples, size_t count);
+	void close();
+
+private:
+	wav_sink(const wav_sink &);
+	wav_sink &operator=(const wav_sink &);
+
+	FILE *file;
+	uint64 samples_written;
+};
+
+class chip8_audio {
+public:
+	static const int DEFAULT_SAMPLE_RATE = 44100;
+	static const int BLOCK_SAMPLES = 256;
+	static const int AMPLITUDE = 8000;
+
+	// takes ownership of the sink
+	chip8_audio(audio_sink *sink, int sample_rate = DEFAULT_SAMPLE_RATE);
+	~chip8_audio();
+
+	void start();
+	// renders everything up to the last tick, then closes the sink
+	void stop();
+
+	// emulation thread, once per timer tick before the timers count down
+	void tick(const chip8 &chip);
+	// emulation thread, after an FX18 that ended at emulated cycle 'at' (between this tick and the next)
+	void edge(const chip8 &chip, uint64 at);
+
+	uint64 dropped() const { return dropped_events.load(std::memory_order_relaxed); }
+
+private:
+	chip8_audio(const chip8_audio &);
+	chip8_audio &operator=(const chip8_audio &);
+
+	void send(const chip8 &chip, uint64 sample);
+	void run();
+	bool render(uint64 until);
+	void apply(const audio_event &event);
+
+	audio_sink *sink;
+	int sample_rate;
+	std::thread thread;
+	std::atomic<bool> stopping;
+
+	// emulation side
+	SpscQueue<audio_event, 256> events;
+	audio_event last;
+	uint64 ticks;
+	uint64 tick_cycle;              // the emulated cycle and sample of the last tick
+	uint64 tick_sample;
+	std::atomic<uint64> clock;      // samples up to the last tick or edge
+	std::atomic<uint64> dropped_events;
+
+	// audio thread side
+	audio_event current;
+	audio_event pending;
+	bool has_pending;
+	uint64 rendered;
+	uint32_t phase;                 // 16.16 fixed point bit position in the pattern
+	uint32_t step;                  // bits per sample, same format
+	size_t block_used;
+	int16_t block[BLOCK_SAMPLES];
+};
+
+#endif
@@ -1,144 +1,341 @@
 #include "stdio.h"  // debug and loader only
 #include "stdlib.h"
+#include "string.h"
 #include "time.h"
+#include "limits.h"
+#include <algorithm>
 #include "Common.h"
 #include "Chip8.h"
 #include "Debug.h"
+#include "Log.h"
+#include "Jit.h"
+#include "Rom.h"
+#include "Trace.h"
+#include "Audio.h"
+#include "Analysis.h"
+#include "Input.h"
+
+#ifdef CHIP8_PROFILE
+#include "Timer.h"
+#include "Profiler.h"
+#endif
+
+#ifdef CHIP8_SSE2
+#include <emmintrin.h>
+#endif
 
 chip8::chip8()
 {
-	// empty constructor
+	// the interpreter is the default engine, the jit is only created when selected
+	engine = ENGINE_INTERPRETER;
+	decode_cache = NULL;
+	decode_cache_size = 0;
+	decode_miss = 0x1;
+	jit = NULL;
+	faulted = false;
+	exit_on_fault = true;
+	random_state = 1;
+#ifdef CHIP8_PROFILE
+	profile = NULL;
+#endif
+	trace = NULL;
+	audio = NULL;
+	input_recorder = NULL;
+
+	// the opcode table starts out with the modern routines
+	quirk_profile = QUIRKS_MODERN;
+	useQuirks<quirks_modern>();
+
+	fast_forward = true;
+	idle_cycles = 0;
+	fusion = true;
+
+	cycle = 0;
+	frames = 0;
+	cycles_per_frame = TARGET_CLOCK_SPEED / SCREEN_REFRESH_RATE;
+	vblank = false;
+
+	machine = MACHINE_CHIP8;
+	allocateDecodeCache();
+	hires = false;
+	planes = 0x1;
+	memset(rpl, 0, sizeof(rpl));
+	memset(audio_pattern, 0, sizeof(audio_pattern));
+	pitch = 64;
 }
 
 chip8::~chip8()
 {
-	// empty destructor
+	stopTrace();
+	stopAudio();
+	delete jit;
+	delete[] decode_cache;
+#ifdef CHIP8_PROFILE
+	delete profile;
+#endif
 }
 
-chip8::Opcode chip8::translate_opcode(uint16 opcode) {
+#ifdef CHIP8_PROFILE
+void chip8::enableProfiling()
+{
+	if (profile == NULL) {
+		profile = new chip8_profile;
+	}
+	profile->reset();
+}
+#endif
+
+bool chip8::setEngine(Engine selected)
+{
+	if (selected == ENGINE_JIT) {
+		if (!chip8_jit::supported()) {
+			LOG_WARN(LOG_JIT_UNSUPPORTED);
+			return false;
+		}
+		if (jit == NULL) {
+			jit = new chip8_jit(*this);
+		}
+		if (trace != NULL) {
+			LOG_WARN(LOG_TRACE_ENGINE);
+		}
+	}
+
+	engine = selected;
+	return true;
+}
+
+void chip8::setQuirks(QuirkProfile selected)
+{
+	switch (selected) {
+	case QUIRKS_VIP:    useQuirks<quirks_vip>(); break;
+	case QUIRKS_SCHIP:  useQuirks<quirks_schip>(); break;
+	case QUIRKS_XOCHIP: useQuirks<quirks_xochip>(); break;
+	case QUIRKS_MODERN:
+	default:
+		selected = QUIRKS_MODERN;
+		useQuirks<quirks_modern>();
+		break;
+	}
+	quirk_profile = selected;
+
+	// decoded instructions and compiled blocks still point at the old routines
+	invalidateDecodeCache();
+}
+
+void chip8::setMachine(Machine selected)
+{
+	static const QuirkProfile machine_quirks[NUMBER_OF_MACHINES] = { QUIRKS_MODERN, QUIRKS_SCHIP, QUIRKS_XOCHIP };
+
+	machine = (selected < NUMBER_OF_MACHINES) ? selected : MACHINE_CHIP8;
+
+	// the cache and the JIT's tables cover the memory the machine can reach, a JIT in use is rebuilt for the new size
+	if (decode_cache_size != programMemory() / 2) {
+		allocateDecodeCache();
+		delete jit;
+		jit = NULL;
+		if (engine == ENGINE_JIT) {
+			setEngine(ENGINE_JIT);
+		}
+	}
+
+	// the new instructions only decode on the machines that have them
+	setQuirks(machine_quirks[machine]);
+}
+
+static const char *machine_names[chip8::NUMBER_OF_MACHINES] = { "chip8", "schip", "xochip" };
+static const char *quirk_names[chip8::NUMBER_OF_QUIRK_PROFILES] = { "modern", "vip", "schip", "xochip" };
+
+bool chip8::parseMachine(const char *name, Machine &selected)
+{
+	for (int i = 0; i < NUMBER_OF_MACHINES; ++i) {
+		if (strcmp(name, machine_names[i]) == 0) {
+			selected = (Machine)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool chip8::parseQuirks(const char *name, QuirkProfile &profile)
+{
+	for (int i = 0; i < NUMBER_OF_QUIRK_PROFILES; ++i) {
+		if (strcmp(name, quirk_names[i]) == 0) {
+			profile = (QuirkProfile)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *chip8::machineName(Machine selected)
+{
+	return (selected >= 0 && selected < NUMBER_OF_MACHINES) ? machine_names[selected] : "unknown";
+}
+
+const char *chip8::quirksName(QuirkProfile profile)
+{
+	return (profile >= 0 && profile < NUMBER_OF_QUIRK_PROFILES) ? quirk_names[profile] : "unknown";
+}
+
+// point every quirk dependent entry of the opcode table (and the threaded engine) at the 'Quirks' instantiation
+template <class Quirks>
+void chip8::useQuirks()
+{
+	opcodes[_0x8XY1].executor = &chip8::opcode_0x8XY1<Quirks>;
+	opcodes[_0x8XY2].executor = &chip8::opcode_0x8XY2<Quirks>;
+	opcodes[_0x8XY3].executor = &chip8::opcode_0x8XY3<Quirks>;
+	opcodes[_0x8XY6].executor = &chip8::opcode_0x8XY6<Quirks>;
+	opcodes[_0x8XYE].executor = &chip8::opcode_0x8XYE<Quirks>;
+	opcodes[_0xBNNN].executor = &chip8::opcode_0xBNNN<Quirks>;
+	opcodes[_0xDXYN].executor = &chip8::opcode_0xDXYN<Quirks>;
+	opcodes[_0xFX55].executor = &chip8::opcode_0xFX55<Quirks>;
+	opcodes[_0xFX65].executor = &chip8::opcode_0xFX65<Quirks>;
+
+	threaded = &chip8::threadedLoop<Quirks>;
+	threaded_traced = &chip8::threadedLoop<Quirks, true>;
+	quirks = quirk_settings::of<Quirks>();
+}
+
+// what a raw opcode is on each machine, only ever evaluated by the compiler (see opcode_lookup)
+//  each group returns on its own, an opcode no machine defines is INVALID_OPCODE
+constexpr chip8::Opcode chip8::decodeOpcode(Machine machine, uint16 opcode)
+{
 	switch (opcode & 0xF000) {
 	case 0x0000:
-		switch (opcode & 0x0FFF) {
-		case 0x00E0:
+		if (opcode == 0x00E0) {
 			return _0x00E0;
-			break;
-		case 0x00EE:
+		}
+		if (opcode == 0x00EE) {
 			return _0x00EE;
-			break;
-		default:
-			return _0x0NNN;
-			break;
 		}
+		if (machine != MACHINE_CHIP8 && opcode >= 0x00FB && opcode <= 0x00FF) {
+			return (Opcode)(_0x00FB + (opcode - 0x00FB));
+		}
+		if (machine != MACHINE_CHIP8 && (opcode & 0xFFF0) == 0x00C0) {
+			return _0x00CN;
+		}
+		if (machine == MACHINE_XOCHIP && (opcode & 0xFFF0) == 0x00D0) {
+			return _0x00DN;
+		}
+		return _0x0NNN;
+
 	case 0x1000:
 		return _0x1NNN;
-		break;
 	case 0x2000:
 		return _0x2NNN;
-		break;
 	case 0x3000:
 		return _0x3XNN;
-		break;
 	case 0x4000:
 		return _0x4XNN;
-		break;
+
 	case 0x5000:
+		if (machine == MACHINE_XOCHIP && (opcode & 0x000F) == 0x0002) {
+			return _0x5XY2;
+		}
+		if (machine == MACHINE_XOCHIP && (opcode & 0x000F) == 0x0003) {
+			return _0x5XY3;
+		}
 		return _0x5XY0;
-		break;
+
 	case 0x6000:
 		return _0x6XNN;
-		break;
 	case 0x7000:
 		return _0x7XNN;
-		break;
+
 	case 0x8000:
 		switch (opcode & 0x000F) {
-		case 0x0000:
-			return _0x8XY0;
-			break;
-		case 0x0001:
-			return _0x8XY1;
-			break;
-		case 0x0002:
-			return _0x8XY2;
-			break;
-		case 0x0003:
-			return _0x8XY3;
-			break;
-		case 0x0004:
-			return _0x8XY4;
-			break;
-		case 0x0005:
-			return _0x8XY5;
-			break;
-		case 0x0006:
-			return _0x8XY6;
-			break;
-		case 0x0007:
-			return _0x8XY7;
-			break;
-		case 0x000E:
-			return _0x8XYE;
-			break;
+		case 0x0000: return _0x8XY0;
+		case 0x0001: return _0x8XY1;
+		case 0x0002: return _0x8XY2;
+		case 0x0003: return _0x8XY3;
+		case 0x0004: return _0x8XY4;
+		case 0x0005: return _0x8XY5;
+		case 0x0006: return _0x8XY6;
+		case 0x0007: return _0x8XY7;
+		case 0x000E: return _0x8XYE;
+		default:     return INVALID_OPCODE;
 		}
+
 	case 0x9000:
 		return _0x9XY0;
-		break;
 	case 0xA000:
 		return _0xANNN;
-		break;
 	case 0xB000:
 		return _0xBNNN;
-		break;
 	case 0xC000:
 		return _0xCXNN;
-		break;
 	case 0xD000:
 		return _0xDXYN;
-		break;
+
 	case 0xE000:
 		switch (opcode & 0x00FF) {
-		case 0x009E:
-			return _0xEX9E;
-			break;
-		case 0x00A1:
-			return _0xEX9E;
-			break;
+		case 0x009E: return _0xEX9E;
+		case 0x00A1: return _0xEXA1;
+		default:     return INVALID_OPCODE;
+		}
+
+	default:    // 0xF000
+		if (machine == MACHINE_XOCHIP) {
+			if (opcode == 0xF000) {
+				return _0xF000;
+			}
+			if (opcode == 0xF002) {
+				return _0xF002;
+			}
+			if ((opcode & 0x00FF) == 0x0001) {
+				return _0xFN01;
+			}
+			if ((opcode & 0x00FF) == 0x003A) {
+				return _0xFX3A;
+			}
+		}
+		if (machine != MACHINE_CHIP8) {
+			switch (opcode & 0x00FF) {
+			case 0x0030: return _0xFX30;
+			case 0x0075: return _0xFX75;
+			case 0x0085: return _0xFX85;
+			default:     break;
+			}
 		}
-	case 0xF000:
 		switch (opcode & 0x00FF) {
-		case 0x0007:
-			return _0xFX07;
-			break;
-		case 0x000A:
-			return _0xFX0A;
-			break;
-		case 0x0015:
-			return _0xFX15;
-			break;
-		case 0x0018:
-			return _0xFX18;
-			break;
-		case 0x001E:
-			return _0xFX1E;
-			break;
-		case 0x0029:
-			return _0xFX29;
-			break;
-		case 0x0033:
-			return _0xFX33;
-			break;
-		case 0x0055:
-			return _0xFX55;
-			break;
-		case 0x0065:
-			return _0xFX65;
-			break;
+		case 0x0007: return _0xFX07;
+		case 0x000A: return _0xFX0A;
+		case 0x0015: return _0xFX15;
+		case 0x0018: return _0xFX18;
+		case 0x001E: return _0xFX1E;
+		case 0x0029: return _0xFX29;
+		case 0x0033: return _0xFX33;
+		case 0x0055: return _0xFX55;
+		case 0x0065: return _0xFX65;
+		default:     return INVALID_OPCODE;
 		}
+	}
+}
 
-	default:
-		return INVALID_OPCODE;
-		break;
+// every raw opcode of every machine, 64K per machine.
+//  MSVC needs /constexpr:steps raised to build it, see the project files
+struct opcode_table {
+	int8_t opcodes[chip8::NUMBER_OF_MACHINES][chip8::MEMORY_SIZE];
+
+	constexpr opcode_table() : opcodes() {
+		for (int machine = 0; machine < chip8::NUMBER_OF_MACHINES; ++machine) {
+			for (uint32_t opcode = 0; opcode < chip8::MEMORY_SIZE; ++opcode) {
+				opcodes[machine][opcode] = (int8_t)chip8::decodeOpcode((chip8::Machine)machine, (uint16)opcode);
+			}
+		}
 	}
+};
+
+static constexpr opcode_table opcode_lookup;
+
+// the groups that used to fall through into the next one
+static_assert(opcode_lookup.opcodes[chip8::MACHINE_CHIP8][0x8AB8] == chip8::INVALID_OPCODE, "8XY8 is not 9XY0");
+static_assert(opcode_lookup.opcodes[chip8::MACHINE_CHIP8][0xE1A1] == chip8::_0xEXA1, "EXA1 is not EX9E");
+static_assert(opcode_lookup.opcodes[chip8::MACHINE_XOCHIP][0xE000] == chip8::INVALID_OPCODE, "E000 is not F000");
+static_assert(opcode_lookup.opcodes[chip8::MACHINE_CHIP8][0xF000] == chip8::INVALID_OPCODE, "F000 is XO-CHIP only");
+
+chip8::Opcode chip8::translate_opcode(uint16 opcode) {
+	return (Opcode)opcode_lookup.opcodes[machine][opcode];
 }
 
 void chip8::initialize()
@@ -149,10 +346,10 @@ void chip8::initialize()
 	sp = 0;				// reset stack pointer
 
 	 // clear display
-    memset(gfx, 0, sizeof(uint8) * GFX_SIZE);
+    clearScreen(0x3);
 
 	// clear stack
-    memset(stack, 0, STACK_LEVELS); 
+    memset(stack, 0, sizeof(stack));
 
 	// clear registers V0 through VF
     memset(V, 0, sizeof(uint8) * REGISTER_COUNT); 
@@ -165,21 +362,438 @@ void chip8::initialize()
 
 	// load fontset
     memcpy(memory, chip8_fontset, sizeof(uint8) * 80);
+    memcpy(memory + FONT_LARGE_ADDRESS, chip8_fontset_large, sizeof(chip8_fontset_large));
+
+	// every program starts in lo-res, drawing on the first plane
+	hires = false;
+	planes = 0x1;
 
 	// reset timers
 	delay_timer = 0;
 	sound_timer = 0;
 
+	// emulated time starts over, the first vblank comes after a frame of instructions
+	cycle = 0;
+	vblank = false;
+	scheduler.clear();
+	scheduler.schedule(cycles_per_frame, EVENT_VBLANK);
+
+	// nothing has been decoded from the fresh memory yet
+	invalidateDecodeCache();
+
 	// signal a screen clear
 	drawFlag = true;
 
-    srand(time(NULL));
+	faulted = false;
+	seedRandom((uint32_t)time(NULL));
+}
+
+void chip8::seedRandom(uint32_t seed)
+{
+	// xorshift can't leave the all zero state
+	random_state = (seed != 0) ? seed : 0x2545F491;
+}
+
+uint8 chip8::nextRandom()
+{
+	// xorshift32
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return (uint8)(random_state >> 24);
+}
+
+void chip8::fault()
+{
+	faulted = true;
+	if (exit_on_fault) {
+		chip8_log::flush();
+		getchar();
+		exit(1);
+	}
 }
 
 void chip8::emulateCycle()
 {
+	// FETCH + DECODE OPCODE
+	// instructions are normally word aligned, so the decoded form is looked up from the cache by pc / 2
+	//  and only translated the first time that address is executed (or after the memory was written).
+	//  an odd pc is legal but rare, it is decoded into a temporary every time.
+	decoded_instruction uncached;
+	decoded_instruction *instruction = &uncached;
+	bool decoded = true;
+
+	if ((pc & decode_miss) == 0) {
+		instruction = &decode_cache[pc >> 1];
+		if (!instruction->valid) {
+			decoded = decodeInstruction(pc, *instruction);
+		}
+	}
+	else {
+		decoded = decodeInstruction(pc, uncached);
+	}
+
+	if (!decoded) {
+		LOG_WARN(LOG_INVALID_OPCODE, instruction->raw, pc);
+		fault();
+		return;
+	}
+
+#ifdef CHIP8_PROFILE
+	uint16 profiled_pc = pc;
+	Clock::time_point profile_start;
+	if (profile != NULL) {
+		profile_start = Clock::now();
+	}
+#endif
+
+	// execute the opcode
+	bool result = (this->*(instruction->executor))(*instruction);
+
+#ifdef CHIP8_PROFILE
+	if (profile != NULL) {
+		profile->record(instruction->opcode, profiled_pc,
+			std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - profile_start).count());
+	}
+#endif
+	if (!result) {
+		LOG_WARN(LOG_OPCODE_FAILED, instruction->raw, pc);
+		fault();
+	}
+}
+
+int chip8::emulateCycles(int cycles)
+{
+	// run a batch of instructions on the selected engine, the caller ticks the timers in between batches
+	Engine selected = engine;
+#ifdef CHIP8_PROFILE
+	// every instruction has to pass the hooks in emulateCycle
+	if (profile != NULL) {
+		selected = ENGINE_INTERPRETER;
+	}
+#endif
+
+	// traced runs record every instruction (no superinstructions, no idle fast-forward). The JIT's blocks
+	//  can't stop for that, its traced runs take the threaded engine (startTrace warns)
+	if (trace != NULL) {
+		if (selected != ENGINE_INTERPRETER) {
+			return (this->*threaded_traced)(cycles);
+		}
+		for (int i = 0; i < cycles; ) {
+			if (faulted) {
+				return i;
+			}
+			uint8 sound = sound_timer;
+			tracedCycle();
+			++i;
+			if (sound_timer != sound && audio != NULL) {
+				soundTimerWritten(cycle + i);
+			}
+		}
+		return cycles;
+	}
+
+	switch (selected) {
+	case ENGINE_JIT:
+		return jit->execute(cycles);
+
+	case ENGINE_THREADED:
+		return (this->*threaded)(cycles);
+
+	case ENGINE_INTERPRETER:
+	default: {
+		bool fuse = fusion;
+#ifdef CHIP8_PROFILE
+		fuse = fuse && (profile == NULL);
+#endif
+		for (int i = 0; i < cycles; ) {
+			if (faulted) {
+				return i;
+			}
+			if (fast_forward) {
+				i += skipIdle(cycles - i);
+				if (i == cycles) {
+					return cycles;
+				}
+			}
+
+			// a superinstruction only runs when the whole of it fits in the batch, any other cached
+			//  instruction is dispatched from here instead of being looked up again by emulateCycle
+			decoded_instruction *head = &decode_cache[pc >> 1];
+			if (fuse && (pc & decode_miss) == 0 && head->valid) {
+				if (head->fused_length != 1) {
+					if (head->fused_length == 0) {
+						fuseInstruction(pc);
+					}
+					if (head->fused_length > 1 && head->fused_length <= cycles - i) {
+						i += (this->*(head->fused))(head);
+						continue;
+					}
+				}
+				if (!(this->*(head->executor))(*head)) {
+					LOG_WARN(LOG_OPCODE_FAILED, head->raw, pc);
+					fault();
+				}
+				++i;
+				if (head->opcode == _0xFX18 && audio != NULL) {
+					soundTimerWritten(cycle + i);
+				}
+				continue;
+			}
+			// only an FX18 changes the sound timer between ticks
+			uint8 sound = sound_timer;
+			emulateCycle();
+			++i;
+			if (sound_timer != sound && audio != NULL) {
+				soundTimerWritten(cycle + i);
+			}
+		}
+		return cycles;
+	}
+	}
+}
+
+int chip8::run(int cycles, bool until_vblank)
+{
+	int executed = 0;
+	bool vblanked = advance(0);
+
+	while (executed < cycles && !faulted && !(until_vblank && vblanked)) {
+		int slice = std::min(cycles - executed, cyclesUntilEvent());
+		int done = emulateCycles(slice);
+		executed += done;
+		vblanked = advance(done);
+		if (done < slice) {
+			break;
+		}
+	}
+	return executed;
+}
+
+int chip8::cyclesUntilEvent() const
+{
+	uint64 next = scheduler.nextCycle();
+	if (next <= cycle) {
+		return 0;
+	}
+	return (next - cycle > INT_MAX) ? INT_MAX : (int)(next - cycle);
+}
+
+bool chip8::advance(int cycles)
+{
+	cycle += cycles;
+
+	bool vblanked = false;
+	scheduled_event event;
+	while (scheduler.pop(cycle, event)) {
+		switch (event.kind) {
+		case EVENT_VBLANK:
+			updateTimers();
+			vblank = true;
+			++frames;
+			vblanked = true;
+			scheduler.schedule(event.cycle + cycles_per_frame, EVENT_VBLANK);
+			break;
+
+		case EVENT_KEY:
+			key[event.key & (KEY_STATES - 1)] = event.pressed ? 1 : 0;
+			if (input_recorder != NULL) {
+				input_recorder->record(cycle, event.key & (KEY_STATES - 1), event.pressed);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+	return vblanked;
+}
+
+void chip8::setClock(int hz)
+{
+	cycles_per_frame = (hz >= SCREEN_REFRESH_RATE) ? hz / SCREEN_REFRESH_RATE : 1;
+	scheduler.cancel(EVENT_VBLANK);
+	scheduler.schedule(cycle + cycles_per_frame, EVENT_VBLANK);
+}
+
+void chip8::queueKey(uint64 at, uint8 key_index, bool pressed)
+{
+	scheduler.schedule((at > cycle) ? at : cycle, EVENT_KEY, key_index, pressed);
+}
+
+bool chip8::startTrace(const char *path)
+{
+	stopTrace();
+	trace = new trace_recorder();
+	if (!trace->open(path)) {
+		delete trace;
+		trace = NULL;
+		return false;
+	}
+	if (engine == ENGINE_JIT) {
+		LOG_WARN(LOG_TRACE_ENGINE);
+	}
+	return true;
+}
+
+void chip8::stopTrace()
+{
+	if (trace != NULL) {
+		trace->close();
+		delete trace;
+		trace = NULL;
+	}
+}
+
+void chip8::startAudio(audio_sink *sink)
+{
+	stopAudio();
+	audio = new chip8_audio(sink);
+	audio->start();
+
+	// compiled FX18s don't report their cycle, the JIT leaves them to its dispatcher from now on
+	if (jit != NULL) {
+		jit->invalidateAll();
+	}
+}
+
+void chip8::stopAudio()
+{
+	delete audio;
+	audio = NULL;
+}
+
+void chip8::soundTimerWritten(uint64 at)
+{
+	if (audio != NULL) {
+		audio->edge(*this, at);
+	}
+}
+
+uint16 chip8::memoryWriteLength(uint16 opcode) const
+{
+	uint16 x = (opcode & 0x0F00) >> 8;
+	uint16 y = (opcode & 0x00F0) >> 4;
+
+	if ((opcode & 0xF0FF) == 0xF033) {
+		return 3;
+	}
+	if ((opcode & 0xF0FF) == 0xF055) {
+		return x + 1;
+	}
+	if ((opcode & 0xF00F) == 0x5002 && machine == MACHINE_XOCHIP) {
+		return ((x > y) ? x - y : y - x) + 1;
+	}
+	return 0;
+}
+
+chip8::IdleLoop chip8::idleLoopShape(uint16 address) const
+{
+	// every idle loop starts with 1NNN, EXxx or FXxx, or is a DXYN waiting for the display
+	uint8 group = memory[address & (MEMORY_SIZE - 1)] >> 4;
+	if (group == 0xD) {
+		return quirks.display_wait ? IDLE_DISPLAY_WAIT : IDLE_NONE;
+	}
+	if (group != 0x1 && group != 0xE && group != 0xF) {
+		return IDLE_NONE;
+	}
+
+	uint16 first = memory[address & (MEMORY_SIZE - 1)] << 8 | memory[(address + 1) & (MEMORY_SIZE - 1)];
+	uint16 second = memory[(address + 2) & (MEMORY_SIZE - 1)] << 8 | memory[(address + 3) & (MEMORY_SIZE - 1)];
+	uint16 third = memory[(address + 4) & (MEMORY_SIZE - 1)] << 8 | memory[(address + 5) & (MEMORY_SIZE - 1)];
+	uint16 jump_back = 0x1000 | address;
+	uint16 x = first & 0x0F00;
+
+	if (address > 0x0FFF) {
+		// 1NNN can't jump back up here, FX0A is the only wait left
+		return ((first & 0xF0FF) == 0xF00A) ? IDLE_KEY_WAIT : IDLE_NONE;
+	}
+	if (first == jump_back) {
+		return IDLE_SELF_JUMP;
+	}
+	if ((first & 0xF0FF) == 0xF00A) {
+		return IDLE_KEY_WAIT;
+	}
+	if (((first & 0xF0FF) == 0xE09E || (first & 0xF0FF) == 0xE0A1) && second == jump_back) {
+		return IDLE_KEY_POLL;
+	}
+	if ((first & 0xF0FF) == 0xF007 && ((second & 0xFF00) == (0x3000 | x) || (second & 0xFF00) == (0x4000 | x)) && third == jump_back) {
+		return IDLE_DELAY_POLL;
+	}
+	return IDLE_NONE;
+}
+
+// only the scheduled events (timer ticks, vblank, keys) can end these loops, none of them comes in
+//  the middle of an emulateCycles batch
+chip8::IdleLoop chip8::idleLoop() const
+{
+	IdleLoop loop = idleLoopShape(pc);
+	uint8 x = memory[pc & (MEMORY_SIZE - 1)] & 0x0F;
+
+	switch (loop) {
+	case IDLE_KEY_WAIT:
+		for (int i = 0; i < KEY_STATES; ++i) {
+			if (key[i] == 1) {
+				return IDLE_NONE;
+			}
+		}
+		return loop;
+
+	case IDLE_KEY_POLL: {
+		// EX9E skips out of the loop once the key is down, EXA1 once it is up
+		if (V[x] > 0xF) {
+			return IDLE_NONE;
+		}
+		bool pressed = (key[V[x]] == 1);
+		bool skip_on_press = (memory[(pc + 1) & (MEMORY_SIZE - 1)] == 0x9E);
+		return (pressed == skip_on_press) ? IDLE_NONE : loop;
+	}
+
+	case IDLE_DELAY_POLL: {
+		// 3XNN leaves the loop once the timer reaches NN, 4XNN once it moves off NN
+		uint8 nn = memory[(pc + 3) & (MEMORY_SIZE - 1)];
+		bool skip_on_equal = ((memory[(pc + 2) & (MEMORY_SIZE - 1)] & 0xF0) == 0x30);
+		return ((delay_timer == nn) == skip_on_equal) ? IDLE_NONE : loop;
+	}
+
+	case IDLE_DISPLAY_WAIT:
+		return vblank ? IDLE_NONE : loop;
+
+	default:
+		return loop;
+	}
+}
+
+int chip8::skipIdle(int remaining)
+{
+	if (remaining <= 0) {
+		return 0;
+	}
+
+	IdleLoop loop = idleLoop();
+	if (loop == IDLE_NONE) {
+		return 0;
+	}
+
+	// whole passes only, each one ends back on the loop's first instruction with nothing changed, the
+	//  caller runs what is left of the batch as usual
+	int length = (loop == IDLE_DELAY_POLL) ? 3 : (loop == IDLE_KEY_POLL) ? 2 : 1;
+	int skipped = remaining - remaining % length;
+	if (skipped == 0) {
+		return 0;
+	}
+
+	// the poll would have kept loading the (unchanged) timer
+	if (loop == IDLE_DELAY_POLL) {
+		V[memory[pc & (MEMORY_SIZE - 1)] & 0x0F] = delay_timer;
+	}
+
+	idle_cycles += skipped;
+	return skipped;
+}
 
-	// FETCH OPCODE
+bool chip8::decodeInstruction(uint16 address, decoded_instruction &instruction)
+{
 	// each opcode is 2 bytes long, need to get pc and pc+1 to get the full
 	//  opcode then merge them with bitwise OR operator
 	//  Memory:  
@@ -190,94 +804,258 @@ void chip8::emulateCycle()
 	//  opcode = 0x00 0xA2
 	//  opcode = 0xA2 0x00  (0xA2) << 8
 	//  opcode = 0xA2 0xF0  
-	uint16 raw_opcode = memory[pc] << 8 | memory[pc + 1];
-
-	// decode opcode
-	Opcode opcode = translate_opcode(raw_opcode);  // this should really just be identifed as a hash into a bucket map below
+	uint16 raw_opcode = memory[address & (MEMORY_SIZE - 1)] << 8 | memory[(address + 1) & (MEMORY_SIZE - 1)];
+
+	instruction.raw = raw_opcode;
+	instruction.opcode = translate_opcode(raw_opcode);
+	instruction.x = (raw_opcode & 0x0F00) >> 8;
+	instruction.y = (raw_opcode & 0x00F0) >> 4;
+	instruction.n = raw_opcode & 0x000F;
+	instruction.nn = raw_opcode & 0x00FF;
+	instruction.nnn = raw_opcode & 0x0FFF;
+	instruction.fused = NULL;
+	instruction.fused_length = 0;
+	instruction.skip = 4;
+	if (machine == MACHINE_XOCHIP && memory[(address + 2) & (MEMORY_SIZE - 1)] == 0xF0 && memory[(address + 3) & (MEMORY_SIZE - 1)] == 0x00) {
+		instruction.skip = 6;
+	}
 
-	if (opcode == INVALID_OPCODE) {
-		debug_fmt_msg("Invalid Opcode parsed from loaded file:  %i", raw_opcode);
-		getchar();
-		exit(1);
+	if (instruction.opcode == INVALID_OPCODE) {
+		// never cache an invalid decode, the memory may still be rewritten before it is reached again
+		instruction.executor = NULL;
+		instruction.valid = false;
+		return false;
 	}
 
 	// get the implementation:  Uses the numerical behavior of enum values to get the correct opcode impl via it's index
-	opcode_impl func = opcodes[opcode].executor;
+	instruction.executor = opcodes[instruction.opcode].executor;
+	instruction.valid = true;
+	return true;
+}
 
-	// execute the opcode
-	bool result = (this->*func)(raw_opcode);
-	if (!result) {
-		debug_simple_msg("Unexepcted result from opcode execution, exiting...");
-		getchar();
-		exit(1);
+void chip8::allocateDecodeCache()
+{
+	delete[] decode_cache;
+	decode_cache_size = programMemory() / 2;
+	decode_cache = new decoded_instruction[decode_cache_size];
+	decode_miss = (uint16)(~(programMemory() - 1) | 0x1);
+	for (uint32_t i = 0; i < decode_cache_size; ++i) {
+		decode_cache[i].valid = false;
 	}
 }
 
-bool chip8::loadApp(char *filename)
+void chip8::invalidateDecodeCache()
 {
-	// initialize chip8
-	initialize();
+	for (uint32_t i = 0; i < decode_cache_size; ++i) {
+		decode_cache[i].valid = false;
+	}
+
+	if (jit != NULL) {
+		jit->invalidateAll();
+	}
+}
+
+void chip8::invalidateDecodeCache(uint16 address)
+{
+	// a write to either byte of a word changes the instruction that starts at the even address,
+	//  and the skip length of the instruction before it (XO-CHIP F000 NNNN)
+	for (int back = 0; back <= FUSE_MAX; ++back) {
+		decoded_instruction *head = cachedInstruction((uint16)((address & ~0x1) - 2 * back));
+		if (head == NULL) {
+			continue;
+		}
+		if (back <= 1) {
+			head->valid = false;
+		}
+		else {
+			// a superinstruction starting further back may run over either of them, it is looked for again
+			head->fused = NULL;
+			head->fused_length = 0;
+		}
+	}
+
+	if (jit != NULL) {
+		jit->invalidate(address);
+	}
+}
+
+void chip8::fuseInstruction(uint16 address)
+{
+	decoded_instruction *head = &decode_cache[address >> 1];
+	head->fused = NULL;
+	head->fused_length = 1;
+
+	// only sequences that start the way one of the superinstructions does, and that lie in the
+	//  cache as a whole (they never wrap around the end of memory)
+	Opcode first = head->opcode;
+	if (first != _0xANNN && first != _0x6XNN && first != _0x3XNN && first != _0x4XNN && first != _0xFX07) {
+		return;
+	}
+	if ((address & 0x1) || address > 2 * decode_cache_size - 2 * FUSE_MAX) {
+		return;
+	}
+
+	// the instructions after it are decoded into the cache as well
+	Opcode sequence[FUSE_MAX];
+	int length = 1;
+	sequence[0] = first;
+	while (length < FUSE_MAX) {
+		decoded_instruction &next = head[length];
+		if (!next.valid && !decodeInstruction(address + 2 * length, next)) {
+			break;
+		}
+		sequence[length++] = next.opcode;
+	}
+
+	bool skip_jump = (length >= 2 && (first == _0x3XNN || first == _0x4XNN) && sequence[1] == _0x1NNN);
+	bool poll = (length >= 3 && first == _0xFX07 && (sequence[1] == _0x3XNN || sequence[1] == _0x4XNN) &&
+		sequence[2] == _0x1NNN);
+
+	if (length >= 2 && first == _0xANNN && sequence[1] == _0xDXYN) {
+		head->fused = &chip8::fused_0xANNN_0xDXYN;
+		head->fused_length = 2;
+	}
+	else if (length >= 2 && first == _0x6XNN && sequence[1] == _0x6XNN) {
+		int run = 2;
+		while (run < length && sequence[run] == _0x6XNN) {
+			++run;
+		}
+		head->fused = &chip8::fused_0x6XNN_run;
+		head->fused_length = (uint8)run;
+	}
+	else if (skip_jump) {
+		head->fused = &chip8::fused_skip_0x1NNN;
+		head->fused_length = 2;
+	}
+	else if (poll) {
+		head->fused = &chip8::fused_0xFX07_skip_0x1NNN;
+		head->fused_length = 3;
+	}
+
+	// an instruction that may start an idle loop (a 1NNN to itself, a DXYN under the display wait) stays
+	//  an instruction boundary, the fast-forward looks right before it like in the other engines
+	for (int i = 1; i < head->fused_length; ++i) {
+		if (idleLoopShape(address + 2 * i) != IDLE_NONE) {
+			head->fused = NULL;
+			head->fused_length = 1;
+			return;
+		}
+	}
+}
+
+// superinstructions, each returns the number of instructions it ran
+int chip8::fused_0xANNN_0xDXYN(decoded_instruction *head)
+{
+	I = head->nnn;
+	pc += 2;
+	if (!(this->*(head[1].executor))(head[1])) {
+		LOG_WARN(LOG_OPCODE_FAILED, head[1].raw, pc);
+		fault();
+	}
+	return 2;
+}
+
+int chip8::fused_0x6XNN_run(decoded_instruction *head)
+{
+	int length = head->fused_length;
+	for (int i = 0; i < length; ++i) {
+		V[head[i].x] = head[i].nn;
+	}
+	pc += 2 * length;
+	return length;
+}
+
+int chip8::fused_skip_0x1NNN(decoded_instruction *head)
+{
+	// 3XNN skips the jump when VX equals NN, 4XNN when it doesn't
+	bool equal = (V[head->x] == head->nn);
+	if (equal == (head->opcode == _0x3XNN)) {
+		pc += head->skip;
+		return 1;
+	}
+	pc = head[1].nnn;
+	return 2;
+}
+
+int chip8::fused_0xFX07_skip_0x1NNN(decoded_instruction *head)
+{
+	V[head->x] = delay_timer;
+	pc += 2;
+	return 1 + fused_skip_0x1NNN(head + 1);
+}
+
+void chip8::prewarm(const rom_analysis &analysis)
+{
+	const std::vector<flow_block> &blocks = analysis.blocks();
+	for (size_t b = 0; b < blocks.size(); ++b) {
+		// instructions at odd addresses (or past the cached memory) are never cached
+		uint32_t address = blocks[b].start;
+		decoded_instruction *instruction;
+		while (address < blocks[b].end && (instruction = cachedInstruction(address)) != NULL) {
+			if (!instruction->valid && !decodeInstruction((uint16)address, *instruction)) {
+				break;
+			}
+			address += (instruction->opcode == _0xF000) ? 4 : 2;
+		}
 
-	debug_fmt_msg("Loading filename: %s", filename);
+		if (engine == ENGINE_JIT && jit != NULL) {
+			jit->precompile(blocks[b].start);
+		}
+	}
+}
 
+bool chip8::loadApp(char *filename)
+{
 #ifdef DEBUG
     if (filename == NULL && DEBUG) {
         filename = DEFAULT_APP;
-        debug_fmt_msg("DEBUG => Loading filename: %s", filename);
     }
 #endif
+	LOG_DEBUG(LOG_ROM_LOADING, filename);
 
-	// open file for reaching in binary mode (do not map end of line)
-	FILE *ptrFile = NULL;
-	fopen_s(&ptrFile, filename, "rb");
-
-	if (ptrFile == NULL)
+	// the file is mapped and copied straight into memory, see rom_image
+	rom_image image;
+	if (!image.open(filename))
 	{
-		debug_fmt_msg("Filename %s does not exist!", filename);
+		LOG_ERROR(LOG_ROM_NOT_FOUND, filename);
 		return false;
 	}
 
-	// get the buffer size (size of file)
-	fseek(ptrFile, 0, SEEK_END);
-	long bufferSize = ftell(ptrFile);
-	rewind(ptrFile);
-	debug_fmt_msg("Filesize found to be: %d", bufferSize);
+	return loadRom(image.data(), image.size());
+}
 
-    // check the file won't overrun the memory
-    if (bufferSize > (MEMORY_SIZE - 512)) {
-        debug_fmt_msg("Filesize too large for available RAM: %l", bufferSize);
-    }
+bool chip8::loadRom(const uint8 *data, size_t size)
+{
+	// initialize chip8
+	initialize();
 
-	// buffer should have 'bufferSize' number of bytes for the system
-	char *buffer = (char*)malloc(sizeof(char) * bufferSize);
-	if (buffer == NULL)
-	{
-		debug_simple_msg("Memory allocation error!");
-	}
+	LOG_DEBUG(LOG_ROM_SIZE, (int64_t)size);
 
-	// read the bytes into the buffer 
-	size_t bytesread = fread(buffer, 1, bufferSize, ptrFile);
-	
-	// check that they were read
-	if (bytesread != bufferSize) {
-		debug_simple_msg("Read error, too many or too few bytes were read - check the file.");
-		getchar();
-		exit(1);
-	}
+    // refuse a program that would overrun the memory (4K unless the machine is XO-CHIP)
+    const size_t available = (size_t)(programMemory() - 512);
+    if (size > available) {
+        LOG_ERROR(LOG_ROM_TOO_LARGE, (int64_t)size, (int64_t)available);
+        return false;
+    }
 
 	// program or game is loaded into memory starting at location 0x200 (512 in decimal)
-	for (int i = 0; i < bufferSize; ++i)
-	{
-		memory[i + 512] = buffer[i];
+	if (size != 0) {
+		memcpy(memory + 512, data, size);
 	}
 
-    fclose(ptrFile);
-    free(buffer);
+	// the program replaced whatever was decoded before
+	invalidateDecodeCache();
 	return true;
 }
 
 void chip8::updateTimers() 
 {
+    // the tone of the frame that starts here
+    if (audio != NULL)
+    {
+        audio->tick(*this);
+    }
+
     // update delay timer
     if (delay_timer > 0)
     {
@@ -289,31 +1067,172 @@ void chip8::updateTimers()
     {
         if (sound_timer == 1)
         {
-            debug_simple_msg("BEEP!");
+            LOG_DEBUG(LOG_BEEP);
         }
         --sound_timer;
     }
 }
 
-void chip8::setKeys() 
+// clears the planes in plane_mask (bit 0 = plane 0, bit 1 = plane 1)
+void chip8::clearScreen(uint8 plane_mask)
 {
-	// do nothing...
+	for (int plane = 0; plane < GFX_PLANES; ++plane) {
+		if (!(plane_mask & (1 << plane))) {
+			continue;
+		}
+#ifdef CHIP8_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for (int row = 0; row < GFX_HEIGHT; ++row) {
+			_mm_storeu_si128((__m128i *)gfx[plane][row], zero);
+		}
+#else
+		memset(gfx[plane], 0, sizeof(gfx_plane));
+#endif
+	}
 }
 
-void chip8::debug_simple_msg(char *message)
+// the scrolls move whole packed rows (or shift both words of a row), never single pixels.
+//  only the selected planes move, in lo-res only the top left 64x32 of each plane is touched.
+void chip8::scrollDown(uint8 rows)
 {
-	DBOUT(message);
-	DBOUT("\n");
+	int height = screenHeight();
+	int words = hires ? GFX_ROW_WORDS : 1;
+	if (rows > height) {
+		rows = height;
+	}
+
+	for (int plane = 0; plane < GFX_PLANES; ++plane) {
+		if (!(planes & (1 << plane))) {
+			continue;
+		}
+		for (int row = height - 1; row >= rows; --row) {
+			memcpy(gfx[plane][row], gfx[plane][row - rows], sizeof(uint64) * words);
+		}
+		for (int row = 0; row < rows; ++row) {
+			memset(gfx[plane][row], 0, sizeof(uint64) * words);
+		}
+	}
 }
 
-template <typename T>
-void chip8::debug_fmt_msg(char formatted_message[], T object)
+void chip8::scrollUp(uint8 rows)
 {
-	const size_t buf_size = 512;  // TODO:  Needs fixed later to get the length needed
-	char buffer[buf_size];
-	sprintf_s(buffer, formatted_message, object);
-	DBOUT(buffer);
-	DBOUT("\n");
+	int height = screenHeight();
+	int words = hires ? GFX_ROW_WORDS : 1;
+	if (rows > height) {
+		rows = height;
+	}
+
+	for (int plane = 0; plane < GFX_PLANES; ++plane) {
+		if (!(planes & (1 << plane))) {
+			continue;
+		}
+		for (int row = 0; row < height - rows; ++row) {
+			memcpy(gfx[plane][row], gfx[plane][row + rows], sizeof(uint64) * words);
+		}
+		for (int row = height - rows; row < height; ++row) {
+			memset(gfx[plane][row], 0, sizeof(uint64) * words);
+		}
+	}
+}
+
+// 4 pixels right, the nibble leaving the first word moves into the top of the second
+void chip8::scrollRight()
+{
+	for (int plane = 0; plane < GFX_PLANES; ++plane) {
+		if (!(planes & (1 << plane))) {
+			continue;
+		}
+		for (int row = 0; row < screenHeight(); ++row) {
+			uint64 *words = gfx[plane][row];
+			if (hires) {
+				words[1] = (words[1] >> 4) | (words[0] << 60);
+			}
+			words[0] >>= 4;
+		}
+	}
+}
+
+// 4 pixels left, the nibble leaving the second word moves into the bottom of the first
+void chip8::scrollLeft()
+{
+	for (int plane = 0; plane < GFX_PLANES; ++plane) {
+		if (!(planes & (1 << plane))) {
+			continue;
+		}
+		for (int row = 0; row < screenHeight(); ++row) {
+			uint64 *words = gfx[plane][row];
+			words[0] <<= 4;
+			if (hires) {
+				words[0] |= words[1] >> 60;
+				words[1] <<= 4;
+			}
+		}
+	}
+}
+
+// 64 bit hash of the framebuffer (both planes and the display mode), the SSE2 and the scalar version give the same value
+//  each pair of words is mixed into two accumulators with a 32x32->64 multiply, then folded together
+uint64 chip8::framebufferHash()
+{
+	const uint64 key_lo = 0x9E3779B97F4A7C15ULL;
+	const uint64 key_hi = 0xC2B2AE3D27D4EB4FULL;
+	const int word_count = GFX_PLANES * GFX_HEIGHT * GFX_ROW_WORDS;
+	const uint64 *words = &gfx[0][0][0];
+	uint64 acc[2];
+
+#ifdef CHIP8_SSE2
+	const __m128i key = _mm_set_epi64x((long long)key_hi, (long long)key_lo);
+	__m128i accumulator = _mm_set_epi64x(screenHeight(), screenWidth());
+	for (int word = 0; word < word_count; word += 2) {
+		__m128i data = _mm_loadu_si128((const __m128i *)&words[word]);
+		__m128i keyed = _mm_xor_si128(data, key);
+		__m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(3, 3, 1, 1)));
+		accumulator = _mm_add_epi64(accumulator, product);
+		accumulator = _mm_add_epi64(accumulator, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+	_mm_storeu_si128((__m128i *)acc, accumulator);
+#else
+	acc[0] = screenWidth();
+	acc[1] = screenHeight();
+	for (int word = 0; word < word_count; word += 2) {
+		uint64 keyed_lo = words[word] ^ key_lo;
+		uint64 keyed_hi = words[word + 1] ^ key_hi;
+		acc[0] += (keyed_lo & 0xFFFFFFFF) * (keyed_lo >> 32) + words[word + 1];
+		acc[1] += (keyed_hi & 0xFFFFFFFF) * (keyed_hi >> 32) + words[word];
+	}
+#endif
+
+	// murmur3 finalizer over the folded accumulators
+	uint64 hash = acc[0] ^ ROTATE_RIGHT_64(acc[1], 29);
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+bool chip8::framebufferEquals(const gfx_plane other[GFX_PLANES])
+{
+#ifdef CHIP8_SSE2
+	const int word_count = GFX_PLANES * GFX_HEIGHT * GFX_ROW_WORDS;
+	const uint64 *mine = &gfx[0][0][0];
+	const uint64 *theirs = &other[0][0][0];
+	__m128i difference = _mm_setzero_si128();
+	for (int word = 0; word < word_count; word += 2) {
+		__m128i a = _mm_loadu_si128((const __m128i *)&mine[word]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&theirs[word]);
+		difference = _mm_or_si128(difference, _mm_xor_si128(a, b));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(difference, _mm_setzero_si128())) == 0xFFFF;
+#else
+	return memcmp(gfx, other, sizeof(gfx)) == 0;
+#endif
+}
+
+void chip8::setKeys() 
+{
+	// do nothing...
 }
 
 /**
@@ -322,48 +1241,48 @@ void chip8::debug_fmt_msg(char formatted_message[], T object)
 */
 
 // opcode 0x00E0 -> Clears the screen
-bool chip8::opcode_0x00E0(uint16 opcode) {
-    memset(gfx, 0, sizeof(uint8) * GFX_SIZE);
+bool chip8::opcode_0x00E0(const decoded_instruction &instruction) {
+    clearScreen(planes);
 	drawFlag = true;
 	pc += 2;
 	return true; 
 }
 
 // opcode 0x00EE -> Returns from a subroutine
-bool chip8::opcode_0x00EE(uint16 opcode) {
+bool chip8::opcode_0x00EE(const decoded_instruction &instruction) {
 	// pop the stack and return to where the pc pointer was
 	--sp;
-	pc = stack[sp];  // return to the point of function call
+	pc = stack[sp & (STACK_LEVELS - 1)];  // return to the point of function call
 	pc += 2;    // increase the pc to the next instruction after the function call
 	return true; 
 }
 
 // opcode 0x0NNN -> Calls RCA 1802 program at address NNN. Not necessary for most ROMs.
-bool chip8::opcode_0x0NNN(uint16 opcode) {
-	stack[sp] = pc;  // store the current pc on the stack
+bool chip8::opcode_0x0NNN(const decoded_instruction &instruction) {
+	stack[sp & (STACK_LEVELS - 1)] = pc;  // store the current pc on the stack
 	++sp;			 // increment stack pointer
-	pc = (opcode & 0x0FFF);  // set the pc to the address specified in the opcode (NNN part of 0x0NNN)
+	pc = instruction.nnn;  // set the pc to the address specified in the opcode (NNN part of 0x0NNN)
 	return true; 
 }
 
 // opcodes 0x1NNN -> jump to address specified in 'NNN' 
-bool chip8::opcode_0x1NNN(uint16 opcode) {
-	pc = (opcode & 0x0FFF); // jump to address stored in NNN
+bool chip8::opcode_0x1NNN(const decoded_instruction &instruction) {
+	pc = instruction.nnn; // jump to address stored in NNN
 	return true; 
 }
 
 // opcodes 0x2NNN -> call subroutine (subroutine will return)
-bool chip8::opcode_0x2NNN(uint16 opcode) {
-	stack[sp] = pc;    // store the current pc in the stack
+bool chip8::opcode_0x2NNN(const decoded_instruction &instruction) {
+	stack[sp & (STACK_LEVELS - 1)] = pc;    // store the current pc in the stack
 	++sp;			   // increase the stack pointer to next avail location
-	pc = opcode & 0x0FFF;	// set the pc to the address specified in the opcode (NNN part of 0x2NNN)
+	pc = instruction.nnn;	// set the pc to the address specified in the opcode (NNN part of 0x2NNN)
 	return true; 
 }
 
 // opcode 0x3XNN -> Skip the next instruction if VX equals NN
-bool chip8::opcode_0x3XNN(uint16 opcode) {
-	if ((V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF))) {
-		pc += 4;   // skip the next instruction 
+bool chip8::opcode_0x3XNN(const decoded_instruction &instruction) {
+	if ((V[instruction.x] == instruction.nn)) {
+		pc += skipLength();   // skip the next instruction
 	}
 	else {
 		pc += 2;   // otherwise, just go to the next instruction
@@ -372,9 +1291,9 @@ bool chip8::opcode_0x3XNN(uint16 opcode) {
 }
 
 // opcode 0x4XNN -> Skips the next instruction if VX doesn't equal NN.
-bool chip8::opcode_0x4XNN(uint16 opcode) {
-	if ((V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))) {
-		pc += 4;  // skip the next instruction
+bool chip8::opcode_0x4XNN(const decoded_instruction &instruction) {
+	if ((V[instruction.x] != instruction.nn)) {
+		pc += skipLength();  // skip the next instruction
 	}
 	else {
 		pc += 2;  // otherwise, just go to the next instruction
@@ -383,9 +1302,9 @@ bool chip8::opcode_0x4XNN(uint16 opcode) {
 }
 
 // opcode 0x5XY0 -> Skips the next instruction if VX equals VY. 
-bool chip8::opcode_0x5XY0(uint16 opcode) {
-	if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4]) {
-		pc += 4;  // skip the next instruction
+bool chip8::opcode_0x5XY0(const decoded_instruction &instruction) {
+	if (V[instruction.x] == V[instruction.y]) {
+		pc += skipLength();  // skip the next instruction
 	}
 	else {
 		pc += 2;  // otherwise, just go to the next instruction
@@ -394,137 +1313,138 @@ bool chip8::opcode_0x5XY0(uint16 opcode) {
 }
 
 // opcode 0x6XNN -> Sets VX to NN.
-bool chip8::opcode_0x6XNN(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] = (opcode & 0x00FF);
+bool chip8::opcode_0x6XNN(const decoded_instruction &instruction) {
+	V[instruction.x] = instruction.nn;
 	pc += 2;
 	return true; 
 }
 
 // opcode 0x7XNN -> Adds NN to VX. (Carry flag is not changed)
-bool chip8::opcode_0x7XNN(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] += (opcode & 0x00FF);
+bool chip8::opcode_0x7XNN(const decoded_instruction &instruction) {
+	V[instruction.x] += instruction.nn;
 	pc += 2;
 	return true; 
 }
 
 // opcode 0x8XY0 -> Sets VX to the value of VY
-bool chip8::opcode_0x8XY0(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
+bool chip8::opcode_0x8XY0(const decoded_instruction &instruction) {
+	V[instruction.x] = V[instruction.y];
 	pc += 2;
 	return true; 
 }
 
 // opcode 0x8XY1 -> Sets VX to VX or VY (Bitwise OR operation)
-bool chip8::opcode_0x8XY1(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0) >> 4];
+//                  VIP quirk: VF is cleared
+template <class Quirks>
+bool chip8::opcode_0x8XY1(const decoded_instruction &instruction) {
+	V[instruction.x] |= V[instruction.y];
+	if (Quirks::LOGIC_RESETS_VF) {
+		V[0xF] = 0;
+	}
 	pc += 2;
 	return true;
 }
 
 // opcode 0x8XY2 -> Sets VX to VX and VY. (Bitwise AND operation)
-bool chip8::opcode_0x8XY2(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0) >> 4];
+//                  VIP quirk: VF is cleared
+template <class Quirks>
+bool chip8::opcode_0x8XY2(const decoded_instruction &instruction) {
+	V[instruction.x] &= V[instruction.y];
+	if (Quirks::LOGIC_RESETS_VF) {
+		V[0xF] = 0;
+	}
 	pc += 2;
 	return true; 
 }
 
 // opcode 0x8XY3 -> Sets VX to VX xor VY.
-bool chip8::opcode_0x8XY3(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0) >> 4];
+//                  VIP quirk: VF is cleared
+template <class Quirks>
+bool chip8::opcode_0x8XY3(const decoded_instruction &instruction) {
+	V[instruction.x] ^= V[instruction.y];
+	if (Quirks::LOGIC_RESETS_VF) {
+		V[0xF] = 0;
+	}
 	pc += 2;
 	return true; 
 }
 
 // opcode 0x8XY4 -> Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't
-bool chip8::opcode_0x8XY4(uint16 opcode) {
+bool chip8::opcode_0x8XY4(const decoded_instruction &instruction) {
 	// we figure out how much of 0xFF is left when subtracting what is already in V[X]
 	//   then if what is going to be added in V[Y] to that is more, then adding V[Y] to V[X] will cause overflow
 	//  
 	//   Example:
 	//          Will 4 + 3 overflow 9?  ->  (9 - 4) = 5.   3 being added is not > 5, so no
 	//          Will 4 + 7 overflow 9?  ->  (9 - 4) = 5.   7 being added is > 5, so yes
-	if (V[(opcode & 0x00F0) >> 4] > (0xFF - V[(opcode & 0x0F00) >> 8])) {
+	if (V[instruction.y] > (0xFF - V[instruction.x])) {
 		V[0xF] = 1;  // set carry flag
 	}
 	else {
 		V[0xF] = 0;
 	}
-	V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x00F0) >> 4];    // now do the addition
+	V[instruction.x] += V[instruction.y];    // now do the addition
 	pc += 2;
 	return true; 
 }
 
 // opcode 0x8XY5 -> VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-bool chip8::opcode_0x8XY5(uint16 opcode) {
+bool chip8::opcode_0x8XY5(const decoded_instruction &instruction) {
 	// it is easier than above to figure out if we'll need to borrow
 	//  we just need to determine if VY is bigger than VX - if it is, VX will go below 0 and need to borrow
-	if (V[(opcode & 0x00F0) >> 4] > V[(opcode & 0x0F00) >> 8]) {
+	if (V[instruction.y] > V[instruction.x]) {
 		V[0xF] = 0;  // set borrow flag
 	}
 	else {
 		V[0xF] = 1;
 	}
-	V[(opcode & 0x0F00) >> 8] -= V[(opcode & 0x00F0) >> 4];    // now do the subtraction
+	V[instruction.x] -= V[instruction.y];    // now do the subtraction
 	pc += 2;
 	return true; 
 }
 
-// opcode 0x8XY6 -> Two intepretations based on modern and older interpreters
-//                  Implementation can be set with _MODERN_CHIP8 setting
-bool chip8::opcode_0x8XY6(uint16 opcode) {
-#ifdef _MODERN_CHIP8
-// (MODERN) -> Shift VX right by one. Set VF to LSB of VX before the shift. Ignore VY.
-    V[0xF] = V[(opcode & 0x0F00) >> 8] & 0x1;
-    V[(opcode & 0x0F00) >> 8] >>= 1;
+// opcode 0x8XY6 -> Two intepretations based on modern and older interpreters (Quirks::SHIFT_USES_VY)
+//                  Modern: Shift VX right by one. Set VF to LSB of VX before the shift. Ignore VY.
+//                  VIP:    Shift VY right by one and copy the result to VX. VF is set to the LSB of VY before the shift.
+template <class Quirks>
+bool chip8::opcode_0x8XY6(const decoded_instruction &instruction) {
+    uint8 source = Quirks::SHIFT_USES_VY ? V[instruction.y] : V[instruction.x];
+    V[0xF] = source & 0x1;
+    V[instruction.x] = source >> 1;
     pc += 2;
     return true; 
-#else
-// Shifts VY right by one and copies the result to VX. 
-// VF is set to the value of the least significant bit of VY before the shift
-    V[0xF] = V[(opcode & 0x00F0) >> 4] & 0x01;
-    V[(opcode & 0x0F00) >> 8] = (V[(opcode & 0x00F0) >> 4] >>= 1);
-    pc += 2;
-    return true;
-#endif
 }
 
 // opcode 0x8XY7 -> Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-bool chip8::opcode_0x8XY7(uint16 opcode) {
+bool chip8::opcode_0x8XY7(const decoded_instruction &instruction) {
 	// if we're subtracting VX from VY, if VX is larger than VY, there will be a borrow
-	if (V[(opcode & 0x0F00) >> 8] > V[(opcode & 0x00F0) >> 4]) {
+	if (V[instruction.x] > V[instruction.y]) {
 		V[0xF] = 0;  // set borrow flag
 	}
 	else {
 		V[0xF] = 1;
 	}
-	V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4] - V[(opcode & 0x0F00) >> 8];
+	V[instruction.x] = V[instruction.y] - V[instruction.x];
 	pc += 2;
 	return true; 
 }
 
-// opcode 0x8XYE ->  Two intepretations based on modern and older interpreters
-//                   Implementation can be set with _MODERN_CHIP8 setting
-bool chip8::opcode_0x8XYE(uint16 opcode) {
-#ifdef _MODERN_CHIP8
-// (MODERN) -> Shift VX left by one. Set VF to MSB of VX before the shift. Ignore VY.
-    V[0xF] = V[(opcode & 0x0F00) >> 8] >> 7;
-    V[(opcode & 0x0F00) >> 8] <<= 1;
+// opcode 0x8XYE ->  Two intepretations based on modern and older interpreters (Quirks::SHIFT_USES_VY)
+//                   Modern: Shift VX left by one. Set VF to MSB of VX before the shift. Ignore VY.
+//                   VIP:    Shift VY left by one and copy the result to VX. VF is set to the MSB of VY before the shift.
+template <class Quirks>
+bool chip8::opcode_0x8XYE(const decoded_instruction &instruction) {
+    uint8 source = Quirks::SHIFT_USES_VY ? V[instruction.y] : V[instruction.x];
+    V[0xF] = source >> 7;
+    V[instruction.x] = source << 1;
     pc += 2;
     return true;
-#else
-//    Shifts VY left by one and copies the result to VX.
-//	  VF is set to the value of the most significant bit of VY before the shift
-    V[0xF] = V[(opcode & 0x00F0) >> 4] & 0x80;   // msb = 0b10000000 = 0x80
-    V[(opcode & 0x0F00) >> 8] = (V[(opcode & 0x00F0) >> 4] <<= 1);
-    pc += 2;
-    return true;
-#endif
 }
 
 // opcode 0x9XY0 -> Skips the next instruction if VX doesn't equal VY.
-bool chip8::opcode_0x9XY0(uint16 opcode) {
-	if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4]) {
-		pc += 4;  // skip next instruction
+bool chip8::opcode_0x9XY0(const decoded_instruction &instruction) {
+	if (V[instruction.x] != V[instruction.y]) {
+		pc += skipLength();  // skip next instruction
 	}
 	else {
 		pc += 2;
@@ -533,21 +1453,23 @@ bool chip8::opcode_0x9XY0(uint16 opcode) {
 }
 
 // opcode 0xANNN -> Sets I to the address NNN.
-bool chip8::opcode_0xANNN(uint16 opcode) {
-	I = opcode & 0x0FFF;    // - set I to the NNN part of the opcode
+bool chip8::opcode_0xANNN(const decoded_instruction &instruction) {
+	I = instruction.nnn;    // - set I to the NNN part of the opcode
 	pc += 2;                // - move the program counter by 2 for next opcode
 	return true; 
 }
 
 // opcode 0xBNNN -> Jumps to the address NNN plus V0.
-bool chip8::opcode_0xBNNN(uint16 opcode) {
-    pc = (opcode & 0x0FFF) + V[0x0];
+//                  CHIP-48 / SCHIP quirk (Quirks::JUMP_USES_VX): BXNN jumps to XNN plus VX
+template <class Quirks>
+bool chip8::opcode_0xBNNN(const decoded_instruction &instruction) {
+    pc = instruction.nnn + V[Quirks::JUMP_USES_VX ? instruction.x : 0x0];
 	return true; 
 }
 
 // opcode 0xCXNN -> Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
-bool chip8::opcode_0xCXNN(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] = (rand() % 0xFF) && (opcode & 0x00FF);
+bool chip8::opcode_0xCXNN(const decoded_instruction &instruction) {
+	V[instruction.x] = nextRandom() & instruction.nn;
 	pc += 2;
 	return true; 
 }
@@ -557,58 +1479,100 @@ bool chip8::opcode_0xCXNN(uint16 opcode) {
 //                    The 'height' fo the pixel is determined by how many bytes -> 1 byte = 1 row, 2 bytes = 2 rows, etc...
 //                    Example 2 byte sprite:
 //                          0b01100001 0b10101001
-//                          
-//                          if bit_index = 0..7
-//                          col (x coordinate) = col (or x) + (7 - bit_index) ==> MSB to LSB
-//                          row (y coordinate) = row (or y) + byte_index
-bool chip8::opcode_0xDXYN(uint16 opcode) {
-
-    uint8 col = V[(opcode & 0x0F00) >> 8];
-    uint8 row = V[(opcode & 0x00F0) >> 4];
-    uint8 n_bytes = opcode & 0x000F;
-    uint8 byte_index;
-    uint8 bit_index;
-    uint8 byte;
-
-	// reset register VF (this is the drawFlag and pixel collision register - status register)
-	V[0xF] = 0;
-
-	// loop through the height of the sprite
-	for (byte_index = 0; byte_index < n_bytes; ++byte_index) {
-
-		// get all bytes of the sprite to be drawn from memory - starting at I 
-		byte = memory[I + byte_index];
-
-		// scan through the bits of the sprite pixel obtained from memory (8 bits - use 0x10000000, or 0x80, and shift right to check)
-		for (bit_index = 0; bit_index < SPRITE_WIDTH; ++bit_index) {
+//
+//                    Each sprite row is moved to the top of a 64 bit word and rotated right to the column,
+//                    so it lines up with the packed screen row (and wraps around to the left edge).
+//                    In hi-res the row spans two words, the part past the first word goes into the second
+//                    and with wrapping the part past column 127 comes back into the first.
+//                    The whole row is then XOR'd in one go, any bit set in both is a collision.
+//                    Without Quirks::SPRITES_WRAP the row is shifted instead and rows below the screen
+//                    are dropped, so the sprite is clipped at the right and bottom edges.
+//                    SCHIP / XO-CHIP: DXY0 draws a 16x16 sprite (two bytes per row),
+//                    XO-CHIP draws on every selected plane, the sprite data for each plane follows the previous one.
+template <class Quirks>
+bool chip8::opcode_0xDXYN(const decoded_instruction &instruction) {
+
+	// pc stays on the DXYN until the next vblank, which it then uses up
+	if (Quirks::DISPLAY_WAIT) {
+		if (!vblank) {
+			return true;
+		}
+		vblank = false;
+	}
 
-            // get the next bit to check
-            uint8 draw_bit = NTH_BIT_OF_BYTE(byte, bit_index); 
+	int width = screenWidth();
+	int height = screenHeight();
+    uint8 col = V[instruction.x] & (width - 1);
+    uint8 row = V[instruction.y] & (height - 1);
+    uint8 n_rows = instruction.n;
+	uint8 sprite_width = 8;
+	uint64 collision = 0;
+
+	if (n_rows == 0 && machine != MACHINE_CHIP8) {
+		n_rows = 16;
+		sprite_width = 16;
+	}
 
-            // get the current pixel bit on screen
-            uint16 pixel_index = ((col + (7 - bit_index) + ((row + byte_index) * GFX_WIDTH))) % (GFX_SIZE);
-            uint8 *pixel_bit = &gfx[pixel_index];
+	uint8 visible_rows = n_rows;
+	if (!Quirks::SPRITES_WRAP && row + n_rows > height) {
+		visible_rows = height - row;
+	}
 
-            if(draw_bit == 1 && *pixel_bit == 1) {
-                // collision detection
-                V[0xF] = 1; 
-            }
+	uint16 address = I;
+	for (int plane = 0; plane < GFX_PLANES; ++plane) {
+		if (!(planes & (1 << plane))) {
+			continue;
+		}
 
-            // draw the pixel 
-            *pixel_bit = *pixel_bit ^ draw_bit;
+		for (uint8 byte_index = 0; byte_index < visible_rows; ++byte_index) {
+
+			// get the sprite row from memory and move it to the top of a word
+			uint64 sprite_bits = memory[(address + byte_index * (sprite_width / 8)) & (MEMORY_SIZE - 1)];
+			if (sprite_width == 16) {
+				sprite_bits = (sprite_bits << 8) | memory[(address + byte_index * 2 + 1) & (MEMORY_SIZE - 1)];
+			}
+			uint64 sprite_top = sprite_bits << (64 - sprite_width);
+			uint64 *screen_row = gfx[plane][(row + byte_index) & (height - 1)];
+
+			if (!hires) {
+				uint64 sprite_row = Quirks::SPRITES_WRAP ? ROTATE_RIGHT_64(sprite_top, col) : (sprite_top >> col);
+				collision |= screen_row[0] & sprite_row;
+				screen_row[0] ^= sprite_row;
+				continue;
+			}
+
+			uint64 first = 0;
+			uint64 second = 0;
+			if (col < 64) {
+				first = sprite_top >> col;
+				second = (col != 0) ? (sprite_top << (64 - col)) : 0;
+			}
+			else {
+				second = sprite_top >> (col - 64);
+				if (Quirks::SPRITES_WRAP && col > 64) {
+					first = sprite_top << (128 - col);
+				}
+			}
+			collision |= (screen_row[0] & first) | (screen_row[1] & second);
+			screen_row[0] ^= first;
+			screen_row[1] ^= second;
 		}
+		address += n_rows * (sprite_width / 8);
 	}
+
+	// register VF is the pixel collision register - status register
+	V[0xF] = (collision != 0) ? 1 : 0;
 	drawFlag = true;
 	pc += 2;
 	return true; 
 }
 
 // opcode 0xEX9E -> Skips the next instruction if the key stored in VX is pressed.
-bool chip8::opcode_0xEX9E(uint16 opcode) {
-	uint8 store_key = V[(opcode & 0x0F00) >> 8];
+bool chip8::opcode_0xEX9E(const decoded_instruction &instruction) {
+	uint8 store_key = V[instruction.x];
 	if (store_key <= 0xF) {
 		if (key[store_key] == 1) {
-			pc += 4;
+			pc += skipLength();
 		}
 		else {
 			pc += 2;
@@ -616,19 +1580,17 @@ bool chip8::opcode_0xEX9E(uint16 opcode) {
 		return true; 
 	}
 	else {
-		char msg[] = "Key stored in V[%i] is outside of the hex bounds.";
-		debug_fmt_msg(msg, store_key);
-		debug_simple_msg("Illegal reference attempted on key[] array!");
+		LOG_WARN(LOG_KEY_OUT_OF_RANGE, store_key, instruction.x);
 		return false; 
 	}
 }
 
 // opcode 0xEXA1 -> Skips the next instruction if the key stored in VX isn't pressed.
-bool chip8::opcode_0xEXA1(uint16 opcode) {
-	uint8 store_key = V[(opcode & 0x0F00) >> 8];
+bool chip8::opcode_0xEXA1(const decoded_instruction &instruction) {
+	uint8 store_key = V[instruction.x];
 	if (store_key <= 0xF) {
 		if (key[store_key] == 0) {
-			pc += 4;
+			pc += skipLength();
 		}
 		else {
 			pc += 2;
@@ -636,28 +1598,26 @@ bool chip8::opcode_0xEXA1(uint16 opcode) {
 		return true; 
 	}
 	else {
-		char msg[] = "Key stored in V[%i] is outside of the hex bounds.";
-		debug_fmt_msg(msg, store_key);
-		debug_simple_msg("Illegal reference attempted on key[] array!");
+		LOG_WARN(LOG_KEY_OUT_OF_RANGE, store_key, instruction.x);
 		return false;
 	}
 }
 
 // opcode 0xFX07 -> Sets VX to the value of the delay timer.
-bool chip8::opcode_0xFX07(uint16 opcode) {
-	V[(opcode & 0x0F00) >> 8] = delay_timer;
+bool chip8::opcode_0xFX07(const decoded_instruction &instruction) {
+	V[instruction.x] = delay_timer;
 	pc += 2;
 	return true; 
 }
 
 // opcode 0xFX0A -> A key press is awaited, and then stored in VX. 
 //					(Blocking Operation. All instruction halted until next key event)
-bool chip8::opcode_0xFX0A(uint16 opcode) {
+bool chip8::opcode_0xFX0A(const decoded_instruction &instruction) {
 	bool isKeyPressed = false;
 	for (int i = 0; i < 16; ++i) {
 		if (key[i] == 1) {
 			isKeyPressed = true;
-			V[(opcode & 0x0F00) >> 8] = i;
+			V[instruction.x] = i;
 			break;
 		}
 	}
@@ -669,15 +1629,15 @@ bool chip8::opcode_0xFX0A(uint16 opcode) {
 }
 
 // opcode 0xFX15 -> Sets the delay timer to VX.	
-bool chip8::opcode_0xFX15(uint16 opcode) {
-	delay_timer = V[(opcode & 0x0F00) >> 8];
+bool chip8::opcode_0xFX15(const decoded_instruction &instruction) {
+	delay_timer = V[instruction.x];
 	pc += 2;
 	return true;
 }
 
 // opcode 0xFX18 -> Sets the sound timer to VX.
-bool chip8::opcode_0xFX18(uint16 opcode) {
-	sound_timer = V[(opcode & 0x0F00) >> 8];
+bool chip8::opcode_0xFX18(const decoded_instruction &instruction) {
+	sound_timer = V[instruction.x];
 	pc += 2;
 	return true; 
 }
@@ -687,28 +1647,28 @@ bool chip8::opcode_0xFX18(uint16 opcode) {
 // Per Wikipedia footnote (3)
 // VF is set to 1 when there is a range overflow (I+VX>0xFFF), and to 0 when there isn't. 
 // This is an undocumented feature of the CHIP-8 and used by the Spacefight 2091! game.
-bool chip8::opcode_0xFX1E(uint16 opcode) {
-	if ((I + V[(opcode & 0x0F00) >> 8]) > 0xFFF) {
+bool chip8::opcode_0xFX1E(const decoded_instruction &instruction) {
+	if ((I + V[instruction.x]) > 0xFFF) {
 		V[0xF] = 1;
 	}
 	else {
 		V[0xF] = 0;
 	}
-	I += V[(opcode & 0x0F00) >> 8];  // now just add them and store in I
+	I += V[instruction.x];  // now just add them and store in I
 	pc += 2;
 	return true; 
 }
 
 // opcode 0xFX29 -> Sets I to the location of the sprite for the character in VX. 
 //                  Characters 0-F (in hexadecimal) are represented by a 4x5 font.
-bool chip8::opcode_0xFX29(uint16 opcode) {
-	// get the character from V[(opcode & 0x0F00) >> 8]
+bool chip8::opcode_0xFX29(const decoded_instruction &instruction) {
+	// get the character from VX
 	// we need to get the sprite data for this from the fontset memory
 	// each character is 5 bytes wide (4x5)
 
 	// implementation of this is multiple what V[X] points to by 5 (0 * 5 = 0, 1 * 5 = 5, 2 * 5 = 10, etc...)
 	//  this will skip ahead the correct number of locations (bytes) in the fontset array to the start of the correct hex character
-	I = V[(opcode & 0x0F00) >> 8] * 0x5;
+	I = V[instruction.x] * 0x5;
 	pc += 2;
 	return true; 
 }
@@ -719,35 +1679,185 @@ bool chip8::opcode_0xFX29(uint16 opcode) {
 //                  (In other words, take the decimal representation of VX, 
 //                    place the hundreds digit in memory at location in I, the tens digit at location I+1, 
 //                    and the ones digit at location I+2.)
-bool chip8::opcode_0xFX33(uint16 opcode) {
-	uint8 val = V[(opcode & 0x0F00) >> 8];
+bool chip8::opcode_0xFX33(const decoded_instruction &instruction) {
+	uint8 val = V[instruction.x];
 
 	// break dec_val down to the decimal places
-	memory[I] = val / 100;
-	memory[I + 1] = (val / 10) % 10;
-	memory[I + 2] = (val % 100) / 10;
+	memory[I & (MEMORY_SIZE - 1)] = val / 100;
+	memory[(I + 1) & (MEMORY_SIZE - 1)] = (val / 10) % 10;
+	memory[(I + 2) & (MEMORY_SIZE - 1)] = (val % 100) / 10;
+	invalidateDecodeCache(I);
+	invalidateDecodeCache(I + 1);
+	invalidateDecodeCache(I + 2);
 	pc += 2;
 	return true; 
 }
 
 // opcode 0xFX55 -> Stores V0 to VX (including VX) in memory starting at address I. I is increased by 1 for each value written.
-bool chip8::opcode_0xFX55(uint16 opcode) {
-	for (int i = 0; i <= ((opcode & 0x0F00) >> 8); ++i) {
-		memory[I + i] = V[i];
+//                  SCHIP quirk (no Quirks::LOAD_STORE_INCREMENTS_I): I is left unchanged
+template <class Quirks>
+bool chip8::opcode_0xFX55(const decoded_instruction &instruction) {
+	for (int i = 0; i <= instruction.x; ++i) {
+		memory[(I + i) & (MEMORY_SIZE - 1)] = V[i];
+		invalidateDecodeCache(I + i);
 	}
 	// I = I + X + 1
-	I += ((opcode & 0x0F00) >> 8) + 1;
+	if (Quirks::LOAD_STORE_INCREMENTS_I) {
+		I += instruction.x + 1;
+	}
 	pc += 2;
 	return true; 
 }
 
 // opcode 0xFX65 -> Fills V0 to VX (including VX) with values from memory starting at address I. I is increased by 1 for each value written.
-bool chip8::opcode_0xFX65(uint16 opcode) {
-	for (int i = 0; i <= ((opcode & 0x0F00) >> 8); ++i) {
-		V[i] = memory[I + i];
+//                  SCHIP quirk (no Quirks::LOAD_STORE_INCREMENTS_I): I is left unchanged
+template <class Quirks>
+bool chip8::opcode_0xFX65(const decoded_instruction &instruction) {
+	for (int i = 0; i <= instruction.x; ++i) {
+		V[i] = memory[(I + i) & (MEMORY_SIZE - 1)];
 	}
 	// I = I + X + 1
-	I += ((opcode & 0x0F00) >> 8) + 1;
+	if (Quirks::LOAD_STORE_INCREMENTS_I) {
+		I += instruction.x + 1;
+	}
 	pc += 2;
 	return true; 
-}
\ No newline at end of file
+}
+
+/**
+ * SUPER-CHIP / XO-CHIP Opcode Routines
+ *  only decoded when chip8::machine has them, see translate_opcode
+*/
+
+// opcode 0x00CN -> (SCHIP) Scroll the display down N rows.
+bool chip8::opcode_0x00CN(const decoded_instruction &instruction) {
+	scrollDown(instruction.n);
+	drawFlag = true;
+	pc += 2;
+	return true;
+}
+
+// opcode 0x00DN -> (XO-CHIP) Scroll the display up N rows.
+bool chip8::opcode_0x00DN(const decoded_instruction &instruction) {
+	scrollUp(instruction.n);
+	drawFlag = true;
+	pc += 2;
+	return true;
+}
+
+// opcode 0x00FB -> (SCHIP) Scroll the display right 4 pixels.
+bool chip8::opcode_0x00FB(const decoded_instruction &instruction) {
+	scrollRight();
+	drawFlag = true;
+	pc += 2;
+	return true;
+}
+
+// opcode 0x00FC -> (SCHIP) Scroll the display left 4 pixels.
+bool chip8::opcode_0x00FC(const decoded_instruction &instruction) {
+	scrollLeft();
+	drawFlag = true;
+	pc += 2;
+	return true;
+}
+
+// opcode 0x00FD -> (SCHIP) Exit the interpreter.
+//                  There is nothing to return to, so the machine stays on this instruction (like a 1NNN to itself).
+bool chip8::opcode_0x00FD(const decoded_instruction &instruction) {
+	return true;
+}
+
+// opcode 0x00FE -> (SCHIP) Switch to lo-res (64x32) mode and clear the screen.
+bool chip8::opcode_0x00FE(const decoded_instruction &instruction) {
+	hires = false;
+	clearScreen(0x3);
+	drawFlag = true;
+	pc += 2;
+	return true;
+}
+
+// opcode 0x00FF -> (SCHIP) Switch to hi-res (128x64) mode and clear the screen.
+bool chip8::opcode_0x00FF(const decoded_instruction &instruction) {
+	hires = true;
+	clearScreen(0x3);
+	drawFlag = true;
+	pc += 2;
+	return true;
+}
+
+// opcode 0x5XY2 -> (XO-CHIP) Store VX to VY (inclusive) in memory starting at address I, I is not changed.
+//                  X may be larger than Y, the registers are then stored in reverse order.
+bool chip8::opcode_0x5XY2(const decoded_instruction &instruction) {
+	int x = instruction.x;
+	int y = instruction.y;
+	int step = (x <= y) ? 1 : -1;
+	for (int i = 0; i <= abs(y - x); ++i) {
+		memory[(I + i) & (MEMORY_SIZE - 1)] = V[x + i * step];
+		invalidateDecodeCache(I + i);
+	}
+	pc += 2;
+	return true;
+}
+
+// opcode 0x5XY3 -> (XO-CHIP) Load VX to VY (inclusive) from memory starting at address I, I is not changed.
+bool chip8::opcode_0x5XY3(const decoded_instruction &instruction) {
+	int x = instruction.x;
+	int y = instruction.y;
+	int step = (x <= y) ? 1 : -1;
+	for (int i = 0; i <= abs(y - x); ++i) {
+		V[x + i * step] = memory[(I + i) & (MEMORY_SIZE - 1)];
+	}
+	pc += 2;
+	return true;
+}
+
+// opcode 0xF000 NNNN -> (XO-CHIP) Sets I to the 16 bit address NNNN in the next word.
+bool chip8::opcode_0xF000(const decoded_instruction &instruction) {
+	I = memory[(pc + 2) & (MEMORY_SIZE - 1)] << 8 | memory[(pc + 3) & (MEMORY_SIZE - 1)];
+	pc += 4;
+	return true;
+}
+
+// opcode 0xFN01 -> (XO-CHIP) Select the bit-planes N (0 - 3) used by DXYN, 00E0 and the scrolls.
+bool chip8::opcode_0xFN01(const decoded_instruction &instruction) {
+	planes = instruction.x & 0x3;
+	pc += 2;
+	return true;
+}
+
+// opcode 0xF002 -> (XO-CHIP) Load the 16 byte (128 sample, 1 bit) audio pattern from memory starting at address I.
+bool chip8::opcode_0xF002(const decoded_instruction &instruction) {
+	for (int i = 0; i < 16; ++i) {
+		audio_pattern[i] = memory[(I + i) & (MEMORY_SIZE - 1)];
+	}
+	pc += 2;
+	return true;
+}
+
+// opcode 0xFX30 -> (SCHIP) Sets I to the large (8x10) font character for the low nibble of VX.
+bool chip8::opcode_0xFX30(const decoded_instruction &instruction) {
+	I = FONT_LARGE_ADDRESS + (V[instruction.x] & 0xF) * 10;
+	pc += 2;
+	return true;
+}
+
+// opcode 0xFX3A -> (XO-CHIP) Sets the audio pattern playback pitch to VX.
+bool chip8::opcode_0xFX3A(const decoded_instruction &instruction) {
+	pitch = V[instruction.x];
+	pc += 2;
+	return true;
+}
+
+// opcode 0xFX75 -> (SCHIP) Store V0 to VX (inclusive) in the persistent flag registers.
+bool chip8::opcode_0xFX75(const decoded_instruction &instruction) {
+	memcpy(rpl, V, instruction.x + 1);
+	pc += 2;
+	return true;
+}
+
+// opcode 0xFX85 -> (SCHIP) Load V0 to VX (inclusive) from the persistent flag registers.
+bool chip8::opcode_0xFX85(const decoded_instruction &instruction) {
+	memcpy(V, rpl, instruction.x + 1);
+	pc += 2;
+	return true;
+}
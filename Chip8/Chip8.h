@@ -2,13 +2,35 @@
 #ifndef _CHIP8_H
 #define _CHIP8_H
 
-#define _MODERN_CHIP8
-
+#include <stddef.h>
 #include "Common.h"
+#include "Quirks.h"
+#include "Scheduler.h"
+
+class chip8_jit;
+struct chip8_state;
+struct chip8_profile;
+class trace_recorder;
+class chip8_audio;
+class audio_sink;
+class rom_analysis;
+class input_log;
 
-#define GFX_WIDTH 64
-#define GFX_HEIGHT 32
+// framebuffer size in hi-res mode (SCHIP / XO-CHIP), the classic 64x32 screen is its top left quarter
+#define GFX_WIDTH 128
+#define GFX_HEIGHT 64
 #define GFX_SIZE ((GFX_WIDTH) * (GFX_HEIGHT))
+#define GFX_LORES_WIDTH 64
+#define GFX_LORES_HEIGHT 32
+
+// 64 bit words per row and bit-planes (XO-CHIP draws on two)
+#define GFX_ROW_WORDS ((GFX_WIDTH) / 64)
+#define GFX_PLANES 2
+
+typedef uint64 gfx_plane[GFX_HEIGHT][GFX_ROW_WORDS];
+
+// pixel (x, y) of one plane of a packed framebuffer, see chip8::gfx
+#define GFX_PIXEL(plane, x, y) (((plane)[(y)][(x) >> 6] >> (63 - ((x) & 63))) & 0x1)
 
 #define TARGET_CLOCK_SPEED 540
 #define SCREEN_REFRESH_RATE 60
@@ -21,8 +43,11 @@ public:
 
 	// memory
 	//  0x00 -> 0x50 = font set
+	//  0x50 -> 0xF0 = large font set (SCHIP / XO-CHIP)
 	//  0x200 = start of program memory
-    static const uint16 MEMORY_SIZE = 4096;
+	//  every machine has the 64K address space of XO-CHIP, CHIP-8 and SCHIP programs only ever use the first 4K
+    static const uint32_t MEMORY_SIZE = 65536;
+	static const uint16 FONT_LARGE_ADDRESS = 0x50;
 	uint8 memory[MEMORY_SIZE];
 
 	// 1 uint8 (8 bit) data registers
@@ -34,12 +59,27 @@ public:
 	uint16 pc;
 
 	// pixel state (1=on=white,0=off=black)
-	uint8 gfx[GFX_SIZE];
+	//  GFX_ROW_WORDS 64 bit words per row, the most significant bit of the first word is the leftmost pixel (x = 0)
+	//  in lo-res mode only the first word of the first GFX_LORES_HEIGHT rows is used
+	gfx_plane gfx[GFX_PLANES];
+
+	// SCHIP / XO-CHIP display mode and the planes DXYN, 00E0 and the scrolls work on (XO-CHIP FN01)
+	bool hires;
+	uint8 planes;
 
 	// timers
 	uint8 delay_timer;
 	uint8 sound_timer;
 
+	// emulated time, see Scheduler.h
+	//  'cycle' counts the instructions since initialize(), fast-forwarded ones included. The vblank (timer
+	//  tick) comes every cycles_per_frame of them, key changes at the cycle they were queued for
+	chip8_scheduler scheduler;
+	uint64 cycle;
+	uint64 frames;              // vblanks delivered since the machine was created
+	int cycles_per_frame;       // clock / SCREEN_REFRESH_RATE, TARGET_CLOCK_SPEED unless setClock() changes it
+	bool vblank;                // a vblank came since the last DXYN, the display wait quirk draws only then
+
 	// stack and stack pointer (sp)
     static const uint16 STACK_LEVELS = 16;
 	uint16 stack[STACK_LEVELS];
@@ -51,9 +91,33 @@ public:
     static const uint16 KEY_STATES = 16;
 	uint8 key[KEY_STATES];
 
+	// SCHIP persistent flag registers (FX75 / FX85)
+	uint8 rpl[REGISTER_COUNT];
+
+	// XO-CHIP audio pattern (F002) and pitch (FX3A)
+	uint8 audio_pattern[16];
+	uint8 pitch;
+
 	// draw flag (if we draw next cycle)
 	uint16 drawFlag;
 
+	// random number generator (per instance so independent machines don't share the C runtime rand())
+	uint32_t random_state;
+
+	// set once an unrecoverable error stopped the emulation
+	bool faulted;
+
+	// the interactive build waits for a key and exits on a fault, batch runs keep the process alive
+	bool exit_on_fault;
+
+	// idle loop fast-forward (on by default):  once the machine sits in a loop that can't make progress
+	//  before the next scheduled event (vblank, key change), emulateCycles counts the whole passes of it
+	//  left in the batch as executed instead of running them, which leaves the machine exactly where
+	//  running them would have. Every engine checks right before the loop's first instruction.
+	//  idle_cycles adds up the cycles skipped that way
+	bool fast_forward;
+	uint64 idle_cycles;
+
 	// font set
 	uint8 chip8_fontset[80] =
 	{
@@ -75,18 +139,121 @@ public:
 		0xF0, 0x80, 0xF0, 0x80, 0x80  // F  addr 0x4B
 	};
 
+	// large font set (8x10), 0-9 from SCHIP, A-F from XO-CHIP
+	uint8 chip8_fontset_large[160] =
+	{
+		0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0  addr 0x50
+		0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1  addr 0x5A
+		0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2  addr 0x64
+		0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3  addr 0x6E
+		0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4  addr 0x78
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5  addr 0x82
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6  addr 0x8C
+		0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7  addr 0x96
+		0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8  addr 0xA0
+		0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9  addr 0xAA
+		0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A  addr 0xB4
+		0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B  addr 0xBE
+		0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C  addr 0xC8
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D  addr 0xD2
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E  addr 0xDC
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F  addr 0xE6
+	};
+
 	chip8();
 	~chip8();
 
 	void initialize();
 	void emulateCycle();
+	int emulateCycles(int cycles);
+
+	// runs up to 'cycles' instructions, uninterrupted from one scheduled event to the next, and delivers
+	//  every event that falls due (also right at the end). With 'until_vblank' it returns after the first
+	//  vblank. Returns the instructions executed
+	int run(int cycles, bool until_vblank = false);
+
+	// for a caller that runs the engines itself (lockstep):  how far it may go, then advance() by what it
+	//  ran to deliver what fell due. advance() is true when a vblank was among it
+	int cyclesUntilEvent() const;
+	bool advance(int cycles);
+
+	// instructions per second, the next vblank moves to the new frame length
+	void setClock(int hz);
+	// a key change at emulated cycle 'at' (now, when that has passed)
+	void queueKey(uint64 at, uint8 key, bool pressed);
+
+	// every key change from here on goes into 'log' (NULL stops), at the cycle it was delivered, see Input.h
+	input_log *input_recorder;
+	void recordInput(input_log *log) { input_recorder = log; }
+
+	// loops that only wait:  1NNN to itself, FX0A, 'FX07 / 3XNN or 4XNN / 1NNN back' on the delay timer
+	//  and 'EX9E or EXA1 / 1NNN back' on a key
+	enum idle_loops {
+		IDLE_NONE = 0,
+		IDLE_SELF_JUMP,
+		IDLE_KEY_WAIT,
+		IDLE_DELAY_POLL,
+		IDLE_KEY_POLL,
+		IDLE_DISPLAY_WAIT   // DXYN under the display wait quirk, until the next vblank
+	};
+	typedef enum idle_loops IdleLoop;
+
+	IdleLoop idleLoopShape(uint16 address) const;  // instructions only
+	IdleLoop idleLoop() const;                      // the loop at pc is waiting right now
+	int skipIdle(int remaining);                    // fast-forward, the cycles skipped (whole passes, 0 = none)
 	bool loadApp(char *filename);
+	bool loadRom(const uint8 *data, size_t size);   // false (nothing loaded) when it doesn't fit the machine
 	void setKeys();
     void updateTimers();
+	void seedRandom(uint32_t seed);
+	uint8 nextRandom();
+	void fault();
+	void clearScreen(uint8 plane_mask = 0x3);
+	void scrollDown(uint8 rows);
+	void scrollUp(uint8 rows);
+	void scrollRight();
+	void scrollLeft();
+	uint64 framebufferHash();
+	bool framebufferEquals(const gfx_plane other[GFX_PLANES]);
+
+	int screenWidth() const { return hires ? GFX_WIDTH : GFX_LORES_WIDTH; }
+	int screenHeight() const { return hires ? GFX_HEIGHT : GFX_LORES_HEIGHT; }
+
+	// machine variants
+	//  MACHINE_CHIP8  = the original instruction set, 64x32
+	//  MACHINE_SCHIP  = SUPER-CHIP 1.1:  128x64 hi-res mode, scrolling, 16x16 sprites, large font, flag registers
+	//  MACHINE_XOCHIP = SCHIP plus XO-CHIP:  two bit-planes, 16 bit I (F000 NNNN), 5XY2 / 5XY3, audio pattern
+	enum machines {
+		MACHINE_CHIP8 = 0,
+		MACHINE_SCHIP,
+		MACHINE_XOCHIP,
+		NUMBER_OF_MACHINES
+	};
+
+	typedef enum machines Machine;
+
+	Machine machine;
 
-	template <typename T>
-	void debug_fmt_msg(char formatted_message[], T values);
-	void debug_simple_msg(char *message);
+	// also selects the matching quirk profile, and sizes the decode cache (and the JIT) for the machine's memory
+	void setMachine(Machine);
+	// the memory a program of the machine can reach:  4K, the whole 64K on XO-CHIP
+	uint32_t programMemory() const { return (machine == MACHINE_XOCHIP) ? MEMORY_SIZE : 4096; }
+	static bool parseMachine(const char *name, Machine &selected);
+	static const char *machineName(Machine selected);
+
+	// bytes a skip instruction at pc jumps over (XO-CHIP skips the 4 byte F000 NNNN as a whole)
+	uint16 skipLength() const {
+		return (machine == MACHINE_XOCHIP && memory[(uint16)(pc + 2)] == 0xF0 && memory[(uint16)(pc + 3)] == 0x00) ? 6 : 4;
+	}
+
+	// bytes the instruction stores from I on:  FX33 3, FX55 V0..VX, XO-CHIP 5XY2 VX..VY, 0 for everything else
+	uint16 memoryWriteLength(uint16 opcode) const;
+
+	// save states, see SaveState.h
+	void saveState(chip8_state &state) const;
+	bool loadState(const chip8_state &state);
+	bool saveStateFile(const char *filename) const;
+	bool loadStateFile(const char *filename);
 
 	/**
 	 * When adding opcodes:
@@ -94,6 +261,7 @@ public:
 	 *  2.  Add the declaration of the opcode routine under '// opcode routines'
 	 *  3.  Add the address of the routine to the end of 'opcode_impls'
 	 *  4.  Define the implementation of the opcode routine in Chip8.cpp
+	 *  5.  Decode it in 'decodeOpcode', the lookup table follows at compile time
 	*/
 
 	// opcodes
@@ -134,6 +302,22 @@ public:
 		_0xFX33,
 		_0xFX55,
 		_0xFX65,
+		_0x00CN,
+		_0x00DN,
+		_0x00FB,
+		_0x00FC,
+		_0x00FD,
+		_0x00FE,
+		_0x00FF,
+		_0x5XY2,
+		_0x5XY3,
+		_0xF000,
+		_0xFN01,
+		_0xF002,
+		_0xFX30,
+		_0xFX3A,
+		_0xFX75,
+		_0xFX85,
 		NUMBER_OF_OPCODES
 	};
 
@@ -141,47 +325,72 @@ public:
 	
 
 	// translate opcode
+	//  one load from a table of every raw opcode on every machine, built at compile time from decodeOpcode
 	Opcode translate_opcode(uint16);
+	static constexpr Opcode decodeOpcode(Machine machine, uint16 opcode);
+
+	// predecoded operands, see the decode cache below
+	struct decoded_instruction;
 
 	// opcode routines
-	bool opcode_0x00E0(uint16);
-	bool opcode_0x00EE(uint16);
-	bool opcode_0x0NNN(uint16);
-	bool opcode_0x1NNN(uint16);
-	bool opcode_0x2NNN(uint16);
-	bool opcode_0x3XNN(uint16);
-	bool opcode_0x4XNN(uint16);
-	bool opcode_0x5XY0(uint16);
-	bool opcode_0x6XNN(uint16);
-	bool opcode_0x7XNN(uint16);
-	bool opcode_0x8XY0(uint16);
-	bool opcode_0x8XY1(uint16);
-	bool opcode_0x8XY2(uint16);
-	bool opcode_0x8XY3(uint16);
-	bool opcode_0x8XY4(uint16);
-	bool opcode_0x8XY5(uint16);
-	bool opcode_0x8XY6(uint16);
-	bool opcode_0x8XY7(uint16);
-	bool opcode_0x8XYE(uint16);
-	bool opcode_0x9XY0(uint16);
-	bool opcode_0xANNN(uint16);
-	bool opcode_0xBNNN(uint16);
-	bool opcode_0xCXNN(uint16);
-	bool opcode_0xDXYN(uint16);
-	bool opcode_0xEX9E(uint16);
-	bool opcode_0xEXA1(uint16);
-	bool opcode_0xFX07(uint16);
-	bool opcode_0xFX0A(uint16);
-	bool opcode_0xFX15(uint16);
-	bool opcode_0xFX18(uint16);
-	bool opcode_0xFX1E(uint16);
-	bool opcode_0xFX29(uint16);
-	bool opcode_0xFX33(uint16);
-	bool opcode_0xFX55(uint16);
-	bool opcode_0xFX65(uint16);
+	//  the templated ones differ between interpreters, see Quirks.h
+	bool opcode_0x00E0(const decoded_instruction &);
+	bool opcode_0x00EE(const decoded_instruction &);
+	bool opcode_0x0NNN(const decoded_instruction &);
+	bool opcode_0x1NNN(const decoded_instruction &);
+	bool opcode_0x2NNN(const decoded_instruction &);
+	bool opcode_0x3XNN(const decoded_instruction &);
+	bool opcode_0x4XNN(const decoded_instruction &);
+	bool opcode_0x5XY0(const decoded_instruction &);
+	bool opcode_0x6XNN(const decoded_instruction &);
+	bool opcode_0x7XNN(const decoded_instruction &);
+	bool opcode_0x8XY0(const decoded_instruction &);
+	template <class Quirks> bool opcode_0x8XY1(const decoded_instruction &);
+	template <class Quirks> bool opcode_0x8XY2(const decoded_instruction &);
+	template <class Quirks> bool opcode_0x8XY3(const decoded_instruction &);
+	bool opcode_0x8XY4(const decoded_instruction &);
+	bool opcode_0x8XY5(const decoded_instruction &);
+	template <class Quirks> bool opcode_0x8XY6(const decoded_instruction &);
+	bool opcode_0x8XY7(const decoded_instruction &);
+	template <class Quirks> bool opcode_0x8XYE(const decoded_instruction &);
+	bool opcode_0x9XY0(const decoded_instruction &);
+	bool opcode_0xANNN(const decoded_instruction &);
+	template <class Quirks> bool opcode_0xBNNN(const decoded_instruction &);
+	bool opcode_0xCXNN(const decoded_instruction &);
+	template <class Quirks> bool opcode_0xDXYN(const decoded_instruction &);
+	bool opcode_0xEX9E(const decoded_instruction &);
+	bool opcode_0xEXA1(const decoded_instruction &);
+	bool opcode_0xFX07(const decoded_instruction &);
+	bool opcode_0xFX0A(const decoded_instruction &);
+	bool opcode_0xFX15(const decoded_instruction &);
+	bool opcode_0xFX18(const decoded_instruction &);
+	bool opcode_0xFX1E(const decoded_instruction &);
+	bool opcode_0xFX29(const decoded_instruction &);
+	bool opcode_0xFX33(const decoded_instruction &);
+	template <class Quirks> bool opcode_0xFX55(const decoded_instruction &);
+	template <class Quirks> bool opcode_0xFX65(const decoded_instruction &);
+
+	// SCHIP / XO-CHIP opcode routines
+	bool opcode_0x00CN(const decoded_instruction &);
+	bool opcode_0x00DN(const decoded_instruction &);
+	bool opcode_0x00FB(const decoded_instruction &);
+	bool opcode_0x00FC(const decoded_instruction &);
+	bool opcode_0x00FD(const decoded_instruction &);
+	bool opcode_0x00FE(const decoded_instruction &);
+	bool opcode_0x00FF(const decoded_instruction &);
+	bool opcode_0x5XY2(const decoded_instruction &);
+	bool opcode_0x5XY3(const decoded_instruction &);
+	bool opcode_0xF000(const decoded_instruction &);
+	bool opcode_0xFN01(const decoded_instruction &);
+	bool opcode_0xF002(const decoded_instruction &);
+	bool opcode_0xFX30(const decoded_instruction &);
+	bool opcode_0xFX3A(const decoded_instruction &);
+	bool opcode_0xFX75(const decoded_instruction &);
+	bool opcode_0xFX85(const decoded_instruction &);
 
 	// opcode information
-	typedef bool(chip8::*opcode_impl)(uint16);
+	//  the routines take the operands predecoded (see decoded_instruction), never the raw opcode
+	typedef bool(chip8::*opcode_impl)(const decoded_instruction &);
 	struct opcode_info {
 		Opcode opcode;
 		char *description;
@@ -201,19 +410,19 @@ public:
 		{ _0x6XNN, "Sets VX to NN.",                                                                &chip8::opcode_0x6XNN },
 		{ _0x7XNN, "Adds NN to VX. (Carry flag is not changed).",                                   &chip8::opcode_0x7XNN },
 		{ _0x8XY0, "Sets VX to the value of VY.",                                                   &chip8::opcode_0x8XY0 },
-		{ _0x8XY1, "Sets VX to VX or VY (Bitwise OR operation).",                                   &chip8::opcode_0x8XY1 },
-		{ _0x8XY2, "Sets VX to VX and VY. (Bitwise AND operation).",                                &chip8::opcode_0x8XY2 },
-		{ _0x8XY3, "Sets VX to VX xor VY.",                                                         &chip8::opcode_0x8XY3 },
+		{ _0x8XY1, "Sets VX to VX or VY (Bitwise OR operation).",                                   &chip8::opcode_0x8XY1<quirks_modern> },
+		{ _0x8XY2, "Sets VX to VX and VY. (Bitwise AND operation).",                                &chip8::opcode_0x8XY2<quirks_modern> },
+		{ _0x8XY3, "Sets VX to VX xor VY.",                                                         &chip8::opcode_0x8XY3<quirks_modern> },
 		{ _0x8XY4, "Adds VY to VX. VF=1 if carry, VF=0 if no carry.",                               &chip8::opcode_0x8XY4 },
 		{ _0x8XY5, "VY is subtracted from VX. VF=0 if borrow, VF=1 if no borrow.",                  &chip8::opcode_0x8XY5 },
-		{ _0x8XY6, "VF = LSB of VY, then VX=(VY >> 1). Modern = VF = LSB of VX, then VX >> 1.",     &chip8::opcode_0x8XY6 },
+		{ _0x8XY6, "VF = LSB of VX, then VX >>= 1. VIP quirk: VF = LSB of VY, then VX = VY >> 1.",   &chip8::opcode_0x8XY6<quirks_modern> },
 		{ _0x8XY7, "Sets VX to VY minus VX. VF=0 if borrow, VF=1 if no borrow.",                    &chip8::opcode_0x8XY7 },
-		{ _0x8XYE, "VF = MSB of VY, then VX=(VY << 1). Modern = VF = MSB of VX, then VX << 1.",     &chip8::opcode_0x8XYE },
+		{ _0x8XYE, "VF = MSB of VX, then VX <<= 1. VIP quirk: VF = MSB of VY, then VX = VY << 1.",   &chip8::opcode_0x8XYE<quirks_modern> },
 		{ _0x9XY0, "Skips the next instruction if VX doesn't equal VY.",                            &chip8::opcode_0x9XY0 },
 		{ _0xANNN, "Sets I to the address NNN.",                                                    &chip8::opcode_0xANNN },
-		{ _0xBNNN, "Jumps to the address NNN plus V0.",                                             &chip8::opcode_0xBNNN },
+		{ _0xBNNN, "Jumps to the address NNN plus V0.",                                             &chip8::opcode_0xBNNN<quirks_modern> },
 		{ _0xCXNN, "Sets VX=result of bitwise and operation between random(0 to 255) and NN.",      &chip8::opcode_0xCXNN },
-		{ _0xDXYN, "Draw a sprite on screen (sprite=8 pixels wide, (opcode & 0x000F) pixels high)", &chip8::opcode_0xDXYN },
+		{ _0xDXYN, "Draw a sprite on screen (sprite=8 pixels wide, (opcode & 0x000F) pixels high)", &chip8::opcode_0xDXYN<quirks_modern> },
 		{ _0xEX9E, "Skips the next instruction if the key stored in VX is pressed.",                &chip8::opcode_0xEX9E },
 		{ _0xEXA1, "Skips the next instruction if the key stored in VX isn't pressed.",             &chip8::opcode_0xEXA1 },
 		{ _0xFX07, "Sets VX to the value of the delay timer.",                                      &chip8::opcode_0xFX07 },
@@ -223,9 +432,150 @@ public:
 		{ _0xFX1E, "Adds VX to I. VF=1 if range overflow (I+VX>0xFFF), VF=0 if no range overflow",  &chip8::opcode_0xFX1E },
 		{ _0xFX29, "Sets I to the location of the sprite for the character in VX. Hex Chars 4x5",   &chip8::opcode_0xFX29 },
 		{ _0xFX33, "I=MSD(decimal(VX)), I+1=mid(decimal(VX)), I+2=LSB(decimal(VX)).",               &chip8::opcode_0xFX33 },
-		{ _0xFX55, "Stores V0 to VX (inclusive) starting memory[I]. I+=1 for each value written.",  &chip8::opcode_0xFX55 },
-		{ _0xFX65, "Dump to V0 to VX (inclusive) starting memory[I]. I+=1 for each value written.", &chip8::opcode_0xFX65 }
+		{ _0xFX55, "Stores V0 to VX (inclusive) starting memory[I]. I+=1 for each value written.",  &chip8::opcode_0xFX55<quirks_modern> },
+		{ _0xFX65, "Dump to V0 to VX (inclusive) starting memory[I]. I+=1 for each value written.", &chip8::opcode_0xFX65<quirks_modern> },
+		{ _0x00CN, "(SCHIP) Scroll the display down N rows.",                                       &chip8::opcode_0x00CN },
+		{ _0x00DN, "(XO-CHIP) Scroll the display up N rows.",                                       &chip8::opcode_0x00DN },
+		{ _0x00FB, "(SCHIP) Scroll the display right 4 pixels.",                                    &chip8::opcode_0x00FB },
+		{ _0x00FC, "(SCHIP) Scroll the display left 4 pixels.",                                     &chip8::opcode_0x00FC },
+		{ _0x00FD, "(SCHIP) Exit the interpreter.",                                                 &chip8::opcode_0x00FD },
+		{ _0x00FE, "(SCHIP) Switch to lo-res (64x32) mode and clear the screen.",                   &chip8::opcode_0x00FE },
+		{ _0x00FF, "(SCHIP) Switch to hi-res (128x64) mode and clear the screen.",                  &chip8::opcode_0x00FF },
+		{ _0x5XY2, "(XO-CHIP) Store VX to VY (inclusive, either direction) starting memory[I].",    &chip8::opcode_0x5XY2 },
+		{ _0x5XY3, "(XO-CHIP) Load VX to VY (inclusive, either direction) starting memory[I].",     &chip8::opcode_0x5XY3 },
+		{ _0xF000, "(XO-CHIP) Sets I to the 16 bit address in the next word. 4 bytes long.",        &chip8::opcode_0xF000 },
+		{ _0xFN01, "(XO-CHIP) Select the bit-planes N for drawing, clearing and scrolling.",        &chip8::opcode_0xFN01 },
+		{ _0xF002, "(XO-CHIP) Load the 16 byte audio pattern from memory[I].",                      &chip8::opcode_0xF002 },
+		{ _0xFX30, "(SCHIP) Sets I to the large (8x10) font character in VX.",                      &chip8::opcode_0xFX30 },
+		{ _0xFX3A, "(XO-CHIP) Sets the audio pitch to VX.",                                         &chip8::opcode_0xFX3A },
+		{ _0xFX75, "(SCHIP) Store V0 to VX (inclusive) in the persistent flag registers.",          &chip8::opcode_0xFX75 },
+		{ _0xFX85, "(SCHIP) Load V0 to VX (inclusive) from the persistent flag registers.",         &chip8::opcode_0xFX85 }
+	};
+
+	// predecoded instruction cache
+	//  one entry per even address holding the resolved routine and the operands extracted from the opcode
+	//  entries are filled the first time the address is executed and invalidated when memory is written
+	typedef int(chip8::*fused_impl)(decoded_instruction *);
+
+	struct decoded_instruction {
+		opcode_impl executor;
+		fused_impl fused;       // superinstruction starting here (see fuseInstruction), NULL when there is none
+		uint8 fused_length;     // instructions 'fused' runs at most, 0 = not looked for yet
+		Opcode opcode;
+		uint16 raw;
+		uint16 nnn;
+		uint8 x;
+		uint8 y;
+		uint8 n;
+		uint8 nn;
+		uint8 skip;     // bytes a taken skip moves pc by, see skipLength()
+		bool valid;
+	};
+
+	// one entry per even address of programMemory(), allocated by setMachine:  a CHIP-8 or SCHIP instance
+	//  keeps 2K entries, not XO-CHIP's 32K. A pc with any bit of 'decode_miss' set (odd, or past the cached
+	//  memory) is never looked up, it is decoded into a temporary every time like an odd one
+	decoded_instruction *decode_cache;
+	uint32_t decode_cache_size;
+	uint16 decode_miss;
+	void allocateDecodeCache();
+	// NULL for an address the cache doesn't hold
+	decoded_instruction *cachedInstruction(uint32_t address) {
+		return ((address & decode_miss) == 0 && address < MEMORY_SIZE) ? &decode_cache[address >> 1] : NULL;
+	}
+
+	bool decodeInstruction(uint16 address, decoded_instruction &instruction);
+	void invalidateDecodeCache();
+	void invalidateDecodeCache(uint16 address);
+
+	// superinstructions (on by default), the interpreter loop of emulateCycles runs the commonest sequences
+	//  of the opcode pair / triple profile with one dispatch:
+	//      ANNN DXYN               set I and draw
+	//      6XNN 6XNN ...           up to FUSE_MAX register loads
+	//      3XNN/4XNN 1NNN          skip over a jump
+	//      FX07 3XNN/4XNN 1NNN     delay timer poll
+	//  A sequence is looked for the first time its first instruction runs and only ever entered there, an
+	//  instruction in the middle of one still runs on its own when a jump lands on it. Writing to any of its
+	//  instructions drops it. emulateCycle (and with it tracing, profiling and lockstep) never fuses
+	static const int FUSE_MAX = 4;
+	bool fusion;
+	void fuseInstruction(uint16 address);
+	int fused_0xANNN_0xDXYN(decoded_instruction *head);
+	int fused_0x6XNN_run(decoded_instruction *head);
+	int fused_skip_0x1NNN(decoded_instruction *head);
+	int fused_0xFX07_skip_0x1NNN(decoded_instruction *head);
+
+	// decodes every block of a static analysis (see Analysis.h) into the cache, and on the JIT compiles
+	//  them, before the first instruction runs. loadRom starts over with an empty cache, call it after
+	void prewarm(const rom_analysis &analysis);
+
+	// execution engines
+	//  ENGINE_INTERPRETER = emulateCycle per instruction (the reference implementation)
+	//  ENGINE_JIT         = native basic blocks, see Jit.h
+	//  ENGINE_THREADED    = batched interpreter with locals and computed goto dispatch, see Chip8_Threaded.cpp
+	enum engines {
+		ENGINE_INTERPRETER = 0,
+		ENGINE_JIT,
+		ENGINE_THREADED,
+		NUMBER_OF_ENGINES
+	};
+
+	typedef enum engines Engine;
+
+	Engine engine;
+	chip8_jit *jit;
+
+	bool setEngine(Engine);
+
+	// quirk profiles, see Quirks.h
+	//  selected before loading a ROM, each one swaps in its own instantiation of the templated opcode
+	//  routines and of the threaded engine
+	enum quirk_profiles {
+		QUIRKS_MODERN = 0,
+		QUIRKS_VIP,
+		QUIRKS_SCHIP,
+		QUIRKS_XOCHIP,
+		NUMBER_OF_QUIRK_PROFILES
 	};
+
+	typedef enum quirk_profiles QuirkProfile;
+
+	QuirkProfile quirk_profile;
+	quirk_settings quirks;
+
+	void setQuirks(QuirkProfile);
+	static bool parseQuirks(const char *name, QuirkProfile &profile);
+	static const char *quirksName(QuirkProfile profile);
+
+	template <class Quirks> void useQuirks();
+	template <class Quirks, bool Traced = false> int threadedLoop(int cycles);
+	typedef int(chip8::*threaded_loop)(int);
+	threaded_loop threaded;
+	threaded_loop threaded_traced;
+
+#ifdef CHIP8_PROFILE
+	// opcode / pc profiling, see Profiler.h
+	chip8_profile *profile;
+	void enableProfiling();
+#endif
+
+	// execution trace, see Trace.h. While tracing emulateCycles records every instruction, the interpreter
+	//  through tracedCycle, the threaded engine (and the JIT, which can't) through threaded_traced
+	trace_recorder *trace;
+	bool startTrace(const char *path);
+	void stopTrace();
+	void traceInstruction(uint16 address, uint16 opcode, uint16 old_I, uint16 changed, const uint8 *registers,
+		uint16 new_I, uint32_t written, uint8 flags);
+	void tracedCycle();                             // emulateCycle, recorded
+	static uint16 changedRegisters(const uint8 *before, const uint8 *after);
+
+	// audio output, see Audio.h. updateTimers hands every tick to it, startAudio takes ownership of the sink
+	chip8_audio *audio;
+	void startAudio(audio_sink *sink);
+	void stopAudio();
+	// while audio is attached every engine calls this after an FX18 with the cycle the instruction ended
+	//  at (the batch's first cycle plus what it has run, FX18 included), the tone edge gets that cycle
+	void soundTimerWritten(uint64 at);
 };
 
 #endif
\ No newline at end of file
@@ -1,29 +1,150 @@
 #include "Chip8.h"
 #include "Timer.h"
+#include "TripleBuffer.h"
+#include "SpscQueue.h"
+#include "Rewind.h"
+#include "Rom.h"
+#include "Log.h"
+#include "Audio.h"
+#include "Video.h"
+#include "Analysis.h"
+#include "Timeline.h"
+#include "Input.h"
 #include "GL/glut.h"
-
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// size of a lo-res pixel, hi-res pixels are half of it so the window keeps its size
 int pixel_size = 10;
 
 // window size
-int display_width = GFX_WIDTH * pixel_size;
-int display_height = GFX_HEIGHT * pixel_size;
+int display_width = GFX_LORES_WIDTH * pixel_size;
+int display_height = GFX_LORES_HEIGHT * pixel_size;
 
-// glut functions
+// emulation thread
+void emulation_thread();
+void startEmulation();
+void stopEmulation();
 void emulate_loop();
+void emulate_frame();
+void publishFrame();
+void applyKeyEvents(int cycles_ahead);
+void applyCommands();
+void rewindFrame();
+
+// glut functions
+void render_idle();
+void reportSpeed();
 void display();
-void drawPixel(int, int);
-void updateQuads();
+void drawFrame();
 void reshape_window(GLsizei w, GLsizei h);
 void keyboardUp(unsigned char key, int x, int y);
 void keyboardDown(unsigned char key, int x, int y);
+void specialDown(int key, int x, int y);
+void changeSpeed(unsigned char key);
+
+// setup
+void parseOptions(int argc, char **argv);
+bool loadGame(const char *path);
 
 // the chip to use 
 chip8 emu_chip;
 
-// cycle / clock timer
+// cycle / clock timer, instruction_count only paces the recorded frames while rewinding (the chip's
+//  own cycle counter and scheduler time everything else)
 Timer timer;
 int instruction_count = 0;
 
+// command line / catalogue settings, the command line wins
+//  keys_option is a layout for 'keymap' (the host key of every chip8 key, 0 first, see Input.h)
+const char *catalogue_path = NULL;
+const char *trace_path = NULL;
+const char *wav_path = NULL;
+const char *timeline_path = NULL;
+const char *keys_option = NULL;
+chip8::Machine machine_option = chip8::NUMBER_OF_MACHINES;
+chip8::QuirkProfile quirks_option = chip8::NUMBER_OF_QUIRK_PROFILES;
+key_map keymap;
+uint64 rom_hash = 0;
+
+// input logs (see Input.h):  --record=<file> writes every key change with the cycle it reached the chip at,
+//  --replay=<file> plays one back (with its random seed) and ignores the keyboard's chip8 keys
+const char *record_path = NULL;
+const char *replay_path = NULL;
+input_log recorded_input;
+input_log replayed_input;
+bool replaying = false;
+
+// live key events are mapped onto the emulated timeline with one host frame of delay, see applyKeyEvents.
+//  key_ready is the first cycle the next event of each key may land on (presses are held a frame at least)
+uint64 last_input_tick = 0;
+uint64 key_ready[chip8::KEY_STATES];
+
+// the screen is expanded to RGBA on the CPU (see Video.h) and drawn as one image, --palette= and
+//  --phosphor=<0-255> pick its colours and how slowly pixels that went dark fade
+frame_scaler scaler;
+
+// pacing
+//  PACING_FRAME        = one burst of a frame's instructions, then sleep until the next frame (default)
+//  PACING_INSTRUCTION  = one instruction at a time, busy-waiting 1/540s in between
+enum pacing_modes { PACING_FRAME = 0, PACING_INSTRUCTION };
+pacing_modes pacing = PACING_FRAME;
+FramePacer frame_pacer;
+
+// speed
+//  a multiple of real time, SPEED_UNCAPPED runs as fast as the host allows. The timers still tick once per
+//  frame's worth of instructions, so a faster run is the same run, only sooner. Above real time only the last
+//  emulated frame of every host frame (1/60s) is published, the frames in between are skipped.
+//  Tab toggles uncapped, '=' and '-' double / halve the multiplier
+#define SPEED_UNCAPPED 0
+#define MAX_SPEED 64
+std::atomic<int> speed(1);
+std::atomic<long long> emulated_frames(0);
+std::atomic<long long> emulated_instructions(0);    // the render thread's speed report reads these two, never emu_chip
+
+// frame pacing instrumentation, see Timeline.h. Always recorded, --timeline=<file> writes it out at exit
+//  the emulation thread owns 'timeline', the render thread 'presents'. Key events carry the TickClock time
+//  of the GLUT callback, the oldest one taken in since the last published frame rides along with it
+frame_timeline timeline;
+present_log presents;
+uint64 pending_input = 0;
+uint64 published_frames = 0;
+
+// threading
+//  the emulation thread owns emu_chip, the GLUT (render) thread only ever touches the two queues below:
+//  finished frames travel one way through a lock-free triple buffer, key presses the other way through a ring
+struct frame {
+    gfx_plane gfx[GFX_PLANES];
+    bool hires;
+    uint64 sequence;
+    uint64 input_tick;
+};
+
+struct key_event {
+    uint8 key;
+    uint8 pressed;
+    uint64 tick;
+};
+
+TripleBuffer<frame> frames;
+SpscQueue<key_event, 64> key_events;
+std::thread emulator;
+std::atomic<bool> emulator_running(false);
+
+// save states and rewind
+//  F5 = save to <rom>.state, F9 = load it, hold backspace to run backwards one frame at a time
+enum emulator_commands { COMMAND_SAVE_STATE = 0, COMMAND_LOAD_STATE };
+SpscQueue<uint8, 16> commands;
+std::atomic<bool> rewinding(false);
+rewind_buffer history;
+std::string state_path;
+
 // Chip8 Graphics Setup Calls
 void setupGraphics(int argc, char **argv)
 {
@@ -34,14 +155,14 @@ void setupGraphics(int argc, char **argv)
 	glutInitWindowPosition(320, 320);
 	glutCreateWindow("Chip8 by Tom S");
 
-    glClearColor(0.0f, 0.0f, 0.5f, 0.0f);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     gluOrtho2D(0.0, display_width, display_height, 0.0); // this is projecting down the Y access
 
 	glutDisplayFunc(display);
-	glutIdleFunc(emulate_loop);
+	glutIdleFunc(render_idle);
 	glutReshapeFunc(reshape_window);
 }
 
@@ -50,56 +171,327 @@ void setupInputs()
 	// OpenGL Inputs - call functions when key is pressed or released
 	glutKeyboardFunc(keyboardDown);
 	glutKeyboardUpFunc(keyboardUp);
+	glutSpecialFunc(specialDown);
 }
 
-// GLUT Callbacks
+// Emulation thread
+
+void emulation_thread()
+{
+    frame_pacer.start(NANO_SECONDS_PER_HZ / SCREEN_REFRESH_RATE);
+    timeline.start();
+
+    while (emulator_running.load(std::memory_order_relaxed)) {
+        if (pacing == PACING_FRAME) {
+            emulate_frame();
+        }
+        else {
+            emulate_loop();
+        }
+    }
+}
+
+void startEmulation()
+{
+    emulator_running = true;
+    emulator = std::thread(emulation_thread);
+}
+
+// also registered with atexit, GLUT leaves through exit() and a joinable std::thread would terminate()
+void stopEmulation()
+{
+    emulator_running = false;
+    if (emulator.joinable()) {
+        emulator.join();
+    }
+
+    // completes the trace file (last chunk and index) and the audio file
+    emu_chip.stopTrace();
+    emu_chip.stopAudio();
+
+    // once, the render thread no longer presents either (this runs on it)
+    if (timeline_path != NULL) {
+        if (timeline.write(timeline_path, presents)) {
+            LOG_INFO(LOG_TIMELINE_WRITTEN, timeline_path, (int64_t)timeline.frames(), (int64_t)timeline.missed());
+        }
+        else {
+            LOG_WARN(LOG_TIMELINE_FAILED, timeline_path);
+        }
+        timeline_path = NULL;
+    }
+    if (record_path != NULL) {
+        if (recorded_input.save(record_path)) {
+            LOG_INFO(LOG_INPUT_RECORDED, record_path, (int)recorded_input.events().size());
+        }
+        else {
+            LOG_WARN(LOG_INPUT_RECORD_FAILED, record_path);
+        }
+        record_path = NULL;
+    }
+}
+
+// hand the current screen to the render thread
+void publishFrame()
+{
+    frame &next = frames.writeBuffer();
+    memcpy(next.gfx, emu_chip.gfx, sizeof(emu_chip.gfx));
+    next.hires = emu_chip.hires;
+    next.sequence = ++published_frames;
+    next.input_tick = pending_input;
+    pending_input = 0;
+    frames.publish();
+}
+
+// key presses queued by the GLUT callbacks since the last call, scheduled over the 'cycles_ahead' cycles
+//  the caller runs next the way they were spread over the host time since the last call:  one host frame
+//  of latency, but their order and spacing survive, to the instruction. A press is held for a frame at
+//  least, a tap shorter than that would otherwise fall between two polls of a game that reads the keys
+//  once per frame
+void applyKeyEvents(int cycles_ahead)
+{
+    uint64 now = TickClock::now();
+    uint64 since = (last_input_tick != 0) ? last_input_tick : now;
+    last_input_tick = now;
+
+    key_event event;
+    while (key_events.pop(event)) {
+        uint64 offset = 0;
+        if (now > since && event.tick > since) {
+            offset = (uint64)((double)(event.tick - since) / (double)(now - since) * cycles_ahead);
+            offset = std::min<uint64>(offset, cycles_ahead - 1);
+        }
+
+        uint64 at = std::max(emu_chip.cycle + offset, key_ready[event.key]);
+        key_ready[event.key] = event.pressed ? at + emu_chip.cycles_per_frame : at;
+        emu_chip.queueKey(at, event.key, event.pressed != 0);
+
+        if (pending_input == 0) {
+            pending_input = event.tick;
+        }
+    }
+}
+
+void applyCommands()
+{
+    uint8 command;
+    while (commands.pop(command)) {
+        if (command == COMMAND_SAVE_STATE) {
+            if (!emu_chip.saveStateFile(state_path.c_str())) {
+                LOG_WARN(LOG_STATE_WRITE_FAILED, state_path.c_str());
+            }
+        }
+        else if (command == COMMAND_LOAD_STATE) {
+            if (!emu_chip.loadStateFile(state_path.c_str())) {
+                LOG_WARN(LOG_STATE_LOAD_FAILED, state_path.c_str());
+            }
+            memset(key_ready, 0, sizeof(key_ready));
+        }
+    }
+}
+
+// step back one recorded frame
+void rewindFrame()
+{
+    if (history.rewind(emu_chip)) {
+        publishFrame();
+        emu_chip.drawFlag = false;
+        memset(key_ready, 0, sizeof(key_ready));
+    }
+}
 
 void emulate_loop() 
 {
-    // lock clock to 540hz
+    // lock clock to 540hz (times the speed multiplier)
+    int multiplier = speed.load(std::memory_order_relaxed);
     timer.start();
-    ++instruction_count;
+    {
+        timeline_probe probe(timeline, PHASE_TIMERS);
+        applyKeyEvents(1);
+        applyCommands();
+    }
 
-    if (instruction_count == (TARGET_CLOCK_SPEED / SCREEN_REFRESH_RATE)) {
-        // update timers
-        emu_chip.updateTimers();
-        instruction_count = 0;
+    bool tick;
+    if (rewinding) {
+        // nothing runs, a recorded frame goes by every frame's worth of steps
+        tick = (++instruction_count >= emu_chip.cycles_per_frame);
+        if (tick) {
+            timeline_probe probe(timeline, PHASE_DISPLAY);
+            instruction_count = 0;
+            rewindFrame();
+        }
+    }
+    else {
+        // emulate one cycle for the Chip8, the scheduler ticks the timers when a vblank falls due
+        uint64 frames = emu_chip.frames;
+        {
+            timeline_probe probe(timeline, PHASE_EXECUTE);
+            emulated_instructions.fetch_add(emu_chip.run(1), std::memory_order_relaxed);
+        }
+        tick = (emu_chip.frames != frames);
+        if (tick) {
+            timeline_probe probe(timeline, PHASE_TIMERS);
+            history.push(emu_chip);
+        }
     }
 
-    // emulate one cycle for the Chip8
-    emu_chip.emulateCycle();
-
-    // check the drawFlag to determine if we need to draw anything
-    if (emu_chip.drawFlag) {
+    // check the drawFlag to determine if we need to draw anything (once per emulated frame when running faster)
+    if (emu_chip.drawFlag && (multiplier == 1 || tick)) {
+        timeline_probe probe(timeline, PHASE_DISPLAY);
 
         // draw routine
-        display();
+        publishFrame();
 
         // reset the draw flag
         emu_chip.drawFlag = false;
     }
 
-    // check elapsed and wait to slow the emulation down to TARGET_CLOCK_SPEED (540hz)
+    // an emulated frame ends at the tick, one frame's length (at this speed) after the previous one
+    if (tick) {
+        emulated_frames.fetch_add(1, std::memory_order_relaxed);
+        long long period_ns = (multiplier == SPEED_UNCAPPED) ? 0 : NANO_SECONDS_PER_HZ / SCREEN_REFRESH_RATE / multiplier;
+        timeline.endFrame(emu_chip.cycle, 1, period_ns, period_ns ? timeline.frameElapsed() - period_ns : 0);
+    }
+
+    // check elapsed and wait to slow the emulation down to the clock speed (540hz by default)
+    if (multiplier == SPEED_UNCAPPED) {
+        return;
+    }
+    timeline_probe probe(timeline, PHASE_WAIT);
     timer.end();
     long long elapsed_ns = timer.elapsed();
-    while (elapsed_ns < (NANO_SECONDS_PER_HZ / TARGET_CLOCK_SPEED)) {
+    while (elapsed_ns < (NANO_SECONDS_PER_HZ / ((long long)emu_chip.cycles_per_frame * SCREEN_REFRESH_RATE * multiplier))) {
         timer.end();
         elapsed_ns = timer.elapsed();
     }
 }
 
+void emulate_frame()
+{
+    // run up to the next vblank in one burst, the timers tick on it (60hz)
+    const long long period_ns = NANO_SECONDS_PER_HZ / SCREEN_REFRESH_RATE;
+    int multiplier = speed.load(std::memory_order_relaxed);
+    {
+        timeline_probe probe(timeline, PHASE_TIMERS);
+        applyKeyEvents(emu_chip.cycles_per_frame * ((multiplier == SPEED_UNCAPPED) ? 1 : multiplier));
+        applyCommands();
+    }
+
+    if (rewinding) {
+        {
+            timeline_probe probe(timeline, PHASE_DISPLAY);
+            rewindFrame();
+        }
+        long long slack;
+        {
+            timeline_probe probe(timeline, PHASE_WAIT);
+            slack = frame_pacer.wait();
+        }
+        timeline.endFrame(emu_chip.cycle, 0, period_ns, -slack);
+        return;
+    }
+
+    // one host frame:  'speed' emulated frames, or as many as fit in 1/60s when uncapped
+    Clock::time_point frame_end = Clock::now() + std::chrono::nanoseconds(period_ns);
+    long long emulated = 0;
+    {
+        timeline_probe probe(timeline, PHASE_EXECUTE);
+        long long executed = 0;
+        do {
+            executed += emu_chip.run(emu_chip.cycles_per_frame, true);
+            ++emulated;
+        } while ((multiplier == SPEED_UNCAPPED) ? (Clock::now() < frame_end) : (emulated < multiplier));
+        emulated_instructions.fetch_add(executed, std::memory_order_relaxed);
+    }
+    emulated_frames.fetch_add(emulated, std::memory_order_relaxed);
+
+    // the rewind history keeps the frames that were shown
+    {
+        timeline_probe probe(timeline, PHASE_TIMERS);
+        history.push(emu_chip);
+    }
+
+    if (emu_chip.drawFlag) {
+        timeline_probe probe(timeline, PHASE_DISPLAY);
+        publishFrame();
+        emu_chip.drawFlag = false;
+    }
+
+    // sleep until the next frame is due, uncapped already used the whole frame
+    long long slack = 0;
+    {
+        timeline_probe probe(timeline, PHASE_WAIT);
+        if (multiplier == SPEED_UNCAPPED) {
+            frame_pacer.start(period_ns);
+        }
+        else {
+            slack = frame_pacer.wait();
+        }
+    }
+    timeline.endFrame(emu_chip.cycle, (int)emulated, period_ns, -slack);
+}
+
+// GLUT Callbacks
+
+// redraw only when the emulation thread published a new frame, otherwise give the core back
+void render_idle()
+{
+    reportSpeed();
+
+    // a fading phosphor needs a redraw every (vsynced) frame even when nothing new came in
+    if (frames.update() || scaler.isFading()) {
+        glutPostRedisplay();
+    }
+    else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// once a second:  the achieved emulation speed in the window title
+void reportSpeed()
+{
+    static Clock::time_point last_report = Clock::now();
+    static long long last_frames = 0;
+    static long long last_instructions = 0;
+
+    Clock::time_point now = Clock::now();
+    long long elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_report).count();
+    if (elapsed_ns < NANO_SECONDS_PER_HZ) {
+        return;
+    }
+
+    long long frames_now = emulated_frames.load(std::memory_order_relaxed);
+    long long instructions_now = emulated_instructions.load(std::memory_order_relaxed);
+    double frames_per_second = (frames_now - last_frames) * (double)NANO_SECONDS_PER_HZ / elapsed_ns;
+    double instructions_per_second = (instructions_now - last_instructions) * (double)NANO_SECONDS_PER_HZ / elapsed_ns;
+    last_report = now;
+    last_frames = frames_now;
+    last_instructions = instructions_now;
+
+    int multiplier = speed.load(std::memory_order_relaxed);
+    char title[128];
+    snprintf(title, sizeof(title), "Chip8 by Tom S - %.1fx (%.0f instructions/s)%s",
+        frames_per_second / SCREEN_REFRESH_RATE, instructions_per_second,
+        (multiplier == SPEED_UNCAPPED) ? " uncapped" : "");
+    glutSetWindowTitle(title);
+}
+
 void display()
 {
     // draw routine
 
-    // clear the screen
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    // update the 4 vertice shapes (quads) on screen
-    updateQuads();
+    // the frame covers the whole window
+    drawFrame();
 
     // swap buffers 
     glutSwapBuffers();
+
+    // a new frame is on screen (fading redraws show the same one again)
+    static uint64 last_presented = 0;
+    const frame &current = frames.readBuffer();
+    if (current.sequence != last_presented) {
+        presents.present(current.sequence, current.input_tick);
+        last_presented = current.sequence;
+    }
 }
 
 void reshape_window(GLsizei w, GLsizei h)
@@ -112,37 +504,30 @@ void reshape_window(GLsizei w, GLsizei h)
     glViewport(0, 0, display_width, display_height);
 }
 
-void drawPixel(int x, int y)
+// the last frame published by the emulation thread, stretched over the window
+//  the projection puts (0, 0) at the top left and the negative zoom draws the rows downwards from there
+void drawFrame()
 {
-	// draw a 4 sided figure with OpenGL
-    glBegin(GL_QUADS);
-        glVertex3f((x * pixel_size) + 0.0f, (y * pixel_size) + 0.0f, 0.0f);    // upper left
-        glVertex3f((x * pixel_size) + 0.0f, (y * pixel_size) + pixel_size + 0.0f, 0.0f);    // lower left
-        glVertex3f((x * pixel_size) + pixel_size + 0.0f, (y * pixel_size) + pixel_size + 0.0f, 0.0f);    // lower right
-        glVertex3f((x * pixel_size) + pixel_size + 0.0f, (y * pixel_size) + 0.0f, 0.0f);    // upper right
-    glEnd();
+	const frame &current = frames.readBuffer();
+	const uint32_t *pixels = scaler.render(current.gfx, current.hires);
+
+	glRasterPos2i(0, 0);
+	glPixelZoom(display_width / (float)scaler.width(), -display_height / (float)scaler.height());
+	glDrawPixels(scaler.width(), scaler.height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 }
 
-// draw quads -- using global chip8 object
-void updateQuads()
+// queue a key change for the emulation thread
+void queueKey(unsigned char key, uint8 pressed)
 {
-	// draw on the screen
-	for (int y = 0; y < GFX_HEIGHT; ++y) {
-		for (int x = 0; x < GFX_WIDTH; ++x) {
-			// check if the gfx buffer has a pixel 
-
-			// no pixel
-			if (emu_chip.gfx[(y * GFX_WIDTH) + x] == 0) {
-				glColor3f(0.0f, 0.0f, 0.0f); // set color black
-			}
-			// pixel 
-			else {
-				glColor3f(1.0f, 1.0f, 1.0f);  // set color white
-			}
+    int chip_key = keymap.lookup(key);
+    if (chip_key < 0 || replaying) {
+        return;
+    }
 
-			drawPixel(x, y);
-		}
-	}
+    key_event event = { (uint8)chip_key, pressed, TickClock::now() };
+    if (!key_events.push(event)) {
+        LOG_WARN(LOG_KEY_QUEUE_FULL, chip_key);
+    }
 }
 
 // set the keys based on the key pressed
@@ -150,59 +535,212 @@ void keyboardDown(unsigned char key, int x, int y)
 {
     // exit = esc key = 27
     if (key == 27) {
-        emu_chip.debug_simple_msg("ESC key pressed - exiting program!");
+        LOG_INFO(LOG_EXIT_REQUESTED);
         exit(0);
     }
-    
-    if (key == '1')         { emu_chip.key[0x1] = 1; }
-    else if (key == '2')    { emu_chip.key[0x2] = 1; }
-    else if (key == '3')    { emu_chip.key[0x3] = 1; }
-    else if (key == '4')    { emu_chip.key[0xC] = 1; }
 
-    else if (key == 'q')    { emu_chip.key[0x4] = 1; }
-    else if (key == 'w')    { emu_chip.key[0x5] = 1; }
-    else if (key == 'e')    { emu_chip.key[0x6] = 1; }
-    else if (key == 'r')    { emu_chip.key[0xD] = 1; }
+    // backspace = rewind while held
+    if (key == 8) {
+        rewinding = true;
+        return;
+    }
+
+    // speed:  tab = uncapped on / off, '=' / '-' = double / halve
+    if (key == '\t' || key == '=' || key == '-') {
+        changeSpeed(key);
+        return;
+    }
+
+    queueKey(key, 1);
+}
 
-    else if (key == 'a')    { emu_chip.key[0x7] = 1; }
-    else if (key == 's')    { emu_chip.key[0x8] = 1; }
-    else if (key == 'd')    { emu_chip.key[0x9] = 1; }
-    else if (key == 'f')    { emu_chip.key[0xE] = 1; }
+void changeSpeed(unsigned char key)
+{
+    static int capped = 1;
+    int current = speed.load(std::memory_order_relaxed);
 
-    else if (key == 'z')    { emu_chip.key[0xA] = 1; }
-    else if (key == 'x')    { emu_chip.key[0x0] = 1; }
-    else if (key == 'c')    { emu_chip.key[0xB] = 1; }
-    else if (key == 'v')    { emu_chip.key[0xF] = 1; }
+    if (key == '\t') {
+        speed = (current == SPEED_UNCAPPED) ? capped : SPEED_UNCAPPED;
+        return;
+    }
+
+    if (current == SPEED_UNCAPPED) {
+        current = capped;
+    }
+    if (key == '=' && current < MAX_SPEED) {
+        current *= 2;
+    }
+    else if (key == '-' && current > 1) {
+        current /= 2;
+    }
+    capped = current;
+    speed = current;
 }
 
 // unset the keys when the key is released
 void keyboardUp(unsigned char key, int x, int y)
 {
-    if (key == '1') { emu_chip.key[0x1] = 0; }
-    else if (key == '2') { emu_chip.key[0x2] = 0; }
-    else if (key == '3') { emu_chip.key[0x3] = 0; }
-    else if (key == '4') { emu_chip.key[0xC] = 0; }
+    if (key == 8) {
+        rewinding = false;
+        return;
+    }
 
-    else if (key == 'q') { emu_chip.key[0x4] = 0; }
-    else if (key == 'w') { emu_chip.key[0x5] = 0; }
-    else if (key == 'e') { emu_chip.key[0x6] = 0; }
-    else if (key == 'r') { emu_chip.key[0xD] = 0; }
+    queueKey(key, 0);
+}
 
-    else if (key == 'a') { emu_chip.key[0x7] = 0; }
-    else if (key == 's') { emu_chip.key[0x8] = 0; }
-    else if (key == 'd') { emu_chip.key[0x9] = 0; }
-    else if (key == 'f') { emu_chip.key[0xE] = 0; }
+// function keys - save states
+void specialDown(int key, int x, int y)
+{
+    uint8 command;
+    if (key == GLUT_KEY_F5)         { command = COMMAND_SAVE_STATE; }
+    else if (key == GLUT_KEY_F9)    { command = COMMAND_LOAD_STATE; }
+    else { return; }
 
-    else if (key == 'z') { emu_chip.key[0xA] = 0; }
-    else if (key == 'x') { emu_chip.key[0x0] = 0; }
-    else if (key == 'c') { emu_chip.key[0xB] = 0; }
-    else if (key == 'v') { emu_chip.key[0xF] = 0; }
+    if (!commands.push(command)) {
+        LOG_WARN(LOG_COMMAND_QUEUE_FULL, command);
+    }
 }
 
 
+// command line:  Chip8 <rom> [--engine=interpreter|jit|threaded] [--pacing=frame|instruction]
+//                            [--machine=chip8|schip|xochip] [--quirks=modern|vip|schip|xochip]
+//                            [--speed=<multiplier>|max] [--catalogue=<file>] [--log=<file>] [--trace=<file>]
+//                            [--wav=<file>] [--palette=mono|amber|green|octo|<4 RRGGBB>] [--phosphor=<0-255>]
+//                            [--timeline=<file>] [--keys=<16 host keys>] [--record=<file>] [--replay=<file>]
+//  the machine picks its own quirks, --quirks overrides them whatever the order on the command line.
+//  Machine, quirks, clock and key map come from the ROM's catalogue entry unless given here
+void parseOptions(int argc, char **argv)
+{
+	for (int i = 2; i < argc; ++i) {
+		std::string option = argv[i];
+
+		if (option == "--engine=jit")               { emu_chip.setEngine(chip8::ENGINE_JIT); }
+		else if (option == "--engine=threaded")     { emu_chip.setEngine(chip8::ENGINE_THREADED); }
+		else if (option == "--engine=interpreter")  { emu_chip.setEngine(chip8::ENGINE_INTERPRETER); }
+		else if (option == "--pacing=frame")        { pacing = PACING_FRAME; }
+		else if (option == "--pacing=instruction")  { pacing = PACING_INSTRUCTION; }
+		else if (option.compare(0, 9, "--quirks=") == 0) {
+			if (!chip8::parseQuirks(option.c_str() + 9, quirks_option)) {
+				LOG_WARN(LOG_UNKNOWN_QUIRKS, option.c_str() + 9);
+			}
+		}
+		else if (option.compare(0, 12, "--catalogue=") == 0) {
+			catalogue_path = argv[i] + 12;
+		}
+		else if (option == "--speed=max")           { speed = SPEED_UNCAPPED; }
+		else if (option.compare(0, 8, "--speed=") == 0) {
+			int multiplier = atoi(option.c_str() + 8);
+			if (multiplier >= 1 && multiplier <= MAX_SPEED) {
+				speed = multiplier;
+			}
+			else {
+				LOG_WARN(LOG_SPEED_OUT_OF_RANGE, multiplier);
+			}
+		}
+		else if (option.compare(0, 10, "--machine=") == 0) {
+			if (!chip8::parseMachine(option.c_str() + 10, machine_option)) {
+				LOG_WARN(LOG_UNKNOWN_MACHINE, option.c_str() + 10);
+			}
+		}
+		else if (option.compare(0, 8, "--trace=") == 0) {
+			trace_path = argv[i] + 8;
+		}
+		else if (option.compare(0, 6, "--wav=") == 0) {
+			wav_path = argv[i] + 6;
+		}
+		else if (option.compare(0, 11, "--timeline=") == 0) {
+			timeline_path = argv[i] + 11;
+		}
+		else if (option.compare(0, 7, "--keys=") == 0) {
+			if (keymap.setLayout(option.substr(7))) {
+				keys_option = argv[i] + 7;
+			}
+			else {
+				LOG_WARN(LOG_UNKNOWN_OPTION, argv[i]);
+			}
+		}
+		else if (option.compare(0, 9, "--record=") == 0) {
+			record_path = argv[i] + 9;
+		}
+		else if (option.compare(0, 9, "--replay=") == 0) {
+			replay_path = argv[i] + 9;
+		}
+		else if (option.compare(0, 10, "--palette=") == 0) {
+			video_palette palette;
+			if (frame_scaler::parsePalette(option.c_str() + 10, palette)) {
+				scaler.setPalette(palette);
+			}
+			else {
+				LOG_WARN(LOG_UNKNOWN_OPTION, argv[i]);
+			}
+		}
+		else if (option.compare(0, 11, "--phosphor=") == 0) {
+			scaler.setPersistence(atoi(option.c_str() + 11));
+		}
+		else if (option.compare(0, 6, "--log=") == 0) {
+			if (!chip8_log::open(argv[i] + 6)) {
+				LOG_WARN(LOG_UNKNOWN_OPTION, argv[i]);
+			}
+		}
+		else {
+			LOG_WARN(LOG_UNKNOWN_OPTION, argv[i]);
+		}
+	}
+}
+
+// map the ROM, apply its catalogue entry (under the command line options) and load it.
+//  A flow file written for it by chip8_analyze (<rom>.flow) decodes / compiles the program up front
+bool loadGame(const char *path)
+{
+	rom_image image;
+	if (!image.open(path)) {
+		return false;
+	}
+
+	rom_catalogue catalogue;
+	const rom_entry *entry = NULL;
+	if (catalogue_path != NULL && catalogue.load(catalogue_path)) {
+		entry = catalogue.find(image.hash());
+	}
+
+	chip8::Machine machine = machine_option;
+	chip8::QuirkProfile quirks = quirks_option;
+	if (entry != NULL) {
+		if (machine == chip8::NUMBER_OF_MACHINES)          { machine = entry->machine; }
+		if (quirks == chip8::NUMBER_OF_QUIRK_PROFILES)     { quirks = entry->quirks; }
+		if (entry->clock >= SCREEN_REFRESH_RATE)           { emu_chip.setClock(entry->clock); }
+		if (keys_option == NULL && !entry->keys.empty()) {
+			keymap.setLayout(entry->keys);
+		}
+	}
+
+	if (machine != chip8::NUMBER_OF_MACHINES) {
+		emu_chip.setMachine(machine);
+	}
+	if (quirks != chip8::NUMBER_OF_QUIRK_PROFILES) {
+		emu_chip.setQuirks(quirks);
+	}
+	if (!emu_chip.loadRom(image.data(), image.size())) {
+		return false;
+	}
+	rom_hash = image.hash();
+
+	rom_analysis analysis;
+	std::string flow_path = rom_analysis::flowPath(path);
+	if (analysis.load(flow_path.c_str(), image.hash(), emu_chip.machine)) {
+		emu_chip.prewarm(analysis);
+		LOG_INFO(LOG_FLOW_LOADED, flow_path.c_str(), (int)analysis.blocks().size());
+	}
+	return true;
+}
+
 // main loop
 int main_loop(int argc, char** argv) 
 {
+	scaler.setScale(pixel_size / 2);
+	parseOptions(argc, argv);
+	TickClock::calibrate();
+
 	// setup render system
 	setupGraphics(argc, argv);
    
@@ -215,14 +753,55 @@ int main_loop(int argc, char** argv)
 
 	// load the game into memory
 	// TODO:  Make this selectable vai a UI
-	if (!emu_chip.loadApp(argv[1]))
+	if (!loadGame(argv[1]))
 	{
-		emu_chip.debug_simple_msg("Error reading the file provided!");
+		LOG_ERROR(LOG_ROM_LOAD_FAILED, argv[1]);
 		return 1;
 	}
+	state_path = std::string(argv[1]) + ".state";
 
+	// a replayed log brings its own seed, the recorded one keeps whichever seed the run started with
+	if (replay_path != NULL) {
+		if (replayed_input.load(replay_path, rom_hash)) {
+			replayed_input.replay(emu_chip);
+			replaying = true;
+		}
+		else {
+			LOG_WARN(LOG_INPUT_REPLAY_FAILED, replay_path);
+		}
+	}
+	if (record_path != NULL) {
+		recorded_input.rom = rom_hash;
+		recorded_input.seed = emu_chip.random_state;
+		recorded_input.has_seed = true;
+		emu_chip.recordInput(&recorded_input);
+	}
+
+	// every instruction from here on goes to the trace
+	if (trace_path != NULL && !emu_chip.startTrace(trace_path)) {
+		LOG_WARN(LOG_TRACE_FAILED, trace_path);
+	}
+
+	// the sound of the session, on the emulated timeline
+	if (wav_path != NULL) {
+		wav_sink *wav = new wav_sink();
+		if (wav->open(wav_path, chip8_audio::DEFAULT_SAMPLE_RATE)) {
+			emu_chip.startAudio(wav);
+		}
+		else {
+			LOG_WARN(LOG_AUDIO_FAILED, wav_path);
+			delete wav;
+		}
+	}
+
+	// the emulation runs on its own thread, GLUT keeps this one for rendering and input
+	publishFrame();
+	atexit(stopEmulation);
+	startEmulation();
 	glutMainLoop();
 
+	stopEmulation();
+
 	return 0;
 }
 
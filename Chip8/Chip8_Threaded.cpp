@@ -0,0 +1,481 @@
+#include <cstring>
+#include "stdio.h"
+#include "stdlib.h"
+#include "Common.h"
+#include "Chip8.h"
+#include "Log.h"
+#include "Trace.h"
+
+#ifdef CHIP8_SSE2
+#include <emmintrin.h>
+#endif
+
+/**
+ * Threaded interpreter (ENGINE_THREADED)
+ *
+ * Runs a batch of instructions in one call instead of one emulateCycle per instruction:
+ *  - V, I and pc are kept in locals for the whole batch and only written back around
+ *    the routines that still go through the opcode table (draw, keys, BCD, load/store, ...)
+ *  - instructions come from the predecoded cache, so no masking or shifting happens here
+ *  - GCC / Clang jump straight from one handler to the next with labels-as-values (computed goto),
+ *    other compilers (MSVC) use the portable switch below
+ *  - instantiated once per quirk policy (Quirks.h), chip8::setQuirks selects the instantiation
+ *  - and once more per policy with Traced = true for traced runs (see Trace.h, the JIT's too):  each
+ *    handler records its instruction. The inline handlers only ever write VX and VF, so only those two
+ *    are compared, the opcode routines (any register, memory) compare all of them
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+
+// one trace_record:  'registers' and 'new_I' after the instruction, memory written from 'old_I' on.
+//  Built as the record's two words and stored as they are, every traced instruction comes through here
+inline void chip8::traceInstruction(uint16 address, uint16 opcode, uint16 old_I, uint16 changed, const uint8 *registers,
+	uint16 new_I, uint32_t written, uint8 flags)
+{
+	uint8 value = (changed != 0) ? registers[COUNT_TRAILING_ZEROS_64(changed)] : 0;
+	uint16 write_address = (written != 0) ? old_I : 0;
+	if (old_I + written > MEMORY_SIZE) {
+		flags |= TRACE_WRAPPED;
+	}
+	trace->record(
+		(uint64)address | (uint64)opcode << 16 | (uint64)new_I << 32 | (uint64)changed << 48,
+		(uint64)write_address | (uint64)written << 16 | (uint64)value << 24 | (uint64)registers[0xF] << 32 |
+			(uint64)sp << 40 | (uint64)delay_timer << 48 | (uint64)flags << 56);
+}
+
+template <class Quirks, bool Traced>
+int chip8::threadedLoop(int cycles)
+{
+	// same as the other engines, a faulted machine executes nothing
+	if (faulted) {
+		return 0;
+	}
+
+	uint16 local_pc = pc;
+	uint16 local_I = I;
+	uint8 v[REGISTER_COUNT];
+	memcpy(v, V, sizeof(uint8) * REGISTER_COUNT);
+
+	int executed = 0;
+	decoded_instruction *instruction = NULL;
+
+	// the instruction being traced:  pc, I, VX and VF before it, the other registers it changed and
+	//  the memory it wrote
+	uint16 traced_pc = 0;
+	uint16 traced_I = 0;
+	uint8 traced_x = 0;
+	uint8 traced_f = 0;
+	uint16 traced_changed = 0;
+	uint16 traced_written = 0;
+	uint8 traced_v[REGISTER_COUNT];
+
+#define SYNC_OUT() \
+	pc = local_pc; \
+	I = local_I; \
+	memcpy(V, v, sizeof(uint8) * REGISTER_COUNT)
+
+#define SYNC_IN() \
+	local_pc = pc; \
+	local_I = I; \
+	memcpy(v, V, sizeof(uint8) * REGISTER_COUNT)
+
+	// fetch the next decoded instruction (or leave once the batch is done)
+#define FETCH() \
+	if (executed == cycles) { goto finished; } \
+	++executed; \
+	if (local_pc & decode_miss) { goto unaligned; } \
+	instruction = &decode_cache[local_pc >> 1]; \
+	if (!instruction->valid) { goto decode; }
+
+	// before an instruction that may start an idle loop (chip8::idleLoop):  whole passes of the loop are
+	//  skipped, the rest run as usual. 'executed' already counts the instruction itself. Traced runs
+	//  record every instruction
+#define SKIP_IDLE() \
+	if (!Traced && fast_forward) { \
+		SYNC_OUT(); \
+		int skipped = skipIdle(cycles - executed + 1); \
+		if (skipped != 0) { \
+			SYNC_IN(); \
+			executed += skipped; \
+			if (executed > cycles) { executed = cycles; goto finished; } \
+		} \
+	}
+
+#ifdef THREADED_DISPATCH
+	// must follow the order of enum 'opcodes'
+	static const void *dispatch_table[NUMBER_OF_OPCODES] = {
+		&&op__0x00E0, &&op__0x00EE, &&op__0x0NNN, &&op__0x1NNN, &&op__0x2NNN, &&op__0x3XNN, &&op__0x4XNN,
+		&&op__0x5XY0, &&op__0x6XNN, &&op__0x7XNN, &&op__0x8XY0, &&op__0x8XY1, &&op__0x8XY2, &&op__0x8XY3,
+		&&op__0x8XY4, &&op__0x8XY5, &&op__0x8XY6, &&op__0x8XY7, &&op__0x8XYE, &&op__0x9XY0, &&op__0xANNN,
+		&&op__0xBNNN, &&op__0xCXNN, &&op__0xDXYN, &&op__0xEX9E, &&op__0xEXA1, &&op__0xFX07, &&op__0xFX0A,
+		&&op__0xFX15, &&op__0xFX18, &&op__0xFX1E, &&op__0xFX29, &&op__0xFX33, &&op__0xFX55, &&op__0xFX65,
+		&&op__0x00CN, &&op__0x00DN, &&op__0x00FB, &&op__0x00FC, &&op__0x00FD, &&op__0x00FE, &&op__0x00FF,
+		&&op__0x5XY2, &&op__0x5XY3, &&op__0xF000, &&op__0xFN01, &&op__0xF002, &&op__0xFX30, &&op__0xFX3A,
+		&&op__0xFX75, &&op__0xFX85
+	};
+#define OPCODE(name) op_##name:
+#define DISPATCH() { TRACE_BEGIN(); goto *dispatch_table[instruction->opcode]; }
+#define CONTINUE() { FETCH(); DISPATCH(); }
+#else
+#define OPCODE(name) case name:
+#define DISPATCH() goto dispatch
+#define CONTINUE() goto next
+#endif
+
+	// the end of every handler
+#define NEXT() { TRACE_END(); CONTINUE(); }
+
+#define TRACE_BEGIN() \
+	if (Traced) { \
+		traced_pc = local_pc; \
+		traced_I = local_I; \
+		traced_x = v[instruction->x]; \
+		traced_f = v[0xF]; \
+		traced_changed = 0; \
+		traced_written = 0; \
+	}
+
+#define TRACE_END() \
+	if (Traced) { \
+		traced_changed |= (uint16)((v[instruction->x] != traced_x) << instruction->x) | (uint16)((v[0xF] != traced_f) << 0xF); \
+		traceInstruction(traced_pc, instruction->raw, traced_I, traced_changed, v, local_I, traced_written, 0); \
+	}
+
+	// around an opcode routine (the machine state written back)
+#define TRACE_ROUTINE_BEGIN() \
+	if (Traced) { \
+		memcpy(traced_v, v, sizeof(uint8) * REGISTER_COUNT); \
+	}
+
+#define TRACE_ROUTINE_END() \
+	if (Traced) { \
+		traced_changed = changedRegisters(traced_v, v); \
+		traced_written = memoryWriteLength(instruction->raw); \
+	}
+
+#define TRACE_FAULT() \
+	if (Traced) { \
+		traceInstruction(traced_pc, instruction->raw, traced_I, changedRegisters(traced_v, V), V, I, 0, TRACE_FAULT); \
+	}
+
+#ifdef THREADED_DISPATCH
+	CONTINUE();
+#else
+next:
+	FETCH();
+
+dispatch:
+	TRACE_BEGIN();
+	switch (instruction->opcode) {
+#endif
+
+	OPCODE(_0x00E0)
+		clearScreen(planes);
+		drawFlag = true;
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x00EE)
+		--sp;
+		local_pc = stack[sp & (STACK_LEVELS - 1)] + 2;
+		NEXT();
+
+	OPCODE(_0x1NNN)
+		if (instruction->nnn == local_pc) {
+			SKIP_IDLE();
+		}
+		local_pc = instruction->nnn;
+		NEXT();
+
+	OPCODE(_0x2NNN)
+		stack[sp & (STACK_LEVELS - 1)] = local_pc;
+		++sp;
+		local_pc = instruction->nnn;
+		NEXT();
+
+	OPCODE(_0x3XNN)
+		local_pc += (v[instruction->x] == instruction->nn) ? instruction->skip : 2;
+		NEXT();
+
+	OPCODE(_0x4XNN)
+		local_pc += (v[instruction->x] != instruction->nn) ? instruction->skip : 2;
+		NEXT();
+
+	OPCODE(_0x5XY0)
+		local_pc += (v[instruction->x] == v[instruction->y]) ? instruction->skip : 2;
+		NEXT();
+
+	OPCODE(_0x6XNN)
+		v[instruction->x] = instruction->nn;
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x7XNN)
+		v[instruction->x] += instruction->nn;
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x8XY0)
+		v[instruction->x] = v[instruction->y];
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x8XY1)
+		v[instruction->x] |= v[instruction->y];
+		if (Quirks::LOGIC_RESETS_VF) {
+			v[0xF] = 0;
+		}
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x8XY2)
+		v[instruction->x] &= v[instruction->y];
+		if (Quirks::LOGIC_RESETS_VF) {
+			v[0xF] = 0;
+		}
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x8XY3)
+		v[instruction->x] ^= v[instruction->y];
+		if (Quirks::LOGIC_RESETS_VF) {
+			v[0xF] = 0;
+		}
+		local_pc += 2;
+		NEXT();
+
+	// VF is written before VX, the same order as opcode_0x8XY4/5/7 (matters when X or Y is F)
+	OPCODE(_0x8XY4)
+		v[0xF] = (v[instruction->y] > (0xFF - v[instruction->x])) ? 1 : 0;
+		v[instruction->x] += v[instruction->y];
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x8XY5)
+		v[0xF] = (v[instruction->y] > v[instruction->x]) ? 0 : 1;
+		v[instruction->x] -= v[instruction->y];
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x8XY7)
+		v[0xF] = (v[instruction->x] > v[instruction->y]) ? 0 : 1;
+		v[instruction->x] = v[instruction->y] - v[instruction->x];
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0x9XY0)
+		local_pc += (v[instruction->x] != v[instruction->y]) ? instruction->skip : 2;
+		NEXT();
+
+	OPCODE(_0xANNN)
+		local_I = instruction->nnn;
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0xBNNN)
+		local_pc = instruction->nnn + v[Quirks::JUMP_USES_VX ? instruction->x : 0x0];
+		NEXT();
+
+	OPCODE(_0xFX07)
+		SKIP_IDLE();
+		v[instruction->x] = delay_timer;
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0xFX15)
+		delay_timer = v[instruction->x];
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0xFX18)
+		sound_timer = v[instruction->x];
+		local_pc += 2;
+		if (audio != NULL) {
+			soundTimerWritten(cycle + executed);
+		}
+		NEXT();
+
+	OPCODE(_0xFX1E)
+		v[0xF] = ((local_I + v[instruction->x]) > 0xFFF) ? 1 : 0;
+		local_I += v[instruction->x];
+		local_pc += 2;
+		NEXT();
+
+	OPCODE(_0xFX29)
+		local_I = v[instruction->x] * 0x5;
+		local_pc += 2;
+		NEXT();
+
+	// waits on a key by not moving pc
+	OPCODE(_0xFX0A)
+		SKIP_IDLE();
+		SYNC_OUT();
+		opcode_0xFX0A(*instruction);
+		SYNC_IN();
+		NEXT();
+
+	// under the display wait quirk pc stays on the DXYN until the next vblank
+	OPCODE(_0xDXYN)
+		if (Quirks::DISPLAY_WAIT) {
+			SKIP_IDLE();
+		}
+		SYNC_OUT();
+		opcode_0xDXYN<Quirks>(*instruction);
+		SYNC_IN();
+		NEXT();
+
+	// the first instruction of a key poll
+	OPCODE(_0xEX9E)
+	OPCODE(_0xEXA1)
+		SKIP_IDLE();
+		TRACE_ROUTINE_BEGIN();
+		SYNC_OUT();
+		if (!(this->*(instruction->executor))(*instruction)) {
+			LOG_WARN(LOG_OPCODE_FAILED, instruction->raw, local_pc);
+			fault();
+			TRACE_FAULT();
+			return executed;
+		}
+		SYNC_IN();
+		NEXT();
+
+	// everything else goes through the opcode table with the machine state written back
+	OPCODE(_0x0NNN)
+	OPCODE(_0x8XY6)
+	OPCODE(_0x8XYE)
+	OPCODE(_0xCXNN)
+	OPCODE(_0xFX33)
+	OPCODE(_0xFX55)
+	OPCODE(_0xFX65)
+	OPCODE(_0x00CN)
+	OPCODE(_0x00DN)
+	OPCODE(_0x00FB)
+	OPCODE(_0x00FC)
+	OPCODE(_0x00FD)
+	OPCODE(_0x00FE)
+	OPCODE(_0x00FF)
+	OPCODE(_0x5XY2)
+	OPCODE(_0x5XY3)
+	OPCODE(_0xF000)
+	OPCODE(_0xFN01)
+	OPCODE(_0xF002)
+	OPCODE(_0xFX30)
+	OPCODE(_0xFX3A)
+	OPCODE(_0xFX75)
+	OPCODE(_0xFX85)
+		TRACE_ROUTINE_BEGIN();
+		SYNC_OUT();
+		if (!(this->*(instruction->executor))(*instruction)) {
+			LOG_WARN(LOG_OPCODE_FAILED, instruction->raw, local_pc);
+			fault();
+			TRACE_FAULT();
+			return executed;
+		}
+		SYNC_IN();
+		TRACE_ROUTINE_END();
+		NEXT();
+
+#ifndef THREADED_DISPATCH
+	default:
+		break;
+	}
+#endif
+
+	// not reachable, every opcode dispatches to the next instruction
+	goto finished;
+
+decode:
+	// first visit of this address (or it was written to), an invalid opcode is reported by emulateCycle
+	if (!decodeInstruction(local_pc, *instruction)) {
+		SYNC_OUT();
+		if (Traced) {
+			tracedCycle();
+		}
+		else {
+			emulateCycle();
+		}
+		return executed;
+	}
+	DISPATCH();
+
+unaligned:
+	// odd addresses (and any past the cached memory) are not cached, let emulateCycle handle the single instruction
+	SYNC_OUT();
+	{
+		uint8 sound = sound_timer;
+		if (Traced) {
+			tracedCycle();
+		}
+		else {
+			emulateCycle();
+		}
+		if (faulted) {
+			return executed;
+		}
+		if (sound_timer != sound && audio != NULL) {
+			soundTimerWritten(cycle + executed);
+		}
+	}
+	SYNC_IN();
+	CONTINUE();
+
+finished:
+	SYNC_OUT();
+	return executed;
+
+#undef SYNC_OUT
+#undef SYNC_IN
+#undef FETCH
+#undef SKIP_IDLE
+#undef OPCODE
+#undef DISPATCH
+#undef CONTINUE
+#undef NEXT
+#undef TRACE_BEGIN
+#undef TRACE_END
+#undef TRACE_ROUTINE_BEGIN
+#undef TRACE_ROUTINE_END
+#undef TRACE_FAULT
+}
+
+template int chip8::threadedLoop<quirks_modern>(int cycles);
+template int chip8::threadedLoop<quirks_vip>(int cycles);
+template int chip8::threadedLoop<quirks_schip>(int cycles);
+template int chip8::threadedLoop<quirks_xochip>(int cycles);
+template int chip8::threadedLoop<quirks_modern, true>(int cycles);
+template int chip8::threadedLoop<quirks_vip, true>(int cycles);
+template int chip8::threadedLoop<quirks_schip, true>(int cycles);
+template int chip8::threadedLoop<quirks_xochip, true>(int cycles);
+
+// the registers that differ, bit n = V[n]
+uint16 chip8::changedRegisters(const uint8 *before, const uint8 *after)
+{
+#ifdef CHIP8_SSE2
+	__m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)before), _mm_loadu_si128((const __m128i *)after));
+	return (uint16)~_mm_movemask_epi8(equal);
+#else
+	uint16 changed = 0;
+	for (int r = 0; r < REGISTER_COUNT; ++r) {
+		changed |= (uint16)((after[r] != before[r]) << r);
+	}
+	return changed;
+#endif
+}
+
+// one emulateCycle with the whole state compared:  the interpreter's traced runs, and the threaded engine's
+//  odd instructions out (unaligned, not decodable)
+void chip8::tracedCycle()
+{
+	uint16 address = pc;
+	uint16 opcode = memory[pc & (MEMORY_SIZE - 1)] << 8 | memory[(pc + 1) & (MEMORY_SIZE - 1)];
+	uint16 old_I = I;
+	uint8 before[REGISTER_COUNT];
+	memcpy(before, V, sizeof(before));
+
+	emulateCycle();
+
+	uint32_t written = faulted ? 0 : memoryWriteLength(opcode);
+	traceInstruction(address, opcode, old_I, changedRegisters(before, V), V, I, written, faulted ? TRACE_FAULT : 0);
+}
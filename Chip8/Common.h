@@ -5,8 +5,28 @@
 #include <stdint.h>
 
 #define NTH_BIT_OF_BYTE(b, bit) (((b) >> (bit)) & 0x1)   
+#define ROTATE_RIGHT_64(v, n) (((v) >> ((n) & 63)) | ((v) << ((64 - (n)) & 63)))
+
+// leading / trailing zero bits of a non-zero 64 bit value
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+static inline int COUNT_LEADING_ZEROS_64(uint64_t v) { unsigned long index; _BitScanReverse64(&index, v); return 63 - (int)index; }
+static inline int COUNT_TRAILING_ZEROS_64(uint64_t v) { unsigned long index; _BitScanForward64(&index, v); return (int)index; }
+#elif defined(__GNUC__) || defined(__clang__)
+#define COUNT_LEADING_ZEROS_64(v) __builtin_clzll(v)
+#define COUNT_TRAILING_ZEROS_64(v) __builtin_ctzll(v)
+#else
+static inline int COUNT_LEADING_ZEROS_64(uint64_t v) { int n = 0; while (!(v & 0x8000000000000000ULL)) { v <<= 1; ++n; } return n; }
+static inline int COUNT_TRAILING_ZEROS_64(uint64_t v) { int n = 0; while (!(v & 0x1)) { v >>= 1; ++n; } return n; }
+#endif
+
+// SSE2 is part of every x86-64 target and of 32 bit MSVC builds with /arch:SSE2 (the default)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHIP8_SSE2
+#endif
 
 typedef uint8_t uint8;
 typedef uint16_t uint16;
+typedef uint64_t uint64;
 
 #endif
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "Input.h"
+#include "Chip8.h"
+
+// the hex keypad on the left of a QWERTY keyboard:   1 2 3 C / 4 5 6 D / 7 8 9 E / A 0 B F
+//  as                                                1 2 3 4 / q w e r / a s d f / z x c v
+const char *key_map::DEFAULT_LAYOUT = "x123qweasdzc4rfv";
+
+key_map::key_map()
+{
+	memset(table, -1, sizeof(table));
+	setLayout(DEFAULT_LAYOUT);
+}
+
+bool key_map::setLayout(const std::string &layout)
+{
+	if (layout.size() != chip8::KEY_STATES) {
+		return false;
+	}
+
+	memset(table, -1, sizeof(table));
+	for (int key = 0; key < chip8::KEY_STATES; ++key) {
+		table[(unsigned char)layout[key]] = (int8_t)key;
+	}
+	return true;
+}
+
+input_log::input_log()
+{
+	rom = 0;
+	seed = 0;
+	has_seed = false;
+}
+
+void input_log::clear()
+{
+	log.clear();
+	rom = 0;
+	seed = 0;
+	has_seed = false;
+}
+
+bool input_log::parse(const std::string &script)
+{
+	bool parsed = parseEvents(script);
+	sort();
+	return parsed;
+}
+
+bool input_log::parseEvents(const std::string &script)
+{
+	std::string separated = script;
+	std::replace(separated.begin(), separated.end(), ',', ' ');
+
+	std::stringstream events(separated);
+	std::string event;
+	while (events >> event) {
+		size_t split = event.find_first_of("+-");
+		if (split == std::string::npos || split == 0 || split + 1 >= event.size()) {
+			return false;
+		}
+		char *end = NULL;
+		input_event input;
+		input.cycle = strtoull(event.substr(0, split).c_str(), &end, 10);
+		if (*end != '\0') {
+			return false;
+		}
+		input.pressed = (event[split] == '+');
+		input.key = (uint8)strtoul(event.substr(split + 1).c_str(), &end, 16);
+		if (*end != '\0' || input.key >= chip8::KEY_STATES) {
+			return false;
+		}
+		log.push_back(input);
+	}
+	return true;
+}
+
+// events at the same cycle keep their order
+void input_log::sort()
+{
+	std::stable_sort(log.begin(), log.end(),
+		[](const input_event &a, const input_event &b) { return a.cycle < b.cycle; });
+}
+
+bool input_log::load(const char *path, uint64 expected_hash)
+{
+	std::ifstream input(path);
+	if (!input) {
+		return false;
+	}
+
+	clear();
+	std::string line;
+	while (std::getline(input, line)) {
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) {
+			line.erase(comment);
+		}
+
+		std::stringstream tokens(line);
+		std::string name;
+		if (!(tokens >> name)) {
+			continue;
+		}
+		if (name == "rom") {
+			std::string value;
+			tokens >> value;
+			rom = strtoull(value.c_str(), NULL, 16);
+		}
+		else if (name == "seed") {
+			std::string value;
+			tokens >> value;
+			seed = (uint32_t)strtoul(value.c_str(), NULL, 0);
+			has_seed = true;
+		}
+		else if (!parseEvents(line)) {
+			return false;
+		}
+	}
+	sort();
+	return (expected_hash == 0 || rom == 0 || rom == expected_hash);
+}
+
+bool input_log::save(const char *path) const
+{
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		return false;
+	}
+
+	fprintf(out, "# chip8 input log:  <cycle>+<key> press, <cycle>-<key> release (key in hex)\n");
+	if (rom != 0) {
+		fprintf(out, "rom %016llx\n", (unsigned long long)rom);
+	}
+	if (has_seed) {
+		fprintf(out, "seed %u\n", seed);
+	}
+	for (size_t i = 0; i < log.size(); ++i) {
+		fprintf(out, "%llu%c%x\n", (unsigned long long)log[i].cycle, log[i].pressed ? '+' : '-', log[i].key);
+	}
+
+	bool written = (ferror(out) == 0);
+	if (fclose(out) != 0) {
+		written = false;
+	}
+	return written;
+}
+
+void input_log::replay(chip8 &chip) const
+{
+	if (has_seed) {
+		chip.seedRandom(seed);
+	}
+	for (size_t i = 0; i < log.size(); ++i) {
+		chip.queueKey(log[i].cycle, log[i].key, log[i].pressed);
+	}
+}
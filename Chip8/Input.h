@@ -0,0 +1,80 @@
+#pragma once
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <string>
+#include <vector>
+#include "Common.h"
+
+class chip8;
+
+/**
+ * Input - which host key is which chip8 key, and key events on the emulated timeline.
+ *
+ * key_map is a table from the byte a keyboard callback gets to the chip8 key (-1 = none), filled from
+ *  a layout:  the 16 host keys, the one for chip8 key 0 first (the catalogue's keys= format).
+ *
+ * input_log holds key events stamped with the emulated cycle they reach the machine at. chip8 records
+ *  every key event it delivers into one (chip8::recordInput), replay() queues them into another machine
+ *  started the same way (ROM, machine, quirks, clock and random seed), which then sees every change at
+ *  the same instruction. A run that rewinds or loads a save state doesn't replay.
+ *
+ *  The script syntax is chip8_batch's keys=:  '<cycle>+<key>' presses, '<cycle>-<key>' releases (key
+ *  in hex), separated by commas or white space. Files add '#' comments and two optional header lines:
+ *      rom <hash>      the ROM it was recorded on (16 hex digits), load() refuses another one
+ *      seed <n>        the random seed of the recorded run
+*/
+
+struct input_event {
+	uint64 cycle;
+	uint8 key;
+	bool pressed;
+};
+
+class key_map {
+public:
+	static const char *DEFAULT_LAYOUT;
+
+	key_map();
+
+	// false (map unchanged) unless it has exactly 16 keys
+	bool setLayout(const std::string &layout);
+
+	int lookup(unsigned char host_key) const { return table[host_key]; }
+
+private:
+	int8_t table[256];
+};
+
+class input_log {
+public:
+	input_log();
+
+	void clear();
+	void record(uint64 cycle, uint8 key, bool pressed) { input_event event = { cycle, key, pressed }; log.push_back(event); }
+
+	// adds the events of a script, kept in cycle order
+	bool parse(const std::string &script);
+
+	// 'expected_hash' 0 takes a log of any ROM
+	bool load(const char *path, uint64 expected_hash = 0);
+	bool save(const char *path) const;
+
+	// every event queued on 'chip' (seeded from the log when it has a seed)
+	void replay(chip8 &chip) const;
+
+	const std::vector<input_event> &events() const { return log; }
+	bool empty() const { return log.empty(); }
+
+	uint64 rom;             // 0 = unknown
+	uint32_t seed;
+	bool has_seed;
+
+private:
+	bool parseEvents(const std::string &script);
+	void sort();
+
+	std::vector<input_event> log;
+};
+
+#endif
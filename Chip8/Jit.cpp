@@ -0,0 +1,615 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include "Chip8.h"
+#include "Jit.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// host registers used by the generated code (all callee-saved on both the Windows and System V ABIs)
+//  rbx = chip8 *
+//  r12 = jit_state *
+//  r13 = remaining cycle budget
+
+#define OFFSET_V(reg) (offsetof(chip8, V) + (reg))
+#define OFFSET_VF OFFSET_V(0xF)
+#define OFFSET_I offsetof(chip8, I)
+#define OFFSET_PC offsetof(chip8, pc)
+#define OFFSET_DELAY offsetof(chip8, delay_timer)
+#define OFFSET_SOUND offsetof(chip8, sound_timer)
+#define OFFSET_BUDGET offsetof(chip8_jit::jit_state, budget)
+#define OFFSET_FLUSH offsetof(chip8_jit::jit_state, flush_pending)
+
+// x86 condition codes (second byte of the 0x0F 0x8? jcc rel32 encoding, 0 = jmp rel32)
+#define JMP_ALWAYS 0x00
+#define JCC_EQUAL 0x84
+#define JCC_NOT_EQUAL 0x85
+#define JCC_LESS 0x8C
+
+// interpreter fallback for every instruction without an inline translation
+static void jit_step(chip8 *chip)
+{
+	chip->emulateCycle();
+}
+
+chip8_jit::chip8_jit(chip8 &chip) : chip(chip)
+{
+	state.chip = &chip;
+	state.budget = 0;
+	state.flush_pending = 0;
+	memory_size = chip.programMemory();
+	blocks.resize(memory_size);
+	code_map.resize(memory_size);
+	code_cache = NULL;
+	code_cache_size = (memory_size == chip8::MEMORY_SIZE) ? CODE_CACHE_SIZE : SMALL_CODE_CACHE_SIZE;
+	code_used = 0;
+	stubs_size = 0;
+	enter_stub = NULL;
+	exit_stub = NULL;
+
+#ifdef CHIP8_JIT_X64
+#ifdef _WIN32
+	code_cache = (uint8 *)VirtualAlloc(NULL, code_cache_size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	void *mapped = mmap(NULL, code_cache_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code_cache = (mapped == MAP_FAILED) ? NULL : (uint8 *)mapped;
+#endif
+	if (code_cache != NULL) {
+		emitStubs();
+	}
+#endif
+
+	flush();
+}
+
+chip8_jit::~chip8_jit()
+{
+	if (code_cache != NULL) {
+#ifdef _WIN32
+		VirtualFree(code_cache, 0, MEM_RELEASE);
+#else
+		munmap(code_cache, code_cache_size);
+#endif
+	}
+}
+
+bool chip8_jit::supported()
+{
+#ifdef CHIP8_JIT_X64
+	return true;
+#else
+	return false;
+#endif
+}
+
+int chip8_jit::execute(int cycles)
+{
+	state.budget = cycles;
+
+	while (state.budget > 0 && !chip.faulted) {
+		// drop code that was overwritten while it was running
+		if (state.flush_pending) {
+			flush();
+		}
+
+		// whole passes of an idle loop are skipped here (chip8::skipIdle):  every instruction that may
+		//  start one is the first of its block and only entered from here, right before it runs
+		if (chip.fast_forward) {
+			state.budget -= chip.skipIdle(state.budget);
+			if (state.budget == 0) {
+				break;
+			}
+		}
+
+		uint16 pc = chip.pc;
+		uint8 *block = NULL;
+		if (code_cache != NULL && pc < memory_size - 1) {
+			block = blocks[pc];
+			if (block == NULL) {
+				block = compile(pc);
+			}
+		}
+
+		if (block != NULL) {
+			int32_t budget = state.budget;
+			enter_stub(&state, block);
+			if (state.budget != budget) {
+				continue;
+			}
+		}
+
+		// nothing could be compiled at pc (invalid opcode, end of memory, unsupported host, an FX18 with audio)
+		uint8 sound = chip.sound_timer;
+		chip.emulateCycle();
+		--state.budget;
+		if (chip.sound_timer != sound && chip.audio != NULL) {
+			chip.soundTimerWritten(chip.cycle + (cycles - state.budget));
+		}
+	}
+
+	return cycles - state.budget;
+}
+
+void chip8_jit::invalidate(uint16 address)
+{
+	// only writes to compiled bytes matter, the flush happens once the running block has exited
+	if (address < memory_size && code_map[address]) {
+		state.flush_pending = 1;
+	}
+}
+
+void chip8_jit::invalidateAll()
+{
+	state.flush_pending = 1;
+}
+
+void chip8_jit::precompile(uint16 address)
+{
+	// memory loaded since the last flush is final by now
+	if (state.flush_pending) {
+		flush();
+	}
+	if (code_cache != NULL && address < memory_size - 1 && blocks[address] == NULL) {
+		compile(address);
+	}
+}
+
+void chip8_jit::flush()
+{
+	std::fill(blocks.begin(), blocks.end(), (uint8 *)NULL);
+	std::fill(code_map.begin(), code_map.end(), 0);
+	unresolved_links.clear();
+	code_used = stubs_size;
+	state.flush_pending = 0;
+}
+
+bool chip8_jit::isTerminator(chip8::Opcode opcode)
+{
+	switch (opcode) {
+	case chip8::_0x00EE:
+	case chip8::_0x0NNN:
+	case chip8::_0x1NNN:
+	case chip8::_0x2NNN:
+	case chip8::_0x3XNN:
+	case chip8::_0x4XNN:
+	case chip8::_0x5XY0:
+	case chip8::_0x9XY0:
+	case chip8::_0xBNNN:
+	case chip8::_0xEX9E:
+	case chip8::_0xEXA1:
+	case chip8::_0xFX0A:
+	case chip8::_0x00FD:
+	case chip8::_0xF000:
+		return true;
+	case chip8::_0xDXYN:
+		// may leave pc on itself, waiting for the vblank
+		return chip.quirks.display_wait;
+	default:
+		return false;
+	}
+}
+
+bool chip8_jit::isSkip(chip8::Opcode opcode)
+{
+	switch (opcode) {
+	case chip8::_0x3XNN:
+	case chip8::_0x4XNN:
+	case chip8::_0x5XY0:
+	case chip8::_0x9XY0:
+	case chip8::_0xEX9E:
+	case chip8::_0xEXA1:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Code generation
+ *
+*/
+
+void chip8_jit::emitStubs()
+{
+	code_used = 0;
+
+	// enter:  push rbx / push r12 / push r13 / sub rsp, 32 (keeps rsp 16 byte aligned + shadow space for calls)
+	enter_stub = (enter_fn)(code_cache + code_used);
+	emit8(0x53);
+	emit8(0x41); emit8(0x54);
+	emit8(0x41); emit8(0x55);
+	emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x20);
+#ifdef _WIN32
+	emit8(0x49); emit8(0x89); emit8(0xCC);      // mov r12, rcx
+#else
+	emit8(0x49); emit8(0x89); emit8(0xFC);      // mov r12, rdi
+#endif
+	emitStateOperand(0x49, 0x8B, 3, offsetof(jit_state, chip));   // mov rbx, [r12 + chip]
+	emitStateOperand(0x45, 0x8B, 5, OFFSET_BUDGET);                // mov r13d, [r12 + budget]
+#ifdef _WIN32
+	emit8(0xFF); emit8(0xE2);                   // jmp rdx
+#else
+	emit8(0xFF); emit8(0xE6);                   // jmp rsi
+#endif
+
+	// exit:  store the budget back and unwind the enter stub
+	exit_stub = code_cache + code_used;
+	emitStateOperand(0x45, 0x89, 5, OFFSET_BUDGET);                // mov [r12 + budget], r13d
+	emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x20);
+	emit8(0x41); emit8(0x5D);
+	emit8(0x41); emit8(0x5C);
+	emit8(0x5B);
+	emit8(0xC3);
+
+	// blocks start 16 byte aligned after the stubs
+	while (code_used & 0xF) {
+		emit8(0xCC);
+	}
+	stubs_size = code_used;
+}
+
+uint8 *chip8_jit::compile(uint16 start)
+{
+#ifdef CHIP8_JIT_X64
+	if (code_used + MAX_BLOCK_BYTES > code_cache_size) {
+		flush();
+	}
+
+	// collect the straight run of instructions up to (and including) the first control flow change
+	chip8::decoded_instruction instructions[MAX_BLOCK_INSTRUCTIONS];
+	int count = 0;
+	uint32_t address = start;
+	while (count < MAX_BLOCK_INSTRUCTIONS && address < memory_size - 1) {
+		// a possible idle loop starts a block of its own
+		if (count > 0 && chip.idleLoopShape(address) != chip8::IDLE_NONE) {
+			break;
+		}
+		if (!chip.decodeInstruction(address, instructions[count])) {
+			break;
+		}
+		// with audio attached an FX18 runs from the dispatcher, which knows its cycle (see execute)
+		if (chip.audio != NULL && instructions[count].opcode == chip8::_0xFX18) {
+			break;
+		}
+		address += 2;
+		if (isTerminator(instructions[count++].opcode)) {
+			break;
+		}
+	}
+
+	if (count == 0) {
+		return NULL;
+	}
+
+	size_t block_start = code_used;
+	std::vector<std::pair<size_t, uint16> > chain_slots;
+	std::vector<std::pair<size_t, uint16> > budget_exits;
+	std::vector<size_t> exits;
+
+	for (int i = 0; i < count; ++i) {
+		const chip8::decoded_instruction &instruction = instructions[i];
+		uint16 instruction_address = start + (i * 2);
+
+		// count the instruction, leave before executing it once the budget is used up
+		emit8(0x41); emit8(0x83); emit8(0xED); emit8(0x01);       // sub r13d, 1
+		budget_exits.push_back(std::make_pair(emitJump32(JCC_LESS), instruction_address));
+
+		if (emitInline(instruction)) {
+			continue;
+		}
+
+		switch (instruction.opcode) {
+		case chip8::_0x1NNN:
+			emitChainExit(instruction.nnn, chain_slots);
+			break;
+
+		case chip8::_0x2NNN:
+			emitStorePc(instruction_address);
+			emitCallStep();
+			emitChainExit(instruction.nnn, chain_slots);
+			break;
+
+		case chip8::_0x3XNN:
+		case chip8::_0x4XNN: {
+			emitChipOperand(0x80, 7, OFFSET_V(instruction.x));          // cmp byte [V + x], nn
+			emit8(instruction.nn);
+			size_t not_taken = emitJump32(instruction.opcode == chip8::_0x3XNN ? JCC_NOT_EQUAL : JCC_EQUAL);
+			emitChainExit(instruction_address + instruction.skip, chain_slots);
+			patch32(not_taken, code_used);
+			emitChainExit(instruction_address + 2, chain_slots);
+			break;
+		}
+
+		case chip8::_0x5XY0:
+		case chip8::_0x9XY0: {
+			emitChipOperand(0x8A, 0, OFFSET_V(instruction.x));          // mov al, [V + x]
+			emitChipOperand(0x3A, 0, OFFSET_V(instruction.y));          // cmp al, [V + y]
+			size_t not_taken = emitJump32(instruction.opcode == chip8::_0x5XY0 ? JCC_NOT_EQUAL : JCC_EQUAL);
+			emitChainExit(instruction_address + instruction.skip, chain_slots);
+			patch32(not_taken, code_used);
+			emitChainExit(instruction_address + 2, chain_slots);
+			break;
+		}
+
+		default:
+			emitStorePc(instruction_address);
+			emitCallStep();
+
+			// the instruction may have overwritten compiled code (possibly this block)
+			if (instruction.opcode == chip8::_0xFX33 || instruction.opcode == chip8::_0xFX55 || instruction.opcode == chip8::_0x5XY2) {
+				emitStateOperand(0x41, 0x80, 7, OFFSET_FLUSH);         // cmp byte [r12 + flush_pending], 0
+				emit8(0x00);
+				exits.push_back(emitJump32(JCC_NOT_EQUAL));
+			}
+
+			// pc was set by the interpreter, go back to the dispatcher to look it up
+			if (isTerminator(instruction.opcode)) {
+				exits.push_back(emitJump32(JMP_ALWAYS));
+			}
+			break;
+		}
+	}
+
+	// the block was cut short (length limit, invalid opcode, an idle loop or an FX18 next) - continue with the next instruction
+	if (!isTerminator(instructions[count - 1].opcode)) {
+		emitChainExit(start + (count * 2), chain_slots);
+	}
+
+	// out of budget:  pc = the instruction that was not executed, give its cycle back
+	for (size_t i = 0; i < budget_exits.size(); ++i) {
+		patch32(budget_exits[i].first, code_used);
+		emitStorePc(budget_exits[i].second);
+		emit8(0x41); emit8(0x83); emit8(0xC5); emit8(0x01);   // add r13d, 1
+		patch32(emitJump32(JMP_ALWAYS), exit_stub - code_cache);
+	}
+
+	for (size_t i = 0; i < exits.size(); ++i) {
+		patch32(exits[i], exit_stub - code_cache);
+	}
+
+	// chain slots hold the address of the target block, or the exit stub until the target is compiled
+	while (code_used & 0x7) {
+		emit8(0xCC);
+	}
+	for (size_t i = 0; i < chain_slots.size(); ++i) {
+		uint16 target = chain_slots[i].second;
+		uint8 **slot = (uint8 **)(code_cache + code_used);
+		patch32(chain_slots[i].first, code_used);
+		emit64(0);
+
+		if (target < memory_size - 1 && blocks[target] != NULL) {
+			*slot = blocks[target];
+		}
+		else {
+			*slot = exit_stub;
+			if (target < memory_size - 1) {
+				chain_link link = { target, slot };
+				unresolved_links.push_back(link);
+			}
+		}
+	}
+
+	while (code_used & 0xF) {
+		emit8(0xCC);
+	}
+
+	uint8 *block = code_cache + block_start;
+	blocks[start] = block;
+	// a skip at the end also depends on the word after it (XO-CHIP skips F000 NNNN as one instruction)
+	uint32_t end = address;
+	if (chip.machine == chip8::MACHINE_XOCHIP && isSkip(instructions[count - 1].opcode)) {
+		end += 2;
+	}
+	for (uint32_t i = start; i < end; ++i) {
+		code_map[i & (memory_size - 1)] = 1;
+	}
+
+	// exits that were waiting on this block can now jump straight into it
+	for (size_t i = 0; i < unresolved_links.size();) {
+		if (unresolved_links[i].target == start) {
+			*unresolved_links[i].slot = block;
+			unresolved_links[i] = unresolved_links.back();
+			unresolved_links.pop_back();
+		}
+		else {
+			++i;
+		}
+	}
+
+	return block;
+#else
+	return NULL;
+#endif
+}
+
+// translate the instructions that only touch registers, returns false if the interpreter is needed
+bool chip8_jit::emitInline(const chip8::decoded_instruction &instruction)
+{
+	uint8 x = instruction.x;
+	uint8 y = instruction.y;
+
+	switch (instruction.opcode) {
+	case chip8::_0x6XNN:
+		emitChipOperand(0xC6, 0, OFFSET_V(x));          // mov byte [V + x], nn
+		emit8(instruction.nn);
+		return true;
+
+	case chip8::_0x7XNN:
+		emitChipOperand(0x80, 0, OFFSET_V(x));          // add byte [V + x], nn
+		emit8(instruction.nn);
+		return true;
+
+	case chip8::_0x8XY0:
+		emitChipOperand(0x8A, 0, OFFSET_V(y));          // mov al, [V + y]
+		emitChipOperand(0x88, 0, OFFSET_V(x));          // mov [V + x], al
+		return true;
+
+	case chip8::_0x8XY1:
+	case chip8::_0x8XY2:
+	case chip8::_0x8XY3:
+		emitChipOperand(0x8A, 0, OFFSET_V(y));          // mov al, [V + y]
+		emitChipOperand(instruction.opcode == chip8::_0x8XY1 ? 0x08 :
+		                instruction.opcode == chip8::_0x8XY2 ? 0x20 : 0x30, 0, OFFSET_V(x));   // or/and/xor [V + x], al
+		if (chip.quirks.logic_resets_vf) {
+			emitChipOperand(0xC6, 0, OFFSET_VF);        // mov byte [VF], 0
+			emit8(0);
+		}
+		return true;
+
+	case chip8::_0x8XY4:
+	case chip8::_0x8XY5:
+	case chip8::_0x8XY7: {
+		// VF as an operand depends on the order the interpreter writes VF and VX, leave it to the interpreter
+		if (x == 0xF || y == 0xF) {
+			return false;
+		}
+		uint8 first = (instruction.opcode == chip8::_0x8XY7) ? y : x;
+		uint8 second = (instruction.opcode == chip8::_0x8XY7) ? x : y;
+		emitChipOperand(0x8A, 0, OFFSET_V(first));                                          // mov al, [V + first]
+		emitChipOperand(instruction.opcode == chip8::_0x8XY4 ? 0x02 : 0x2A, 0, OFFSET_V(second));   // add/sub al, [V + second]
+		emit8(0x0F); emit8(instruction.opcode == chip8::_0x8XY4 ? 0x92 : 0x93); emit8(0xC1);   // setc/setnc cl
+		emitChipOperand(0x88, 0, OFFSET_V(x));                                              // mov [V + x], al
+		emitChipOperand(0x88, 1, OFFSET_VF);                                                // mov [VF], cl
+		return true;
+	}
+
+	case chip8::_0xANNN:
+		emit8(0x66);
+		emitChipOperand(0xC7, 0, OFFSET_I);             // mov word [I], nnn
+		emit16(instruction.nnn);
+		return true;
+
+	case chip8::_0xFX07:
+		emitChipOperand(0x8A, 0, OFFSET_DELAY);         // mov al, [delay_timer]
+		emitChipOperand(0x88, 0, OFFSET_V(x));          // mov [V + x], al
+		return true;
+
+	case chip8::_0xFX15:
+	case chip8::_0xFX18:
+		emitChipOperand(0x8A, 0, OFFSET_V(x));          // mov al, [V + x]
+		emitChipOperand(0x88, 0, instruction.opcode == chip8::_0xFX15 ? OFFSET_DELAY : OFFSET_SOUND);
+		return true;
+
+	case chip8::_0xFX1E:
+		if (x == 0xF) {
+			return false;
+		}
+		emit8(0x0F); emitChipOperand(0xB7, 0, OFFSET_I);      // movzx eax, word [I]
+		emit8(0x0F); emitChipOperand(0xB6, 1, OFFSET_V(x));   // movzx ecx, byte [V + x]
+		emit8(0x01); emit8(0xC8);                             // add eax, ecx
+		emit8(0x3D); emit32(0xFFF);                           // cmp eax, 0xFFF
+		emit8(0x0F); emit8(0x97); emit8(0xC2);                // seta dl
+		emit8(0x66); emitChipOperand(0x89, 0, OFFSET_I);      // mov [I], ax
+		emitChipOperand(0x88, 2, OFFSET_VF);                  // mov [VF], dl
+		return true;
+
+	case chip8::_0xFX29:
+		emit8(0x0F); emitChipOperand(0xB6, 0, OFFSET_V(x));   // movzx eax, byte [V + x]
+		emit8(0x8D); emit8(0x04); emit8(0x80);                // lea eax, [rax + rax * 4]
+		emit8(0x66); emitChipOperand(0x89, 0, OFFSET_I);      // mov [I], ax
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void chip8_jit::emit8(uint8 value)
+{
+	code_cache[code_used++] = value;
+}
+
+void chip8_jit::emit16(uint16 value)
+{
+	emit8(value & 0xFF);
+	emit8(value >> 8);
+}
+
+void chip8_jit::emit32(uint32_t value)
+{
+	emit16(value & 0xFFFF);
+	emit16(value >> 16);
+}
+
+void chip8_jit::emit64(uint64_t value)
+{
+	emit32(value & 0xFFFFFFFF);
+	emit32(value >> 32);
+}
+
+// <opcode> [rbx + offset] with 'reg' in the modrm reg field
+void chip8_jit::emitChipOperand(uint8 opcode, uint8 reg, size_t offset)
+{
+	emit8(opcode);
+	emit8(0x80 | ((reg & 0x7) << 3) | 0x3);
+	emit32((uint32_t)offset);
+}
+
+// <rex> <opcode> [r12 + offset] with 'reg' in the modrm reg field
+void chip8_jit::emitStateOperand(uint8 rex, uint8 opcode, uint8 reg, size_t offset)
+{
+	emit8(rex);
+	emit8(opcode);
+	emit8(0x80 | ((reg & 0x7) << 3) | 0x4);
+	emit8(0x24);
+	emit32((uint32_t)offset);
+}
+
+void chip8_jit::emitStorePc(uint16 address)
+{
+	emit8(0x66);
+	emitChipOperand(0xC7, 0, OFFSET_PC);    // mov word [pc], address
+	emit16(address);
+}
+
+void chip8_jit::emitCallStep()
+{
+#ifdef _WIN32
+	emit8(0x48); emit8(0x89); emit8(0xD9);  // mov rcx, rbx
+#else
+	emit8(0x48); emit8(0x89); emit8(0xDF);  // mov rdi, rbx
+#endif
+	emit8(0x48); emit8(0xB8);               // mov rax, jit_step
+	emit64((uint64_t)(uintptr_t)&jit_step);
+	emit8(0xFF); emit8(0xD0);               // call rax
+}
+
+void chip8_jit::emitChainExit(uint16 target, std::vector<std::pair<size_t, uint16> > &slots)
+{
+	emitStorePc(target);
+
+	// a possible idle loop is entered through the dispatcher, which checks it first
+	if (chip.idleLoopShape(target) != chip8::IDLE_NONE) {
+		patch32(emitJump32(JMP_ALWAYS), exit_stub - code_cache);
+		return;
+	}
+
+	emit8(0xFF); emit8(0x25);               // jmp [rip + slot]
+	slots.push_back(std::make_pair(code_used, target));
+	emit32(0);
+}
+
+// jmp / jcc rel32 with the displacement left to patch32, returns the displacement position
+size_t chip8_jit::emitJump32(uint8 condition)
+{
+	if (condition == JMP_ALWAYS) {
+		emit8(0xE9);
+	}
+	else {
+		emit8(0x0F);
+		emit8(condition);
+	}
+	size_t position = code_used;
+	emit32(0);
+	return position;
+}
+
+void chip8_jit::patch32(size_t position, size_t target)
+{
+	int32_t displacement = (int32_t)(target - (position + 4));
+	memcpy(code_cache + position, &displacement, sizeof(displacement));
+}
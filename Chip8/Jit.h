@@ -0,0 +1,109 @@
+#pragma once
+#ifndef _JIT_H
+#define _JIT_H
+
+#include <vector>
+#include "Common.h"
+#include "Chip8.h"
+
+// the code generator only knows x86-64, every other target falls back to the interpreter
+#if defined(_M_X64) || defined(__x86_64__)
+#define CHIP8_JIT_X64
+#endif
+
+/**
+ * Basic block compiler for the chip8 interpreter.
+ *
+ * Straight runs of instructions are translated into native x86-64 code that works directly on
+ *  V[], I, pc and the timers of the chip8 it was created for. A block ends at the first
+ *  instruction that changes the control flow (1NNN, 2NNN, 00EE, BNNN, skips, FX0A).
+ *
+ *  - simple register / index instructions are emitted inline
+ *  - everything else calls back into the interpreter (emulateCycle) for that single instruction
+ *  - exits with a known target are chained straight into the target block once it is compiled
+ *  - every instruction counts down the cycle budget, so execute() returns exactly on the
+ *    requested instruction boundary (timer ticks stay at 60hz)
+ *  - writes to memory holding compiled code (FX33, FX55, loadApp) flush the code cache
+*/
+class chip8_jit {
+public:
+	chip8_jit(chip8 &chip);
+	~chip8_jit();
+
+	// true when native code can be generated for this build target
+	static bool supported();
+
+	// execute exactly 'cycles' instructions, returns the number executed
+	int execute(int cycles);
+
+	// memory at 'address' was written
+	void invalidate(uint16 address);
+
+	// all of memory was replaced
+	void invalidateAll();
+
+	// compiles the block at 'address' before it first runs (chip8::prewarm)
+	void precompile(uint16 address);
+
+	// state shared with the generated code (the field offsets are baked into the emitted instructions)
+	struct jit_state {
+		chip8 *chip;
+		int32_t budget;
+		uint8 flush_pending;
+	};
+
+private:
+	// the native code for all of XO-CHIP's 64K, a 4K machine gets by with a quarter
+	static const size_t CODE_CACHE_SIZE = 1024 * 1024;
+	static const size_t SMALL_CODE_CACHE_SIZE = 256 * 1024;
+	static const int MAX_BLOCK_INSTRUCTIONS = 64;
+	static const size_t MAX_BLOCK_BYTES = MAX_BLOCK_INSTRUCTIONS * 128;
+
+	// chained exit waiting for its target block to be compiled
+	struct chain_link {
+		uint16 target;
+		uint8 **slot;
+	};
+
+	chip8 &chip;
+	jit_state state;
+
+	// the memory the chip's machine can run code from (chip8::programMemory, fixed for the jit's lifetime)
+	uint32_t memory_size;
+	uint8 *code_cache;
+	size_t code_cache_size;
+	size_t code_used;
+	size_t stubs_size;
+
+	// void enter(jit_state *state, uint8 *block) -> saves host registers and jumps to the block
+	typedef void(*enter_fn)(jit_state *, uint8 *);
+	enter_fn enter_stub;
+	uint8 *exit_stub;
+
+	// compiled block for each address and which bytes of memory have been compiled
+	std::vector<uint8 *> blocks;
+	std::vector<uint8> code_map;
+	std::vector<chain_link> unresolved_links;
+
+	void flush();
+	void emitStubs();
+	uint8 *compile(uint16 address);
+	bool isTerminator(chip8::Opcode opcode);
+	bool isSkip(chip8::Opcode opcode);
+	bool emitInline(const chip8::decoded_instruction &instruction);
+
+	// emitter
+	void emit8(uint8 value);
+	void emit16(uint16 value);
+	void emit32(uint32_t value);
+	void emit64(uint64_t value);
+	void emitChipOperand(uint8 opcode, uint8 reg, size_t offset);
+	void emitStateOperand(uint8 rex, uint8 opcode, uint8 reg, size_t offset);
+	void emitStorePc(uint16 address);
+	void emitCallStep();
+	void emitChainExit(uint16 target, std::vector<std::pair<size_t, uint16> > &slots);
+	size_t emitJump32(uint8 condition);
+	void patch32(size_t position, size_t target);
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "stdio.h"
+#include "Common.h"
+#include "Timer.h"
+#include "SpscQueue.h"
+#include "Log.h"
+
+struct log_event_info {
+	int level;
+	const char *format;
+};
+
+static const log_event_info event_info[NUMBER_OF_LOG_EVENTS] = {
+	{ LOG_LEVEL_DEBUG, "BEEP!" },                                                   // LOG_BEEP
+	{ LOG_LEVEL_DEBUG, "Loading filename: %s" },                                    // LOG_ROM_LOADING
+	{ LOG_LEVEL_DEBUG, "Filesize found to be: %d" },                                // LOG_ROM_SIZE
+	{ LOG_LEVEL_ERROR, "Filename %s does not exist!" },                             // LOG_ROM_NOT_FOUND
+	{ LOG_LEVEL_ERROR, "Filesize too large for available RAM: %d (at most %d)" },   // LOG_ROM_TOO_LARGE
+	{ LOG_LEVEL_ERROR, "Error reading the file provided: %s" },                     // LOG_ROM_LOAD_FAILED
+	{ LOG_LEVEL_WARN,  "Invalid opcode %04x at %03x" },                             // LOG_INVALID_OPCODE
+	{ LOG_LEVEL_WARN,  "Unexpected result from opcode %04x at %03x" },              // LOG_OPCODE_FAILED
+	{ LOG_LEVEL_WARN,  "Key %d in V[%x] is outside of the hex bounds" },            // LOG_KEY_OUT_OF_RANGE
+	{ LOG_LEVEL_WARN,  "JIT is not supported on this platform, keeping the current engine." },  // LOG_JIT_UNSUPPORTED
+	{ LOG_LEVEL_WARN,  "Save state has an unknown format or version, not restored." },         // LOG_STATE_UNKNOWN_FORMAT
+	{ LOG_LEVEL_WARN,  "Save state could not be written: %s" },                     // LOG_STATE_WRITE_FAILED
+	{ LOG_LEVEL_WARN,  "Save state could not be loaded: %s" },                      // LOG_STATE_LOAD_FAILED
+	{ LOG_LEVEL_WARN,  "Key event queue full, key %x dropped." },                   // LOG_KEY_QUEUE_FULL
+	{ LOG_LEVEL_WARN,  "Command queue full, command %d dropped." },                 // LOG_COMMAND_QUEUE_FULL
+	{ LOG_LEVEL_INFO,  "ESC key pressed - exiting program!" },                      // LOG_EXIT_REQUESTED
+	{ LOG_LEVEL_WARN,  "Unknown command line option %s ignored." },                 // LOG_UNKNOWN_OPTION
+	{ LOG_LEVEL_WARN,  "Unknown machine %s ignored." },                             // LOG_UNKNOWN_MACHINE
+	{ LOG_LEVEL_WARN,  "Unknown quirk profile %s ignored." },                       // LOG_UNKNOWN_QUIRKS
+	{ LOG_LEVEL_WARN,  "Speed multiplier %d out of range ignored." },               // LOG_SPEED_OUT_OF_RANGE
+	{ LOG_LEVEL_WARN,  "Trace %s could not be written." },                          // LOG_TRACE_FAILED
+	{ LOG_LEVEL_WARN,  "The JIT can't record a trace, traced runs use the threaded engine." },  // LOG_TRACE_ENGINE
+	{ LOG_LEVEL_WARN,  "Audio file %s could not be written." },                     // LOG_AUDIO_FAILED
+	{ LOG_LEVEL_INFO,  "Flow file %s:  %d blocks prewarmed." },                     // LOG_FLOW_LOADED
+	{ LOG_LEVEL_INFO,  "Timeline %s:  %d frames, %d missed deadlines." },           // LOG_TIMELINE_WRITTEN
+	{ LOG_LEVEL_WARN,  "Timeline %s could not be written." },                       // LOG_TIMELINE_FAILED
+	{ LOG_LEVEL_INFO,  "Input log %s:  %d key events recorded." },                  // LOG_INPUT_RECORDED
+	{ LOG_LEVEL_WARN,  "Input log %s could not be written." },                      // LOG_INPUT_RECORD_FAILED
+	{ LOG_LEVEL_WARN,  "Input log %s could not be replayed." },                     // LOG_INPUT_REPLAY_FAILED
+};
+
+static const char *level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+// records per thread before new ones are dropped
+#define LOG_RING_SIZE 256
+
+struct log_ring {
+	SpscQueue<log_record, LOG_RING_SIZE> records;
+	std::atomic<uint64> dropped;
+
+	log_ring() : dropped(0) {}
+};
+
+/**
+ * the writer - owns every thread's ring and the thread draining them.
+ *  Rings are created on a thread's first record and live as long as the process, so a thread
+ *  only ever takes the lock once.
+*/
+class log_writer {
+public:
+	log_writer();
+	~log_writer();
+
+	log_ring *registerThread(uint16 &thread);
+	bool open(const char *path);
+	void flush();
+	uint64 dropped();
+
+private:
+	void run();
+	bool drain(std::vector<log_record> &batch);
+	void print(const log_record &record);
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::vector<std::unique_ptr<log_ring> > rings;
+	std::thread thread;
+	bool stopping;
+	uint64 written_batches;
+	uint64 reported_drops;
+
+	FILE *out;
+	Clock::time_point start;
+};
+
+static log_writer &writer()
+{
+	static log_writer instance;
+	return instance;
+}
+
+log_writer::log_writer()
+	: stopping(false), written_batches(0), reported_drops(0), out(stderr), start(Clock::now())
+{
+	thread = std::thread(&log_writer::run, this);
+}
+
+log_writer::~log_writer()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	thread.join();
+
+	if (out != stderr) {
+		fclose(out);
+	}
+}
+
+log_ring *log_writer::registerThread(uint16 &thread_index)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	rings.push_back(std::unique_ptr<log_ring>(new log_ring()));
+	thread_index = (uint16)(rings.size() - 1);
+	return rings.back().get();
+}
+
+bool log_writer::open(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		return false;
+	}
+
+	flush();
+	std::lock_guard<std::mutex> guard(lock);
+	if (out != stderr) {
+		fclose(out);
+	}
+	out = file;
+	return true;
+}
+
+// two more passes of the writer guarantee everything pushed before the call is out
+void log_writer::flush()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	uint64 target = written_batches + 2;
+	while (written_batches < target && !stopping) {
+		wake.notify_all();
+		wake.wait_for(guard, std::chrono::milliseconds(1));
+	}
+}
+
+uint64 log_writer::dropped()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	uint64 total = 0;
+	for (size_t i = 0; i < rings.size(); ++i) {
+		total += rings[i]->dropped.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+// pops every ring, false when nothing was waiting. Called with the lock held
+bool log_writer::drain(std::vector<log_record> &batch)
+{
+	batch.clear();
+	log_record record;
+	for (size_t i = 0; i < rings.size(); ++i) {
+		while (rings[i]->records.pop(record)) {
+			batch.push_back(record);
+		}
+	}
+	return !batch.empty();
+}
+
+void log_writer::run()
+{
+	std::vector<log_record> batch;
+	std::unique_lock<std::mutex> guard(lock);
+
+	for (;;) {
+		bool any = drain(batch);
+
+		// rings are only ordered per thread, the batch is put back in time order
+		std::stable_sort(batch.begin(), batch.end(),
+			[](const log_record &a, const log_record &b) { return a.timestamp < b.timestamp; });
+		for (size_t i = 0; i < batch.size(); ++i) {
+			print(batch[i]);
+		}
+
+		uint64 drops = 0;
+		for (size_t i = 0; i < rings.size(); ++i) {
+			drops += rings[i]->dropped.load(std::memory_order_relaxed);
+		}
+		if (drops != reported_drops) {
+			fprintf(out, "%d log records dropped (full ring)\n", (int)(drops - reported_drops));
+			reported_drops = drops;
+			any = true;
+		}
+
+		if (any) {
+			fflush(out);
+		}
+		++written_batches;
+		wake.notify_all();
+
+		if (stopping && !any) {
+			break;
+		}
+		wake.wait_for(guard, std::chrono::milliseconds(10));
+	}
+}
+
+// expands the event's format: %d / %x (optional 0 and width) take the integers in order, %s the text
+void log_writer::print(const log_record &record)
+{
+	char line[256];
+	size_t length = 0;
+	const char *format = (record.event < NUMBER_OF_LOG_EVENTS) ? event_info[record.event].format : "unknown event";
+	int level = (record.event < NUMBER_OF_LOG_EVENTS) ? event_info[record.event].level : LOG_LEVEL_ERROR;
+	int value = 0;
+
+	for (const char *c = format; *c != '\0' && length < sizeof(line) - 1; ++c) {
+		if (*c != '%') {
+			line[length++] = *c;
+			continue;
+		}
+
+		const char *spec = c + 1;
+		while (*spec >= '0' && *spec <= '9') {
+			++spec;
+		}
+
+		int written = 0;
+		char conversion[16];
+		if ((*spec == 'd' || *spec == 'x') && value < 2 && (size_t)(spec - c) < sizeof(conversion) - 4) {
+			// "%" + flags / width + "ll" + conversion
+			size_t width = (size_t)(spec - c);
+			memcpy(conversion, c, width);
+			memcpy(conversion + width, (*spec == 'd') ? "lld" : "llX", 4);
+			written = snprintf(line + length, sizeof(line) - length, conversion, (long long)record.values[value++]);
+		}
+		else if (*spec == 's') {
+			written = snprintf(line + length, sizeof(line) - length, "%s%.*s",
+				(record.text_length > log_record::TEXT_SIZE - 1) ? "..." : "",
+				(int)std::min<uint32_t>(record.text_length, log_record::TEXT_SIZE - 1), record.text);
+		}
+		else {
+			line[length++] = '%';
+			continue;
+		}
+
+		length = std::min(length + (size_t)std::max(written, 0), sizeof(line) - 1);
+		c = spec;
+	}
+	line[length] = '\0';
+
+	double seconds = std::chrono::duration<double>(Clock::time_point(Clock::duration(record.timestamp)) - start).count();
+	fprintf(out, "%12.6f %-5s [%u] %s\n", seconds, level_names[level], record.thread, line);
+}
+
+/**
+ * chip8_log
+ *
+*/
+
+// this thread's ring, registered on its first record
+static thread_local log_ring *local_ring = NULL;
+static thread_local uint16 local_thread = 0;
+
+static inline void push(log_record &record)
+{
+	if (local_ring == NULL) {
+		local_ring = writer().registerThread(local_thread);
+	}
+
+	record.timestamp = (uint64)Clock::now().time_since_epoch().count();
+	record.thread = local_thread;
+	if (!local_ring->records.push(record)) {
+		local_ring->dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void chip8_log::write(log_events event, int64_t first, int64_t second)
+{
+	log_record record;
+	record.event = (uint16)event;
+	record.text_length = 0;
+	record.values[0] = first;
+	record.values[1] = second;
+	push(record);
+}
+
+void chip8_log::write(log_events event, const char *text, int64_t first, int64_t second)
+{
+	log_record record;
+	record.event = (uint16)event;
+	record.values[0] = first;
+	record.values[1] = second;
+
+	// keep the end of long texts, for paths it's the part that matters
+	size_t length = (text != NULL) ? strlen(text) : 0;
+	size_t kept = std::min(length, log_record::TEXT_SIZE - 1);
+	if (kept != 0) {
+		memcpy(record.text, text + length - kept, kept);
+	}
+	record.text[kept] = '\0';
+	record.text_length = (uint32_t)length;
+	push(record);
+}
+
+bool chip8_log::open(const char *path)
+{
+	return writer().open(path);
+}
+
+void chip8_log::flush()
+{
+	writer().flush();
+}
+
+uint64 chip8_log::dropped()
+{
+	return writer().dropped();
+}
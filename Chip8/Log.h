@@ -0,0 +1,122 @@
+#pragma once
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <stddef.h>
+#include "Common.h"
+
+/**
+ * Logging
+ *
+ * A call site pushes a compact record (event id, two integers and an optional short text) into
+ *  its own thread's lock-free ring and returns, a background thread turns the records into text
+ *  and writes them to stderr (or the file given to chip8_log::open). Formatting, the clock
+ *  conversion and the file I/O never run on the emulation thread.
+ *
+ *  - every message is an entry of log_events, its level and format live in the table in Log.cpp
+ *  - levels below CHIP8_LOG_LEVEL compile out entirely, arguments included. The default keeps
+ *    everything in _DEBUG builds and info and up otherwise
+ *  - a full ring drops the record (and counts it) rather than blocking the emulation
+*/
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF   4
+
+#ifndef CHIP8_LOG_LEVEL
+#ifdef _DEBUG
+#define CHIP8_LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define CHIP8_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+// message ids, keep in step with the table in Log.cpp.
+//  formats take %d / %x (with an optional width, e.g. %04x) for the integers in order and %s for the text
+enum log_events {
+	LOG_BEEP = 0,
+	LOG_ROM_LOADING,
+	LOG_ROM_SIZE,
+	LOG_ROM_NOT_FOUND,
+	LOG_ROM_TOO_LARGE,
+	LOG_ROM_LOAD_FAILED,
+	LOG_INVALID_OPCODE,
+	LOG_OPCODE_FAILED,
+	LOG_KEY_OUT_OF_RANGE,
+	LOG_JIT_UNSUPPORTED,
+	LOG_STATE_UNKNOWN_FORMAT,
+	LOG_STATE_WRITE_FAILED,
+	LOG_STATE_LOAD_FAILED,
+	LOG_KEY_QUEUE_FULL,
+	LOG_COMMAND_QUEUE_FULL,
+	LOG_EXIT_REQUESTED,
+	LOG_UNKNOWN_OPTION,
+	LOG_UNKNOWN_MACHINE,
+	LOG_UNKNOWN_QUIRKS,
+	LOG_SPEED_OUT_OF_RANGE,
+	LOG_TRACE_FAILED,
+	LOG_TRACE_ENGINE,
+	LOG_AUDIO_FAILED,
+	LOG_FLOW_LOADED,
+	LOG_TIMELINE_WRITTEN,
+	LOG_TIMELINE_FAILED,
+	LOG_INPUT_RECORDED,
+	LOG_INPUT_RECORD_FAILED,
+	LOG_INPUT_REPLAY_FAILED,
+	NUMBER_OF_LOG_EVENTS
+};
+
+// one cache line per record
+struct log_record {
+	static const size_t TEXT_SIZE = 32;
+
+	uint64 timestamp;           // steady clock ticks
+	uint16 event;
+	uint16 thread;              // registration order of the writing thread
+	uint32_t text_length;
+	int64_t values[2];
+	char text[TEXT_SIZE];       // the tail of longer texts
+};
+
+class chip8_log {
+public:
+	static void write(log_events event, int64_t first = 0, int64_t second = 0);
+	static void write(log_events event, const char *text, int64_t first = 0, int64_t second = 0);
+
+	// send the log to a file instead of stderr, false (and stderr kept) when it can't be created
+	static bool open(const char *path);
+
+	// blocks until everything logged so far is written
+	static void flush();
+
+	// records lost to full rings
+	static uint64 dropped();
+};
+
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) chip8_log::write(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) chip8_log::write(__VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) chip8_log::write(__VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) chip8_log::write(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#endif
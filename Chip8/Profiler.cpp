@@ -0,0 +1,252 @@
+#include <cstring>
+#include <algorithm>
+#include "stdio.h"
+#include <stdarg.h>
+#include "Common.h"
+#include "Chip8.h"
+#include "Timer.h"
+#include "Profiler.h"
+
+// a backward jump over at most this many instructions counts as a tight loop
+#define MAX_LOOP_INSTRUCTIONS 8
+
+// a jump is only reported once it took this share of all instructions (1 / N)
+#define LOOP_REPORT_SHARE 1000
+
+// pairs and triples reported of each
+#define SEQUENCE_REPORT_COUNT 16
+
+// must follow the order of enum 'opcodes'
+static const char *opcode_names[chip8::NUMBER_OF_OPCODES] = {
+	"00E0", "00EE", "0NNN", "1NNN", "2NNN", "3XNN", "4XNN",
+	"5XY0", "6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3",
+	"8XY4", "8XY5", "8XY6", "8XY7", "8XYE", "9XY0", "ANNN",
+	"BNNN", "CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A",
+	"FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65",
+	"00CN", "00DN", "00FB", "00FC", "00FD", "00FE", "00FF", "5XY2", "5XY3", "F000", "FN01", "F002",
+	"FX30", "FX3A", "FX75", "FX85"
+};
+
+const char *chip8_profile::opcodeName(chip8::Opcode opcode)
+{
+	return (opcode >= 0 && opcode < chip8::NUMBER_OF_OPCODES) ? opcode_names[opcode] : "invalid";
+}
+
+void chip8_profile::reset()
+{
+	instructions = 0;
+	memset(counts, 0, sizeof(counts));
+	memset(nanoseconds, 0, sizeof(nanoseconds));
+	memset(pc_heat, 0, sizeof(pc_heat));
+	memset(pairs, 0, sizeof(pairs));
+	memset(triples, 0, sizeof(triples));
+	previous[0] = previous[1] = chip8::INVALID_OPCODE;
+	sequence_length = 0;
+	sequence_next = chip8::MEMORY_SIZE;
+
+	// the fastest of a few empty measurements
+	timer_overhead_ns = -1;
+	for (int i = 0; i < 1000; ++i) {
+		Clock::time_point start = Clock::now();
+		long long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		if (timer_overhead_ns < 0 || elapsed < timer_overhead_ns) {
+			timer_overhead_ns = elapsed;
+		}
+	}
+}
+
+static uint16 read_opcode(const chip8 &chip, uint16 address)
+{
+	return chip.memory[address & (chip8::MEMORY_SIZE - 1)] << 8 | chip.memory[(address + 1) & (chip8::MEMORY_SIZE - 1)];
+}
+
+void chip8_profile::findLoops(const chip8 &chip, std::vector<tight_loop> &loops) const
+{
+	uint64 threshold = instructions / LOOP_REPORT_SHARE;
+	if (threshold == 0) {
+		threshold = 1;
+	}
+
+	for (uint32_t pc = 0; pc < chip8::MEMORY_SIZE; ++pc) {
+		if (pc_heat[pc] < threshold) {
+			continue;
+		}
+
+		uint16 opcode = read_opcode(chip, pc);
+		tight_loop loop = { (uint16)pc, (uint16)pc, NULL, pc_heat[pc] };
+
+		if ((opcode & 0xF0FF) == 0xF00A) {
+			loop.kind = "key_wait";
+		}
+		else if ((opcode & 0xF000) == 0x1000) {
+			loop.target = opcode & 0x0FFF;
+			if (loop.target == pc) {
+				loop.kind = "self_jump";
+			}
+			else if (loop.target < pc && pc - loop.target <= 2 * MAX_LOOP_INSTRUCTIONS) {
+				loop.kind = "tight_loop";
+				for (uint16 address = loop.target; address < pc; address += 2) {
+					uint16 body = read_opcode(chip, address);
+					if ((body & 0xF0FF) == 0xF007) {
+						loop.kind = "delay_timer_poll";
+						break;
+					}
+					if ((body & 0xF0FF) == 0xE09E || (body & 0xF0FF) == 0xE0A1) {
+						loop.kind = "key_poll";
+					}
+				}
+			}
+		}
+
+		if (loop.kind != NULL) {
+			loops.push_back(loop);
+		}
+	}
+}
+
+static bool more_frequent(const chip8_profile::opcode_sequence &a, const chip8_profile::opcode_sequence &b)
+{
+	return a.count > b.count;
+}
+
+void chip8_profile::topSequences(std::vector<opcode_sequence> &sequences) const
+{
+	const int N = chip8::NUMBER_OF_OPCODES;
+
+	for (int length = 2; length <= 3; ++length) {
+		std::vector<opcode_sequence> found;
+		for (int a = 0; a < N; ++a) {
+			for (int b = 0; b < N; ++b) {
+				for (int c = 0; c < ((length == 3) ? N : 1); ++c) {
+					uint64 count = (length == 3) ? triples[a][b][c] : pairs[a][b];
+					if (count != 0) {
+						opcode_sequence sequence = { { (chip8::Opcode)a, (chip8::Opcode)b, (chip8::Opcode)c }, length, count };
+						found.push_back(sequence);
+					}
+				}
+			}
+		}
+
+		size_t kept = std::min(found.size(), (size_t)SEQUENCE_REPORT_COUNT);
+		std::partial_sort(found.begin(), found.begin() + kept, found.end(), more_frequent);
+		sequences.insert(sequences.end(), found.begin(), found.begin() + kept);
+	}
+}
+
+static std::string sequence_name(const chip8_profile::opcode_sequence &sequence)
+{
+	std::string name = chip8_profile::opcodeName(sequence.opcodes[0]);
+	for (int i = 1; i < sequence.length; ++i) {
+		name += ' ';
+		name += chip8_profile::opcodeName(sequence.opcodes[i]);
+	}
+	return name;
+}
+
+// printf into a std::string
+static void append(std::string &out, const char *format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (length > 0) {
+		out.append(buffer, (length < (int)sizeof(buffer)) ? length : sizeof(buffer) - 1);
+	}
+}
+
+static void append_json_string(std::string &out, const std::string &value)
+{
+	out += '"';
+	for (size_t i = 0; i < value.size(); ++i) {
+		char c = value[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			append(out, "\\u%04x", c);
+		}
+		else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+void chip8_profile::appendJson(std::string &out, const chip8 &chip, const std::string &name) const
+{
+	out += "{\"rom\":";
+	append_json_string(out, name);
+	append(out, ",\"instructions\":%llu,\"timer_overhead_ns\":%lld,\"opcodes\":[",
+		(unsigned long long)instructions, timer_overhead_ns);
+
+	bool first = true;
+	for (int op = 0; op < chip8::NUMBER_OF_OPCODES; ++op) {
+		if (counts[op] == 0) {
+			continue;
+		}
+		append(out, "%s{\"opcode\":\"%s\",\"count\":%llu,\"nanoseconds\":%llu,\"ns_per_instruction\":%.2f}",
+			first ? "" : ",", opcode_names[op], (unsigned long long)counts[op], (unsigned long long)nanoseconds[op],
+			(double)nanoseconds[op] / counts[op]);
+		first = false;
+	}
+
+	std::vector<tight_loop> loops;
+	findLoops(chip, loops);
+	out += "],\"loops\":[";
+	for (size_t i = 0; i < loops.size(); ++i) {
+		append(out, "%s{\"pc\":%u,\"target\":%u,\"kind\":\"%s\",\"count\":%llu}",
+			i ? "," : "", loops[i].pc, loops[i].target, loops[i].kind, (unsigned long long)loops[i].count);
+	}
+
+	std::vector<opcode_sequence> sequences;
+	topSequences(sequences);
+	out += "],\"sequences\":[";
+	for (size_t i = 0; i < sequences.size(); ++i) {
+		append(out, "%s{\"opcodes\":\"%s\",\"count\":%llu}", i ? "," : "",
+			sequence_name(sequences[i]).c_str(), (unsigned long long)sequences[i].count);
+	}
+
+	// heat map keyed by address, only the addresses that ran (most of the 64K never does)
+	out += "],\"pc_heat\":{";
+	first = true;
+	for (uint32_t pc = 0; pc < chip8::MEMORY_SIZE; ++pc) {
+		if (pc_heat[pc] != 0) {
+			append(out, "%s\"%u\":%llu", first ? "" : ",", pc, (unsigned long long)pc_heat[pc]);
+			first = false;
+		}
+	}
+	out += "}}";
+}
+
+void chip8_profile::appendCsv(std::string &out, const chip8 &chip, const std::string &name) const
+{
+	for (int op = 0; op < chip8::NUMBER_OF_OPCODES; ++op) {
+		if (counts[op] != 0) {
+			append(out, "%s,opcode,%s,%llu,%llu\n", name.c_str(), opcode_names[op],
+				(unsigned long long)counts[op], (unsigned long long)nanoseconds[op]);
+		}
+	}
+
+	for (uint32_t pc = 0; pc < chip8::MEMORY_SIZE; ++pc) {
+		if (pc_heat[pc] != 0) {
+			append(out, "%s,pc,0x%04X,%llu,\n", name.c_str(), pc, (unsigned long long)pc_heat[pc]);
+		}
+	}
+
+	std::vector<tight_loop> loops;
+	findLoops(chip, loops);
+	for (size_t i = 0; i < loops.size(); ++i) {
+		append(out, "%s,%s,0x%03X-0x%03X,%llu,\n", name.c_str(), loops[i].kind,
+			loops[i].target, loops[i].pc, (unsigned long long)loops[i].count);
+	}
+
+	std::vector<opcode_sequence> sequences;
+	topSequences(sequences);
+	for (size_t i = 0; i < sequences.size(); ++i) {
+		append(out, "%s,%s,%s,%llu,\n", name.c_str(), (sequences[i].length == 3) ? "triple" : "pair",
+			sequence_name(sequences[i]).c_str(), (unsigned long long)sequences[i].count);
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <string>
+#include <vector>
+#include "Common.h"
+#include "Chip8.h"
+
+/**
+ * Opcode and pc profile of one chip8.
+ *
+ * Only recorded in builds with CHIP8_PROFILE defined and only once chip8::enableProfiling() was called.
+ *  Without the define emulateCycle has no hooks at all and chip8 has no profile member.
+ *  While profiling, emulateCycles runs every instruction through emulateCycle (whatever the engine)
+ *  so each handler is timed on its own - the numbers describe the interpreter handlers.
+ *
+ *  - executions and host nanoseconds per opcode
+ *  - executions per address (pc heat map over the whole 64K memory, the reports list only the
+ *    addresses that ran)
+ *  - tight loops found from the heat map and the code at the end of the run:
+ *    jumps to themselves, short backward loops polling the delay timer or the keys, FX0A waits
+ *  - opcode pairs and triples that ran one after the other in memory order (no jump or taken skip in
+ *    between), the candidates for the interpreter's superinstructions (see chip8::fuseInstruction)
+*/
+struct chip8_profile {
+	uint64 instructions;
+	uint64 counts[chip8::NUMBER_OF_OPCODES];
+	uint64 nanoseconds[chip8::NUMBER_OF_OPCODES];
+	uint64 pc_heat[chip8::MEMORY_SIZE];
+	uint64 pairs[chip8::NUMBER_OF_OPCODES][chip8::NUMBER_OF_OPCODES];
+	uint64 triples[chip8::NUMBER_OF_OPCODES][chip8::NUMBER_OF_OPCODES][chip8::NUMBER_OF_OPCODES];
+
+	// the straight-line run the last instructions belong to
+	chip8::Opcode previous[2];
+	int sequence_length;
+	uint32_t sequence_next;
+
+	// cost of the two clock reads around a handler, measured by reset() and included in 'nanoseconds'
+	long long timer_overhead_ns;
+
+	struct tight_loop {
+		uint16 pc;          // address of the backward jump (or the FX0A)
+		uint16 target;      // first instruction of the loop
+		const char *kind;   // self_jump, delay_timer_poll, key_poll, key_wait, tight_loop
+		uint64 count;       // times the jump executed
+	};
+
+	void reset();
+
+	inline void record(chip8::Opcode opcode, uint16 address, long long elapsed_ns) {
+		++instructions;
+		++counts[opcode];
+		nanoseconds[opcode] += (uint64)elapsed_ns;
+		++pc_heat[address & (chip8::MEMORY_SIZE - 1)];
+
+		if (address != sequence_next) {
+			sequence_length = 0;
+		}
+		if (sequence_length >= 1) {
+			++pairs[previous[0]][opcode];
+		}
+		if (sequence_length >= 2) {
+			++triples[previous[1]][previous[0]][opcode];
+		}
+		previous[1] = previous[0];
+		previous[0] = opcode;
+		sequence_length = (sequence_length < 2) ? sequence_length + 1 : 2;
+		sequence_next = address + ((opcode == chip8::_0xF000) ? 4 : 2);
+	}
+
+	struct opcode_sequence {
+		chip8::Opcode opcodes[3];
+		int length;
+		uint64 count;
+	};
+
+	void findLoops(const chip8 &chip, std::vector<tight_loop> &loops) const;
+	// the most frequent pairs and triples, most frequent first
+	void topSequences(std::vector<opcode_sequence> &sequences) const;
+
+	// one JSON object / CSV rows (rom,section,key,count,nanoseconds) describing this profile
+	void appendJson(std::string &out, const chip8 &chip, const std::string &name) const;
+	void appendCsv(std::string &out, const chip8 &chip, const std::string &name) const;
+
+	static const char *opcodeName(chip8::Opcode opcode);
+};
+
+#endif
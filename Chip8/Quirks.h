@@ -0,0 +1,85 @@
+#pragma once
+#ifndef _QUIRKS_H
+#define _QUIRKS_H
+
+/**
+ * Quirk policies
+ *
+ * CHIP-8 interpreters disagree on a handful of instructions and ROMs are written against one of them.
+ *  Every behaviour that differs is a compile time constant of a policy type, the handlers that depend on
+ *  them (and the threaded engine) are templates on that type. chip8::setQuirks picks the matching
+ *  instantiations once, so nothing is tested per instruction.
+ *
+ *  SHIFT_USES_VY           8XY6 / 8XYE shift VY into VX (VIP) instead of shifting VX in place
+ *  LOAD_STORE_INCREMENTS_I FX55 / FX65 leave I past the last register instead of unchanged
+ *  JUMP_USES_VX            BXNN jumps to XNN + VX (CHIP-48 / SCHIP) instead of NNN + V0
+ *  SPRITES_WRAP            sprites running off the right / bottom edge wrap around instead of being clipped
+ *  LOGIC_RESETS_VF         8XY1 / 8XY2 / 8XY3 clear VF
+ *  DISPLAY_WAIT            DXYN waits for the vblank (the VIP drew in its display interrupt), at most one
+ *                          sprite per frame
+*/
+
+// the behaviour this emulator always had, the default
+struct quirks_modern {
+	static const bool SHIFT_USES_VY = false;
+	static const bool LOAD_STORE_INCREMENTS_I = true;
+	static const bool JUMP_USES_VX = false;
+	static const bool SPRITES_WRAP = true;
+	static const bool LOGIC_RESETS_VF = false;
+	static const bool DISPLAY_WAIT = false;
+};
+
+// original COSMAC VIP interpreter
+struct quirks_vip {
+	static const bool SHIFT_USES_VY = true;
+	static const bool LOAD_STORE_INCREMENTS_I = true;
+	static const bool JUMP_USES_VX = false;
+	static const bool SPRITES_WRAP = false;
+	static const bool LOGIC_RESETS_VF = true;
+	static const bool DISPLAY_WAIT = true;
+};
+
+// CHIP-48 / SUPER-CHIP 1.1
+struct quirks_schip {
+	static const bool SHIFT_USES_VY = false;
+	static const bool LOAD_STORE_INCREMENTS_I = false;
+	static const bool JUMP_USES_VX = true;
+	static const bool SPRITES_WRAP = false;
+	static const bool LOGIC_RESETS_VF = false;
+	static const bool DISPLAY_WAIT = false;
+};
+
+// XO-CHIP (Octo)
+struct quirks_xochip {
+	static const bool SHIFT_USES_VY = true;
+	static const bool LOAD_STORE_INCREMENTS_I = true;
+	static const bool JUMP_USES_VX = false;
+	static const bool SPRITES_WRAP = true;
+	static const bool LOGIC_RESETS_VF = false;
+	static const bool DISPLAY_WAIT = false;
+};
+
+// the switches of a policy as plain values, for code that is generated at run time (JIT)
+struct quirk_settings {
+	bool shift_uses_vy;
+	bool load_store_increments_i;
+	bool jump_uses_vx;
+	bool sprites_wrap;
+	bool logic_resets_vf;
+	bool display_wait;
+
+	template <class Quirks>
+	static quirk_settings of() {
+		quirk_settings settings = {
+			Quirks::SHIFT_USES_VY,
+			Quirks::LOAD_STORE_INCREMENTS_I,
+			Quirks::JUMP_USES_VX,
+			Quirks::SPRITES_WRAP,
+			Quirks::LOGIC_RESETS_VF,
+			Quirks::DISPLAY_WAIT
+		};
+		return settings;
+	}
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include <cstring>
+#include <algorithm>
+#include "Common.h"
+#include "Chip8.h"
+#include "Rewind.h"
+
+// delta records are a list of (unchanged bytes to skip, changed byte count, changed bytes XOR base) segments,
+//  both counts as varints (7 bits per byte, low bits first) - one byte for the usual short runs
+#define MAX_VARINT_BYTES 3
+
+// a run of fewer unchanged bytes than this is cheaper to keep inside the literal than to start a new segment
+#define MIN_SKIP_RUN 4
+
+// keyframes are encoded against this
+static const chip8_state zero_state = {};
+
+static inline size_t putVarint(uint8 *out, size_t value)
+{
+	size_t length = 0;
+	while (value >= 0x80) {
+		out[length++] = (uint8)(value | 0x80);
+		value >>= 7;
+	}
+	out[length++] = (uint8)value;
+	return length;
+}
+
+static inline size_t getVarint(const uint8 *in, size_t &value)
+{
+	size_t length = 0;
+	int shift = 0;
+	value = 0;
+	do {
+		value |= (size_t)(in[length] & 0x7F) << shift;
+		shift += 7;
+	} while (in[length++] & 0x80);
+	return length;
+}
+
+rewind_buffer::rewind_buffer(size_t capacity, int keyframe_interval)
+	: storage(std::max(capacity, 4 * sizeof(chip8_state))),
+	  keyframe_interval(std::max(keyframe_interval, 1)),
+	  // worst case every other byte changed
+	  delta(sizeof(chip8_state) + 2 * MAX_VARINT_BYTES * (sizeof(chip8_state) / MIN_SKIP_RUN + 1))
+{
+	clear();
+}
+
+void rewind_buffer::clear()
+{
+	records.clear();
+	write_offset = 0;
+	used = 0;
+	since_keyframe = keyframe_interval;
+}
+
+size_t rewind_buffer::frames() const
+{
+	return records.size();
+}
+
+size_t rewind_buffer::bytesUsed() const
+{
+	return used;
+}
+
+void rewind_buffer::push(const chip8 &chip)
+{
+	chip.saveState(current);
+
+	bool as_keyframe = (since_keyframe >= keyframe_interval) || records.empty();
+
+	// a delta bigger than the state itself (the program rewrote its memory) starts a new keyframe early
+	size_t length = 0;
+	if (!as_keyframe) {
+		length = encodeDelta((const uint8 *)&current, (const uint8 *)&keyframe, &delta[0]);
+		if (length >= sizeof(chip8_state)) {
+			as_keyframe = true;
+		}
+	}
+	if (as_keyframe) {
+		length = encodeDelta((const uint8 *)&current, (const uint8 *)&zero_state, &delta[0]);
+	}
+
+	uint8 *out = reserve(length);
+
+	// making room evicted the keyframe this delta is relative to (only when the whole history was dropped)
+	if (!as_keyframe && records.empty()) {
+		as_keyframe = true;
+		length = encodeDelta((const uint8 *)&current, (const uint8 *)&zero_state, &delta[0]);
+		out = reserve(length);
+	}
+
+	memcpy(out, &delta[0], length);
+	if (as_keyframe) {
+		memcpy(&keyframe, &current, sizeof(chip8_state));
+		since_keyframe = 0;
+	}
+
+	record entry = { (size_t)(out - &storage[0]), length, as_keyframe };
+	records.push_back(entry);
+	write_offset = entry.offset + length;
+	used += length;
+	++since_keyframe;
+}
+
+bool rewind_buffer::rewind(chip8 &chip)
+{
+	if (records.empty()) {
+		return false;
+	}
+
+	record newest = records.back();
+	records.pop_back();
+	used -= newest.length;
+	write_offset = newest.offset;
+
+	const chip8_state &base = newest.keyframe ? zero_state : keyframe;
+	decodeDelta(&storage[newest.offset], newest.length, (const uint8 *)&base, (uint8 *)&current);
+
+	// the next push continues the group of the (now) newest record
+	if (newest.keyframe) {
+		loadKeyframe();
+	}
+	else {
+		--since_keyframe;
+	}
+
+	return chip.loadState(current);
+}
+
+// find the keyframe of the newest group again after its successor was rewound
+bool rewind_buffer::loadKeyframe()
+{
+	for (size_t i = records.size(); i > 0; --i) {
+		if (records[i - 1].keyframe) {
+			decodeDelta(&storage[records[i - 1].offset], records[i - 1].length, (const uint8 *)&zero_state, (uint8 *)&keyframe);
+			since_keyframe = (int)(records.size() - (i - 1));
+			return true;
+		}
+	}
+
+	since_keyframe = keyframe_interval;
+	return false;
+}
+
+// drop the oldest group, a delta without its keyframe can't be decoded
+void rewind_buffer::dropOldest()
+{
+	do {
+		used -= records.front().length;
+		records.pop_front();
+	} while (!records.empty() && !records.front().keyframe);
+
+	if (records.empty()) {
+		write_offset = 0;
+		since_keyframe = keyframe_interval;
+	}
+}
+
+// contiguous space for 'length' bytes at the write position, evicting the oldest groups as needed
+uint8 *rewind_buffer::reserve(size_t length)
+{
+	for (;;) {
+		if (records.empty()) {
+			write_offset = 0;
+			return &storage[0];
+		}
+
+		size_t head = records.front().offset;
+		if (write_offset > head) {
+			// live data is [head, write_offset), free space at the end or wrapped around to the start
+			if (write_offset + length <= storage.size()) {
+				return &storage[write_offset];
+			}
+			if (length <= head) {
+				return &storage[0];
+			}
+		}
+		else if (write_offset + length <= head) {
+			// already wrapped, free space is [write_offset, head)
+			return &storage[write_offset];
+		}
+
+		dropOldest();
+	}
+}
+
+size_t rewind_buffer::encodeDelta(const uint8 *state, const uint8 *base, uint8 *out)
+{
+	const size_t size = sizeof(chip8_state);
+	size_t length = 0;
+	size_t i = 0;
+
+	while (i < size) {
+		// unchanged bytes, a word at a time where possible
+		size_t skip_start = i;
+		uint64 a, b;
+		while (i + sizeof(uint64) <= size) {
+			memcpy(&a, state + i, sizeof(uint64));
+			memcpy(&b, base + i, sizeof(uint64));
+			if (a != b) {
+				break;
+			}
+			i += sizeof(uint64);
+		}
+		while (i < size && state[i] == base[i]) {
+			++i;
+		}
+		if (i == size) {
+			break;
+		}
+
+		// changed bytes up to the next run of MIN_SKIP_RUN unchanged ones
+		size_t literal_start = i;
+		size_t literal_end = i;
+		while (i < size && i - literal_end < MIN_SKIP_RUN) {
+			if (state[i] != base[i]) {
+				literal_end = i + 1;
+			}
+			++i;
+		}
+		i = literal_end;
+
+		length += putVarint(out + length, literal_start - skip_start);
+		length += putVarint(out + length, literal_end - literal_start);
+		for (size_t j = literal_start; j < literal_end; ++j) {
+			out[length++] = state[j] ^ base[j];
+		}
+	}
+
+	return length;
+}
+
+void rewind_buffer::decodeDelta(const uint8 *in, size_t length, const uint8 *base, uint8 *state)
+{
+	memcpy(state, base, sizeof(chip8_state));
+
+	size_t position = 0;
+	size_t read = 0;
+	while (read < length) {
+		size_t skip, count;
+		read += getVarint(in + read, skip);
+		read += getVarint(in + read, count);
+		position += skip;
+		for (size_t j = 0; j < count; ++j) {
+			state[position++] ^= in[read++];
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef _REWIND_H
+#define _REWIND_H
+
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include "Common.h"
+#include "Chip8.h"
+#include "SaveState.h"
+
+/**
+ * Rewind history - one save state per frame in a fixed amount of memory.
+ *
+ *  - every KEYFRAME_INTERVAL frames a full state is stored (a keyframe), encoded against an
+ *    all-zero state so the unused part of the 64K memory costs next to nothing
+ *  - the frames in between are stored as the XOR against their keyframe, run-length encoded.
+ *    Frames barely change memory, so a delta is usually a few hundred bytes
+ *  - all records live in one preallocated byte ring, the oldest keyframe (and its deltas) is
+ *    dropped when a new record doesn't fit. Nothing is allocated per frame
+ *
+ * push() once per frame, rewind() steps back one frame per call (newest first).
+*/
+class rewind_buffer {
+public:
+	static const size_t DEFAULT_CAPACITY = 4 * 1024 * 1024;
+	static const int DEFAULT_KEYFRAME_INTERVAL = 60;
+
+	rewind_buffer(size_t capacity = DEFAULT_CAPACITY, int keyframe_interval = DEFAULT_KEYFRAME_INTERVAL);
+
+	// record the current state of 'chip'
+	void push(const chip8 &chip);
+
+	// restore the newest recorded frame into 'chip' and drop it, false when the history is empty
+	bool rewind(chip8 &chip);
+
+	void clear();
+
+	size_t frames() const;
+	size_t bytesUsed() const;
+
+private:
+	struct record {
+		size_t offset;
+		size_t length;
+		bool keyframe;
+	};
+
+	std::vector<uint8> storage;
+	std::deque<record> records;
+	size_t write_offset;
+	size_t used;
+	int keyframe_interval;
+	int since_keyframe;
+
+	// decoded keyframe of the newest group and scratch space for the frame being encoded / decoded
+	chip8_state keyframe;
+	chip8_state current;
+	std::vector<uint8> delta;
+
+	uint8 *reserve(size_t length);
+	void dropOldest();
+	bool loadKeyframe();
+
+	static size_t encodeDelta(const uint8 *state, const uint8 *base, uint8 *out);
+	static void decodeDelta(const uint8 *in, size_t length, const uint8 *base, uint8 *state);
+};
+
+#endif
@@ -0,0 +1,322 @@
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include "stdio.h"
+#include "stdlib.h"
+#include "Common.h"
+#include "Chip8.h"
+#include "Rom.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * rom_image
+ *
+*/
+
+rom_image::rom_image()
+	: bytes(NULL), length(0), content_hash(0), file_handle(NULL), mapping_handle(NULL)
+{
+}
+
+rom_image::~rom_image()
+{
+	close();
+}
+
+bool rom_image::open(const char *path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	length = (size_t)file_size.QuadPart;
+
+	// an empty file can't be mapped, it is simply an empty image
+	if (length != 0) {
+		mapping_handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_handle != NULL) {
+			bytes = (const uint8 *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+		}
+		if (bytes == NULL) {
+			close();
+			return false;
+		}
+	}
+#else
+	int descriptor = ::open(path, O_RDONLY);
+	if (descriptor < 0) {
+		return false;
+	}
+
+	struct stat file_status;
+	if (fstat(descriptor, &file_status) != 0) {
+		::close(descriptor);
+		return false;
+	}
+	length = (size_t)file_status.st_size;
+
+	if (length != 0) {
+		void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (mapped == MAP_FAILED) {
+			::close(descriptor);
+			length = 0;
+			return false;
+		}
+		bytes = (const uint8 *)mapped;
+	}
+
+	// the mapping stays valid without the descriptor
+	::close(descriptor);
+#endif
+
+	content_hash = hashBytes(bytes, length);
+	return true;
+}
+
+void rom_image::close()
+{
+#ifdef _WIN32
+	if (bytes != NULL) {
+		UnmapViewOfFile(bytes);
+	}
+	if (mapping_handle != NULL) {
+		CloseHandle((HANDLE)mapping_handle);
+	}
+	if (file_handle != NULL) {
+		CloseHandle((HANDLE)file_handle);
+	}
+#else
+	if (bytes != NULL) {
+		munmap((void *)bytes, length);
+	}
+#endif
+
+	bytes = NULL;
+	length = 0;
+	content_hash = 0;
+	file_handle = NULL;
+	mapping_handle = NULL;
+}
+
+// 64 bit FNV-1a
+uint64 rom_image::hashBytes(const uint8 *data, size_t length)
+{
+	uint64 hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+/**
+ * rom_catalogue
+ *
+*/
+
+rom_entry::rom_entry()
+	: hash(0), machine(chip8::NUMBER_OF_MACHINES), quirks(chip8::NUMBER_OF_QUIRK_PROFILES), clock(0)
+{
+}
+
+bool rom_entry::operator==(const rom_entry &other) const
+{
+	return hash == other.hash && name == other.name && machine == other.machine && quirks == other.quirks &&
+		clock == other.clock && keys == other.keys;
+}
+
+// next whitespace separated token of a catalogue line, false at the end of the line or at a '#' comment.
+//  Double quotes keep spaces and '#' in a value, a backslash takes the next character as it is
+static bool next_token(const std::string &line, size_t &at, std::string &token)
+{
+	while (at < line.size() && isspace((unsigned char)line[at])) {
+		++at;
+	}
+	if (at == line.size() || line[at] == '#') {
+		return false;
+	}
+
+	token.clear();
+	bool quoted = false;
+	for (; at < line.size(); ++at) {
+		char c = line[at];
+		if (c == '"') {
+			quoted = !quoted;
+		}
+		else if (c == '\\' && at + 1 < line.size()) {
+			token += line[++at];
+		}
+		else if (!quoted && (isspace((unsigned char)c) || c == '#')) {
+			break;
+		}
+		else {
+			token += c;
+		}
+	}
+	return true;
+}
+
+// a value as next_token reads it back, quoted when it holds anything but plain characters
+static std::string quote_value(const std::string &value)
+{
+	if (!value.empty() && value.find_first_of(" \t\r\"#\\") == std::string::npos) {
+		return value;
+	}
+	std::string quoted = "\"";
+	for (size_t i = 0; i < value.size(); ++i) {
+		if (value[i] == '"' || value[i] == '\\') {
+			quoted += '\\';
+		}
+		quoted += value[i];
+	}
+	return quoted + "\"";
+}
+
+// false for a line with nothing but a comment as well, 'blank' tells the two apart
+static bool parse_entry(const std::string &line, rom_entry &entry, bool &blank)
+{
+	size_t at = 0;
+	std::string token;
+
+	blank = !next_token(line, at, token);
+	if (blank || token.size() != 16) {
+		return false;
+	}
+	char *end = NULL;
+	entry.hash = strtoull(token.c_str(), &end, 16);
+	if (*end != '\0') {
+		return false;
+	}
+
+	while (next_token(line, at, token)) {
+		size_t split = token.find('=');
+		std::string name = token.substr(0, split);
+		std::string value = (split == std::string::npos) ? "" : token.substr(split + 1);
+
+		if (name == "name")         { entry.name = value; }
+		else if (name == "machine") { if (!chip8::parseMachine(value.c_str(), entry.machine)) { return false; } }
+		else if (name == "quirks")  { if (!chip8::parseQuirks(value.c_str(), entry.quirks)) { return false; } }
+		else if (name == "clock")   { entry.clock = atoi(value.c_str()); }
+		else if (name == "keys")    { if (value.size() != chip8::KEY_STATES) { return false; } entry.keys = value; }
+		else { return false; }
+	}
+	return true;
+}
+
+std::string rom_catalogue::entryName(const std::string &path)
+{
+	size_t directory = path.find_last_of("/\\");
+	return (directory == std::string::npos) ? path : path.substr(directory + 1);
+}
+
+bool rom_catalogue::load(const char *path)
+{
+	std::ifstream input(path);
+	if (!input) {
+		return false;
+	}
+
+	std::string line;
+	int line_number = 0;
+	while (std::getline(input, line)) {
+		++line_number;
+
+		rom_entry entry;
+		bool blank = false;
+		if (!parse_entry(line, entry, blank)) {
+			if (!blank) {
+				fprintf(stderr, "%s:%d: bad catalogue entry skipped\n", path, line_number);
+			}
+			continue;
+		}
+		entries[entry.hash] = entry;
+	}
+	return true;
+}
+
+bool rom_catalogue::save(const char *path) const
+{
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		return false;
+	}
+
+	fprintf(out, "# <hash> [name=N] [machine=chip8|schip|xochip] [quirks=modern|vip|schip|xochip] [clock=N] [keys=16 host keys]\n");
+	fprintf(out, "# values with spaces, '#' or quotes are in double quotes, \\ escapes a quote or a backslash\n");
+	for (std::map<uint64, rom_entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		const rom_entry &entry = it->second;
+		fprintf(out, "%016llx", (unsigned long long)entry.hash);
+		if (!entry.name.empty()) {
+			fprintf(out, " name=%s", quote_value(entry.name).c_str());
+		}
+		if (entry.machine != chip8::NUMBER_OF_MACHINES) {
+			fprintf(out, " machine=%s", chip8::machineName(entry.machine));
+		}
+		if (entry.quirks != chip8::NUMBER_OF_QUIRK_PROFILES) {
+			fprintf(out, " quirks=%s", chip8::quirksName(entry.quirks));
+		}
+		if (entry.clock != 0) {
+			fprintf(out, " clock=%d", entry.clock);
+		}
+		if (!entry.keys.empty()) {
+			fprintf(out, " keys=%s", quote_value(entry.keys).c_str());
+		}
+		fprintf(out, "\n");
+	}
+
+	bool written = (ferror(out) == 0);
+	fclose(out);
+	if (!written) {
+		return false;
+	}
+
+	// round trip:  what was written has to read back as the same entries
+	rom_catalogue check;
+	return check.load(path) && check.entries == entries;
+}
+
+std::shared_ptr<const rom_image> rom_catalogue::open(const std::string &path)
+{
+	std::lock_guard<std::mutex> guard(images_lock);
+
+	std::map<std::string, std::shared_ptr<const rom_image> >::iterator found = images.find(path);
+	if (found != images.end()) {
+		return found->second;
+	}
+
+	std::shared_ptr<rom_image> image(new rom_image());
+	if (!image->open(path.c_str())) {
+		return std::shared_ptr<const rom_image>();
+	}
+	images[path] = image;
+	return image;
+}
+
+const rom_entry *rom_catalogue::find(uint64 hash) const
+{
+	std::map<uint64, rom_entry>::const_iterator found = entries.find(hash);
+	return (found != entries.end()) ? &found->second : NULL;
+}
+
+void rom_catalogue::update(const rom_entry &entry)
+{
+	entries[entry.hash] = entry;
+}
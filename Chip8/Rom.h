@@ -0,0 +1,98 @@
+#pragma once
+#ifndef _ROM_H
+#define _ROM_H
+
+#include <stddef.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "Common.h"
+#include "Chip8.h"
+
+/**
+ * ROM image - a ROM file mapped read-only into the address space.
+ *
+ * chip8::loadRom copies it straight from the mapping into machine memory, there is no
+ *  intermediate buffer. The content hash (64 bit FNV-1a) is computed once when the file is opened.
+*/
+class rom_image {
+public:
+	rom_image();
+	~rom_image();
+
+	bool open(const char *path);
+	void close();
+
+	const uint8 *data() const { return bytes; }
+	size_t size() const { return length; }
+	uint64 hash() const { return content_hash; }
+
+	static uint64 hashBytes(const uint8 *data, size_t length);
+
+private:
+	rom_image(const rom_image &);
+	rom_image &operator=(const rom_image &);
+
+	const uint8 *bytes;
+	size_t length;
+	uint64 content_hash;
+
+	// HANDLEs of the file and its mapping on Windows, unused elsewhere (the descriptor is closed once mapped)
+	void *file_handle;
+	void *mapping_handle;
+};
+
+/**
+ * Per ROM settings, keyed by content hash so a renamed or copied file keeps them.
+ *  machine / quirks at NUMBER_OF_MACHINES / NUMBER_OF_QUIRK_PROFILES, clock at 0 and an empty key map
+ *  mean 'not set'.
+*/
+struct rom_entry {
+	uint64 hash;
+	std::string name;
+	chip8::Machine machine;
+	chip8::QuirkProfile quirks;
+	int clock;              // instructions per second
+	std::string keys;       // 16 host keys, the one for chip8 key 0 first
+
+	rom_entry();
+	bool operator==(const rom_entry &other) const;
+};
+
+/**
+ * ROM catalogue
+ *
+ *  - the on-disk catalogue is a text file, one ROM per line, '#' starts a comment:
+ *        <hash as 16 hex digits> [name=N] [machine=chip8|schip|xochip] [quirks=Q] [clock=N] [keys=123q...]
+ *    a value with spaces, '#' or quotes is written in double quotes (\ escapes a quote or a backslash).
+ *    It is read once by load() and written back by save(), which reads the file back and fails unless
+ *    it gives the same entries
+ *  - a ROM is catalogued under its file name (entryName), without the directories of the path it ran from
+ *  - open() maps every ROM file once and hands the same image to every caller (any thread),
+ *    so thousands of instances of a few hundred ROMs cost a few hundred mappings
+*/
+class rom_catalogue {
+public:
+	bool load(const char *path);
+	bool save(const char *path) const;
+
+	static std::string entryName(const std::string &path);
+
+	// NULL when the file can't be opened
+	std::shared_ptr<const rom_image> open(const std::string &path);
+
+	// NULL when the ROM isn't catalogued
+	const rom_entry *find(uint64 hash) const;
+	void update(const rom_entry &entry);
+
+	size_t size() const { return entries.size(); }
+
+private:
+	std::map<uint64, rom_entry> entries;
+
+	std::mutex images_lock;
+	std::map<std::string, std::shared_ptr<const rom_image> > images;
+};
+
+#endif
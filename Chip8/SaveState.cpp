@@ -0,0 +1,109 @@
+#include <cstring>
+#include "stdio.h"
+#include "Common.h"
+#include "Chip8.h"
+#include "Log.h"
+#include "SaveState.h"
+
+void chip8::saveState(chip8_state &state) const
+{
+	state.magic = SAVE_STATE_MAGIC;
+	state.version = SAVE_STATE_VERSION;
+	state.size = sizeof(chip8_state);
+
+	memcpy(state.memory, memory, sizeof(memory));
+	memcpy(state.V, V, sizeof(V));
+	state.I = I;
+	state.pc = pc;
+	memcpy(state.gfx, gfx, sizeof(gfx));
+	state.hires = hires ? 1 : 0;
+	state.planes = planes;
+	state.machine = (uint8)machine;
+	memcpy(state.stack, stack, sizeof(stack));
+	state.sp = sp;
+	memcpy(state.key, key, sizeof(key));
+	state.delay_timer = delay_timer;
+	state.sound_timer = sound_timer;
+	state.random_state = random_state;
+	memcpy(state.rpl, rpl, sizeof(rpl));
+	memcpy(state.audio_pattern, audio_pattern, sizeof(audio_pattern));
+	state.pitch = pitch;
+	state.cycle = cycle;
+	state.vblank_cycle = scheduler.nextCycle(EVENT_VBLANK);
+	state.vblank = vblank ? 1 : 0;
+}
+
+bool chip8::loadState(const chip8_state &state)
+{
+	if (state.magic != SAVE_STATE_MAGIC || state.version != SAVE_STATE_VERSION || state.size != sizeof(chip8_state)) {
+		LOG_WARN(LOG_STATE_UNKNOWN_FORMAT);
+		return false;
+	}
+
+	memcpy(memory, state.memory, sizeof(memory));
+	memcpy(V, state.V, sizeof(V));
+	I = state.I;
+	pc = state.pc;
+	memcpy(gfx, state.gfx, sizeof(gfx));
+	hires = (state.hires != 0);
+	planes = state.planes;
+	memcpy(stack, state.stack, sizeof(stack));
+	sp = state.sp;
+	memcpy(key, state.key, sizeof(key));
+	delay_timer = state.delay_timer;
+	sound_timer = state.sound_timer;
+	random_state = state.random_state;
+	memcpy(rpl, state.rpl, sizeof(rpl));
+	memcpy(audio_pattern, state.audio_pattern, sizeof(audio_pattern));
+	pitch = state.pitch;
+
+	// the frame goes on where it was saved, queued input keeps its distance from the present
+	scheduler.rebase(cycle, state.cycle);
+	scheduler.cancel(EVENT_VBLANK);
+	scheduler.schedule(state.vblank_cycle, EVENT_VBLANK);
+	cycle = state.cycle;
+	vblank = (state.vblank != 0);
+
+	// the instruction set comes with the machine, the quirks are kept unless it changes
+	if (state.machine != machine) {
+		setMachine((Machine)state.machine);
+	}
+
+	// memory was replaced under the decoded instructions (and any compiled blocks)
+	invalidateDecodeCache();
+
+	faulted = false;
+	drawFlag = true;
+	return true;
+}
+
+bool chip8::saveStateFile(const char *filename) const
+{
+	chip8_state *state = new chip8_state;
+	saveState(*state);
+
+	FILE *ptrFile = fopen(filename, "wb");
+	if (ptrFile == NULL) {
+		delete state;
+		return false;
+	}
+
+	bool written = (fwrite(state, sizeof(chip8_state), 1, ptrFile) == 1);
+	fclose(ptrFile);
+	delete state;
+	return written;
+}
+
+bool chip8::loadStateFile(const char *filename)
+{
+	FILE *ptrFile = fopen(filename, "rb");
+	if (ptrFile == NULL) {
+		return false;
+	}
+
+	chip8_state *state = new chip8_state;
+	bool restored = (fread(state, sizeof(chip8_state), 1, ptrFile) == 1) && loadState(*state);
+	fclose(ptrFile);
+	delete state;
+	return restored;
+}
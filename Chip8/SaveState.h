@@ -0,0 +1,49 @@
+#pragma once
+#ifndef _SAVE_STATE_H
+#define _SAVE_STATE_H
+
+#include "Common.h"
+#include "Chip8.h"
+
+#define SAVE_STATE_MAGIC 0x53533843     // "C8SS"
+#define SAVE_STATE_VERSION 3
+
+/**
+ * Save state - everything that defines a running chip8, in one fixed-size block.
+ *
+ * Taking or restoring one is a handful of memcpys (a few microseconds), the file format is this
+ *  struct written as is (host byte order). The header is checked on restore, bump
+ *  SAVE_STATE_VERSION whenever a field is added, removed or changes meaning.
+*/
+struct chip8_state {
+	// header
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+
+	// machine
+	uint8 memory[chip8::MEMORY_SIZE];
+	uint8 V[chip8::REGISTER_COUNT];
+	uint16 I;
+	uint16 pc;
+	gfx_plane gfx[GFX_PLANES];
+	uint8 hires;
+	uint8 planes;
+	uint8 machine;
+	uint16 stack[chip8::STACK_LEVELS];
+	uint16 sp;
+	uint8 key[chip8::KEY_STATES];
+	uint8 delay_timer;
+	uint8 sound_timer;
+	uint32_t random_state;
+	uint8 rpl[chip8::REGISTER_COUNT];
+	uint8 audio_pattern[16];
+	uint8 pitch;
+
+	// emulated time:  the cycle, when the next vblank comes and whether one came since the last DXYN
+	uint64 cycle;
+	uint64 vblank_cycle;
+	uint8 vblank;
+};
+
+#endif
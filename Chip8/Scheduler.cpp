@@ -0,0 +1,76 @@
+#include <algorithm>
+#include "Common.h"
+#include "Scheduler.h"
+
+// std heaps keep the largest element on top, the "larger" event is the one due later
+static bool later(const scheduled_event &a, const scheduled_event &b)
+{
+	if (a.cycle != b.cycle) {
+		return a.cycle > b.cycle;
+	}
+	if (a.kind != b.kind) {
+		return a.kind > b.kind;
+	}
+	return a.sequence > b.sequence;
+}
+
+chip8_scheduler::chip8_scheduler()
+{
+	sequence = 0;
+}
+
+void chip8_scheduler::clear()
+{
+	heap.clear();
+	sequence = 0;
+}
+
+void chip8_scheduler::schedule(uint64 cycle, ScheduledEvent kind, uint8 key, bool pressed)
+{
+	scheduled_event event = { cycle, sequence++, kind, key, pressed };
+	heap.push_back(event);
+	std::push_heap(heap.begin(), heap.end(), later);
+}
+
+void chip8_scheduler::cancel(ScheduledEvent kind)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < heap.size(); ++i) {
+		if (heap[i].kind != kind) {
+			heap[kept++] = heap[i];
+		}
+	}
+	heap.resize(kept);
+	std::make_heap(heap.begin(), heap.end(), later);
+}
+
+uint64 chip8_scheduler::nextCycle(ScheduledEvent kind) const
+{
+	uint64 next = NEVER;
+	for (size_t i = 0; i < heap.size(); ++i) {
+		if (heap[i].kind == kind && heap[i].cycle < next) {
+			next = heap[i].cycle;
+		}
+	}
+	return next;
+}
+
+void chip8_scheduler::rebase(uint64 from, uint64 to)
+{
+	// the same shift for every event (due ones all land on 'to'), the heap order holds
+	for (size_t i = 0; i < heap.size(); ++i) {
+		heap[i].cycle = (heap[i].cycle > from) ? to + (heap[i].cycle - from) : to;
+	}
+}
+
+bool chip8_scheduler::pop(uint64 now, scheduled_event &event)
+{
+	if (heap.empty() || heap.front().cycle > now) {
+		return false;
+	}
+
+	std::pop_heap(heap.begin(), heap.end(), later);
+	event = heap.back();
+	heap.pop_back();
+	return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <vector>
+#include "Common.h"
+
+/**
+ * Emulated time - the events of one chip8, stamped with the cycle they fall due at.
+ *
+ * chip8::cycle counts every instruction since initialize() (idle ones that were fast-forwarded too),
+ *  so the emulated timeline is the instruction stream itself and doesn't depend on how the host slices it.
+ *  The queue is a binary min-heap on the cycle, events due at the same cycle come out vblank first and
+ *  otherwise in the order they were scheduled.
+ *
+ *      EVENT_VBLANK    every cycles_per_frame:  the 60Hz timer tick (delay / sound timer, audio) and the
+ *                      end of a display wait, schedules the next one
+ *      EVENT_KEY       a key goes down or up, from the host or a key script
+ *
+ *  chip8::run() executes uninterrupted up to the next event, delivers everything due and goes on, the
+ *  engines never look at the clock.
+*/
+
+enum scheduled_events {
+	EVENT_VBLANK = 0,
+	EVENT_KEY,
+	NUMBER_OF_SCHEDULED_EVENTS
+};
+
+typedef enum scheduled_events ScheduledEvent;
+
+struct scheduled_event {
+	uint64 cycle;
+	uint32_t sequence;      // order of scheduling, breaks ties after the kind
+	ScheduledEvent kind;
+	uint8 key;
+	bool pressed;
+};
+
+class chip8_scheduler {
+public:
+	// nothing scheduled
+	static const uint64 NEVER = ~(uint64)0;
+
+	chip8_scheduler();
+
+	void clear();
+	void schedule(uint64 cycle, ScheduledEvent kind, uint8 key = 0, bool pressed = false);
+	// drops every event of 'kind' (the vblank when the clock or the timeline changes)
+	void cancel(ScheduledEvent kind);
+
+	bool empty() const { return heap.empty(); }
+	size_t size() const { return heap.size(); }
+	uint64 nextCycle() const { return heap.empty() ? NEVER : heap.front().cycle; }
+	uint64 nextCycle(ScheduledEvent kind) const;
+
+	// the timeline jumped from cycle 'from' to 'to' (a save state was restored), every event keeps its
+	//  distance from the present and the ones already due stay due
+	void rebase(uint64 from, uint64 to);
+
+	// the earliest event, only when it is due at 'now'
+	bool pop(uint64 now, scheduled_event &event);
+
+private:
+	std::vector<scheduled_event> heap;
+	uint32_t sequence;
+};
+
+#endif
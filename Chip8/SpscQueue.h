@@ -0,0 +1,48 @@
+#pragma once
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+// lock-free single producer / single consumer ring buffer
+//  CAPACITY must be a power of two, push() fails instead of blocking when the ring is full
+template <typename T, size_t CAPACITY>
+class SpscQueue {
+
+private:
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+    T _items[CAPACITY];
+    std::atomic<size_t> _head;  // next slot to read, consumer owned
+    std::atomic<size_t> _tail;  // next slot to write, producer owned
+
+public:
+    SpscQueue() : _head(0), _tail(0) {}
+
+    bool push(const T &item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == CAPACITY) {
+            return false;
+        }
+        _items[tail & (CAPACITY - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = _items[head & (CAPACITY - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include "Timeline.h"
+
+static const char *phase_names[NUMBER_OF_TIMELINE_PHASES] = { "execute", "timers", "display", "wait" };
+
+// bucket widths:  jitter and lateness are fractions of a 16.7ms frame, input latency is a few frames
+#define JITTER_BUCKET_NS 250000LL
+#define LATENESS_BUCKET_NS 500000LL
+#define INPUT_LATENCY_BUCKET_NS 2000000LL
+
+// printf into a std::string
+static void append(std::string &out, const char *format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (length > 0) {
+		out.append(buffer, (length < (int)sizeof(buffer)) ? length : sizeof(buffer) - 1);
+	}
+}
+
+latency_histogram::latency_histogram(long long bucket_ns) : bucket_ns(bucket_ns)
+{
+	memset(counts, 0, sizeof(counts));
+	samples = 0;
+	total_ns = 0;
+	max_ns = 0;
+}
+
+void latency_histogram::add(long long ns)
+{
+	if (ns < 0) {
+		ns = 0;
+	}
+	long long bucket = ns / bucket_ns;
+	++counts[(bucket < BUCKETS) ? bucket : BUCKETS - 1];
+	++samples;
+	total_ns += ns;
+	max_ns = std::max(max_ns, ns);
+}
+
+long long latency_histogram::percentile(double p) const
+{
+	uint64 wanted = (uint64)(p * samples + 0.5);
+	uint64 seen = 0;
+	for (int i = 0; i < BUCKETS; ++i) {
+		seen += counts[i];
+		if (seen >= wanted && seen != 0) {
+			return std::min((i + 1) * bucket_ns, max_ns);
+		}
+	}
+	return max_ns;
+}
+
+void latency_histogram::appendJson(std::string &out) const
+{
+	append(out, "{\"bucket_us\":%.1f,\"count\":%llu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p95_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"buckets\":[",
+		bucket_ns / 1000.0, (unsigned long long)samples, samples ? total_ns / 1000.0 / samples : 0.0,
+		percentile(0.5) / 1000.0, percentile(0.95) / 1000.0, percentile(0.99) / 1000.0, max_ns / 1000.0);
+
+	// trailing empty buckets left out
+	int used = BUCKETS;
+	while (used > 0 && counts[used - 1] == 0) {
+		--used;
+	}
+	for (int i = 0; i < used; ++i) {
+		append(out, "%s%llu", i ? "," : "", (unsigned long long)counts[i]);
+	}
+	out += "]}";
+}
+
+present_log::present_log() : presents(PRESENTS), input_latency(INPUT_LATENCY_BUCKET_NS)
+{
+	recorded = 0;
+}
+
+void present_log::present(uint64 sequence, uint64 input_tick)
+{
+	present_record &next = presents[recorded++ & (PRESENTS - 1)];
+	next.tick = TickClock::now();
+	next.sequence = sequence;
+	next.latency_ns = -1;
+	if (input_tick != 0) {
+		next.latency_ns = TickClock::nanoseconds((int64_t)(next.tick - input_tick));
+		input_latency.add(next.latency_ns);
+	}
+}
+
+frame_timeline::frame_timeline() : slices(SLICES), frame_records(FRAMES), jitter(JITTER_BUCKET_NS), lateness(LATENESS_BUCKET_NS)
+{
+	slices_recorded = 0;
+	frames_recorded = 0;
+	frame_start = TickClock::now();
+	memset(phase_ticks, 0, sizeof(phase_ticks));
+}
+
+void frame_timeline::endFrame(uint64 cycle, int emulated, long long period_ns, long long late_ns)
+{
+	uint64 now = TickClock::now();
+
+	frame_record &next = frame_records[frames_recorded++ & (FRAMES - 1)];
+	next.start = frame_start;
+	next.end = now;
+	next.cycle = cycle;
+	memcpy(next.phase_ticks, phase_ticks, sizeof(phase_ticks));
+	next.late_ns = late_ns;
+	next.emulated = emulated;
+
+	if (period_ns > 0) {
+		long long length = TickClock::nanoseconds((int64_t)(now - frame_start));
+		jitter.add((length > period_ns) ? length - period_ns : period_ns - length);
+	}
+	if (late_ns > 0) {
+		lateness.add(late_ns);
+	}
+
+	frame_start = now;
+	memset(phase_ticks, 0, sizeof(phase_ticks));
+}
+
+bool frame_timeline::write(const char *path, const present_log &presents) const
+{
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		return false;
+	}
+
+	// what is still in the rings, oldest first
+	uint64 first_slice = (slices_recorded > SLICES) ? slices_recorded - SLICES : 0;
+	uint64 first_frame = (frames_recorded > FRAMES) ? frames_recorded - FRAMES : 0;
+	uint64 first_present = (presents.recorded > present_log::PRESENTS) ? presents.recorded - present_log::PRESENTS : 0;
+
+	// timestamps are microseconds from the oldest event kept
+	uint64 base = ~(uint64)0;
+	if (slices_recorded != 0)     { base = std::min(base, slices[first_slice & (SLICES - 1)].start); }
+	if (frames_recorded != 0)     { base = std::min(base, frame_records[first_frame & (FRAMES - 1)].start); }
+	if (presents.recorded != 0)   { base = std::min(base, presents.presents[first_present & (present_log::PRESENTS - 1)].tick); }
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Chip8\"}},\n");
+	fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"emulation\"}},\n");
+	fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"render\"}}");
+
+	for (uint64 i = first_frame; i < frames_recorded; ++i) {
+		const frame_record &frame = frame_records[i & (FRAMES - 1)];
+		fprintf(out, ",\n{\"name\":\"frame\",\"cat\":\"pacing\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+			"\"args\":{\"cycle\":%llu,\"emulated_frames\":%d",
+			TickClock::nanoseconds((int64_t)(frame.start - base)) / 1000.0,
+			TickClock::nanoseconds((int64_t)(frame.end - frame.start)) / 1000.0,
+			(unsigned long long)frame.cycle, frame.emulated);
+		for (int phase = 0; phase < NUMBER_OF_TIMELINE_PHASES; ++phase) {
+			fprintf(out, ",\"%s_us\":%.3f", phase_names[phase], TickClock::nanoseconds((int64_t)frame.phase_ticks[phase]) / 1000.0);
+		}
+		fprintf(out, "}}");
+
+		if (frame.late_ns > 0) {
+			fprintf(out, ",\n{\"name\":\"missed deadline\",\"cat\":\"pacing\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":1,\"ts\":%.3f,"
+				"\"args\":{\"late_us\":%.3f}}",
+				TickClock::nanoseconds((int64_t)(frame.end - base)) / 1000.0, frame.late_ns / 1000.0);
+		}
+	}
+
+	for (uint64 i = first_slice; i < slices_recorded; ++i) {
+		const slice &phase = slices[i & (SLICES - 1)];
+		fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"pacing\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+			phase_names[phase.phase], TickClock::nanoseconds((int64_t)(phase.start - base)) / 1000.0,
+			TickClock::nanoseconds((int64_t)(phase.end - phase.start)) / 1000.0);
+	}
+
+	for (uint64 i = first_present; i < presents.recorded; ++i) {
+		const present_log::present_record &present = presents.presents[i & (present_log::PRESENTS - 1)];
+		fprintf(out, ",\n{\"name\":\"present\",\"cat\":\"pacing\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":2,\"ts\":%.3f,"
+			"\"args\":{\"frame\":%llu",
+			TickClock::nanoseconds((int64_t)(present.tick - base)) / 1000.0, (unsigned long long)present.sequence);
+		if (present.latency_ns >= 0) {
+			fprintf(out, ",\"input_latency_us\":%.3f", present.latency_ns / 1000.0);
+		}
+		fprintf(out, "}}");
+	}
+
+	std::string histograms;
+	histograms += "\"frame_jitter\":";
+	jitter.appendJson(histograms);
+	histograms += ",\"missed_deadlines\":";
+	lateness.appendJson(histograms);
+	histograms += ",\"input_latency\":";
+	presents.input_latency.appendJson(histograms);
+
+	fprintf(out, "\n],\n\"histograms\":{%s,\"frames\":%llu}}\n", histograms.c_str(), (unsigned long long)frames_recorded);
+
+	bool written = (ferror(out) == 0);
+	if (fclose(out) != 0) {
+		written = false;
+	}
+	return written;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#ifndef _TIMELINE_H
+#define _TIMELINE_H
+
+#include <string>
+#include <vector>
+#include "Common.h"
+#include "Timer.h"
+
+/**
+ * Frame pacing timeline - where the emulation thread's wall time goes, recorded all the time.
+ *
+ * Each frame of the emulation thread is split into phases, each one timed by a timeline_probe (two
+ *  TickClock reads and a store into a ring, a few ns):
+ *      PHASE_EXECUTE   chip8::run
+ *      PHASE_TIMERS    the work at the frame boundary:  input and commands taken in, the rewind history
+ *                      pushed at the vblank (the delay / sound timers themselves tick inside chip8::run)
+ *      PHASE_DISPLAY   the frame handed to the render thread
+ *      PHASE_WAIT      pacing, sleeping / spinning to the next deadline
+ *  The last SLICES phases and FRAMES frames are kept (minutes with frame pacing, seconds with
+ *  instruction pacing, which times every instruction), nothing is allocated or written while running.
+ *
+ * Three histograms cover the whole session:
+ *      frame jitter        how far each frame's length was off its target (1/60s, shorter when faster)
+ *      missed deadlines    how late the frames that missed their deadline were
+ *      input latency       from a key event on the render thread to the first present of a frame the
+ *                          emulation produced after taking it in (present_log, on the render thread)
+ *
+ * write() exports everything as Chrome Trace Event JSON (chrome://tracing, Perfetto):  frames and their
+ *  phases as complete events on the emulation thread, missed deadlines as instant events, presents with
+ *  their input latency on the render thread, and the histograms (microseconds) under "histograms".
+*/
+
+enum timeline_phases {
+	PHASE_EXECUTE = 0,
+	PHASE_TIMERS,
+	PHASE_DISPLAY,
+	PHASE_WAIT,
+	NUMBER_OF_TIMELINE_PHASES
+};
+
+typedef enum timeline_phases TimelinePhase;
+
+// BUCKETS fixed width buckets, the last one also takes everything beyond it
+class latency_histogram {
+public:
+	static const int BUCKETS = 64;
+
+	explicit latency_histogram(long long bucket_ns);
+
+	void add(long long ns);
+
+	uint64 count() const { return samples; }
+	// upper edge of the bucket holding the p-th fraction of the samples
+	long long percentile(double p) const;
+
+	void appendJson(std::string &out) const;
+
+private:
+	long long bucket_ns;
+	uint64 counts[BUCKETS];
+	uint64 samples;
+	long long total_ns;
+	long long max_ns;
+};
+
+// the render thread's side:  every present of a new frame, and the input latency it closed
+class present_log {
+public:
+	static const size_t PRESENTS = 16384;
+
+	present_log();
+
+	// frame 'sequence' is on screen, 'input_tick' (0 = none) is the oldest key event it answers
+	void present(uint64 sequence, uint64 input_tick);
+
+	const latency_histogram &latency() const { return input_latency; }
+
+private:
+	friend class frame_timeline;
+
+	struct present_record {
+		uint64 tick;
+		uint64 sequence;
+		long long latency_ns;       // -1 = no input
+	};
+
+	std::vector<present_record> presents;
+	uint64 recorded;
+	latency_histogram input_latency;
+};
+
+class frame_timeline {
+public:
+	static const size_t SLICES = 65536;
+	static const size_t FRAMES = 16384;
+
+	frame_timeline();
+
+	// the first frame starts here (the emulation thread starting)
+	void start() { frame_start = TickClock::now(); }
+
+	inline void record(TimelinePhase phase, uint64 start, uint64 end) {
+		slice &next = slices[slices_recorded++ & (SLICES - 1)];
+		next.start = start;
+		next.end = end;
+		next.phase = phase;
+		phase_ticks[phase] += end - start;
+	}
+
+	// closes the frame that started where the last one ended. 'period_ns' is the length it was meant to
+	//  have (0 = none, uncapped), 'late_ns' how far past its deadline it finished (> 0 = missed)
+	void endFrame(uint64 cycle, int emulated, long long period_ns, long long late_ns);
+
+	// since the last endFrame
+	long long frameElapsed() const { return TickClock::nanoseconds((int64_t)(TickClock::now() - frame_start)); }
+
+	uint64 frames() const { return frames_recorded; }
+	uint64 missed() const { return lateness.count(); }
+
+	bool write(const char *path, const present_log &presents) const;
+
+private:
+	struct slice {
+		uint64 start;
+		uint64 end;
+		TimelinePhase phase;
+	};
+
+	struct frame_record {
+		uint64 start;
+		uint64 end;
+		uint64 cycle;               // emulated cycle at the end of the frame
+		uint64 phase_ticks[NUMBER_OF_TIMELINE_PHASES];
+		long long late_ns;
+		int emulated;               // emulated frames it ran
+	};
+
+	std::vector<slice> slices;
+	std::vector<frame_record> frame_records;
+	uint64 slices_recorded;
+	uint64 frames_recorded;
+
+	uint64 frame_start;
+	uint64 phase_ticks[NUMBER_OF_TIMELINE_PHASES];
+
+	latency_histogram jitter;
+	latency_histogram lateness;
+};
+
+// times the rest of the enclosing scope as 'phase'
+class timeline_probe {
+public:
+	timeline_probe(frame_timeline &timeline, TimelinePhase phase)
+		: timeline(timeline), phase(phase), start(TickClock::now()) {}
+	~timeline_probe() { timeline.record(phase, start, TickClock::now()); }
+
+private:
+	frame_timeline &timeline;
+	TimelinePhase phase;
+	uint64 start;
+};
+
+#endif
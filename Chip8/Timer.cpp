@@ -1,5 +1,6 @@
 #include "Timer.h"
 #include "assert.h"
+#include <thread>
 
 void Timer::start() {
     _start_t = Clock::now();
@@ -12,4 +13,62 @@ void Timer::end() {
 long long Timer::elapsed() {
     Clock::duration elapsed = _end_t - _start_t;
     return elapsed.count();
+}
+
+double TickClock::_ns_per_tick = (double)Clock::period::num * NANO_SECONDS_PER_HZ / Clock::period::den;
+
+// a few ms of spinning, the counter against the steady clock
+#define CALIBRATION_NS 5000000LL
+
+void TickClock::calibrate() {
+#ifdef CHIP8_RDTSC
+    Clock::time_point start = Clock::now();
+    uint64_t start_ticks = now();
+    Clock::time_point end;
+    do {
+        end = Clock::now();
+    } while (std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() < CALIBRATION_NS);
+    uint64_t end_ticks = now();
+
+    _ns_per_tick = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)(end_ticks - start_ticks);
+#endif
+}
+
+// falling further behind than this (debugger, window drag) restarts the schedule instead of catching up
+#define MAX_FRAMES_BEHIND 4
+
+void FramePacer::start(long long period_ns) {
+    _period = std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(period_ns));
+    _oversleep = std::chrono::duration_cast<Clock::duration>(std::chrono::milliseconds(1));
+    _deadline = Clock::now() + _period;
+}
+
+long long FramePacer::wait() {
+    Clock::time_point now = Clock::now();
+    long long slack = std::chrono::duration_cast<std::chrono::nanoseconds>(_deadline - now).count();
+
+    if (now - _deadline > _period * MAX_FRAMES_BEHIND) {
+        _deadline = now + _period;
+        return slack;
+    }
+
+    // coarse sleep, keeping the expected oversleep in hand
+    Clock::duration remaining = _deadline - now;
+    if (remaining > _oversleep * 2) {
+        Clock::duration requested = remaining - _oversleep * 2;
+        std::this_thread::sleep_for(requested);
+
+        // track the oversleep (moving average, 1/8 weight per sample)
+        Clock::duration actual = Clock::now() - now;
+        Clock::duration over = (actual > requested) ? (actual - requested) : Clock::duration::zero();
+        _oversleep += (over - _oversleep) / 8;
+    }
+
+    // fine spin to the deadline
+    while (Clock::now() < _deadline) {
+    }
+
+    // the next deadline is relative to this one, not to when we woke up
+    _deadline += _period;
+    return slack;
 }
\ No newline at end of file
@@ -3,6 +3,15 @@
 #define _TIMER_H
 
 #include <chrono>
+#include <stdint.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CHIP8_RDTSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CHIP8_RDTSC
+#endif
 
 #define NANO_SECONDS_PER_HZ 1000000000LL
 
@@ -21,4 +30,43 @@ public:
     long long elapsed();
 };
 
+// time stamps for the probes that stay on in release builds (see Timeline.h):  the CPU's time stamp
+//  counter where there is one (one instruction, constant rate on anything recent), steady_clock
+//  ticks otherwise. calibrate() measures the counter against steady_clock once, before any conversion
+class TickClock {
+
+private:
+    static double _ns_per_tick;
+
+public:
+    static void calibrate();
+
+    static inline uint64_t now() {
+#ifdef CHIP8_RDTSC
+        return __rdtsc();
+#else
+        return (uint64_t)Clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // a tick count (a difference of two now()s) in nanoseconds
+    static long long nanoseconds(int64_t ticks) { return (long long)(ticks * _ns_per_tick); }
+};
+
+// paces a loop to a fixed period against absolute deadlines (no drift from late wake ups):
+//  sleeps for the bulk of the wait, then spins the last stretch since sleeps overshoot.
+//  The spin margin adapts to how much the OS actually oversleeps.
+class FramePacer {
+
+private:
+    Clock::time_point _deadline;
+    Clock::duration _period;
+    Clock::duration _oversleep;
+
+public:
+    void start(long long period_ns);
+    // the time that was left to the deadline when called (ns), negative when the frame ran late
+    long long wait();
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,508 @@
+#include <cstring>
+#include <algorithm>
+#include "stdio.h"
+#include "Common.h"
+#include "Trace.h"
+
+#ifdef CHIP8_SSE2
+#include <emmintrin.h>
+#endif
+
+// the SSSE3 byte shuffle packs a record's changed bytes without a loop, it is compiled in on every SSE2
+//  target and only taken when the processor has it (every x86-64 one since about 2008)
+#if defined(CHIP8_SSE2) && (defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__))
+#define TRACE_SSSE3
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TRACE_SSSE3_FUNCTION
+#else
+#define TRACE_SSSE3_FUNCTION __attribute__((target("ssse3")))
+#endif
+#endif
+
+static_assert(sizeof(trace_record) == 16, "trace records are 16 bytes on disk");
+
+// traces pass 4GB easily
+#ifdef _WIN32
+#define TRACE_SEEK(f, offset) _fseeki64((f), (long long)(offset), SEEK_SET)
+#define TRACE_SEEK_END(f, offset) _fseeki64((f), (long long)(offset), SEEK_END)
+#define TRACE_TELL(f) ((uint64)_ftelli64(f))
+#else
+#define TRACE_SEEK(f, offset) fseeko((f), (off_t)(offset), SEEK_SET)
+#define TRACE_SEEK_END(f, offset) fseeko((f), (off_t)(offset), SEEK_END)
+#define TRACE_TELL(f) ((uint64)ftello(f))
+#endif
+
+// worst case:  the mask and all 16 bytes of every record
+#define MAX_COMPRESSED_RECORD (2 + sizeof(trace_record))
+
+/**
+ * compression
+ *
+*/
+
+// the pc is the low 16 bits of the first word, advancing it by 2 predicts a fall through
+static inline uint64 predictNext(uint64 first_word)
+{
+	return (first_word & ~0xFFFFULL) | ((first_word + 2) & 0xFFFF);
+}
+
+#ifdef TRACE_SSSE3
+static bool hasSsse3()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+// for each 8 bit mask:  the shuffle that moves the masked bytes of a word to its front, and their count
+struct trace_packing {
+	uint8 shuffle[256][8];
+	uint8 count[256];
+
+	trace_packing() {
+		for (int mask = 0; mask < 256; ++mask) {
+			int packed = 0;
+			memset(shuffle[mask], 0x80, sizeof(shuffle[mask]));
+			for (int byte = 0; byte < 8; ++byte) {
+				if (mask & (1 << byte)) {
+					shuffle[mask][packed++] = (uint8)byte;
+				}
+			}
+			count[mask] = (uint8)packed;
+		}
+	}
+};
+
+// same output as the loops below:  each half of the difference is packed by one shuffle and stored whole,
+//  the next bytes overwrite what lies past its changed ones ('write' needs 16 bytes to spare)
+TRACE_SSSE3_FUNCTION
+static uint8 *compressSsse3(const trace_record *records, size_t count, uint8 *write)
+{
+	static const trace_packing packing;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i pc_mask = _mm_cvtsi32_si128(0xFFFF);
+	const __m128i pc_step = _mm_cvtsi32_si128(2);
+	const __m128i high_half = _mm_set_epi32(0x08080808, 0x08080808, 0, 0);
+	__m128i previous = zero;
+	for (size_t i = 0; i < count; ++i) {
+		__m128i now = _mm_loadu_si128((const __m128i *)&records[i]);
+		__m128i predicted = _mm_or_si128(_mm_andnot_si128(pc_mask, previous), _mm_and_si128(_mm_add_epi16(previous, pc_step), pc_mask));
+		__m128i difference = _mm_xor_si128(now, predicted);
+		previous = now;
+
+		unsigned int bits = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(difference, zero)) & 0xFFFF;
+		unsigned int low = bits & 0xFF;
+		unsigned int high = bits >> 8;
+		// the unused shuffle entries (0x80) stay negative with the high half's offset added, they give zeros
+		__m128i shuffle = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)packing.shuffle[low]),
+			_mm_loadl_epi64((const __m128i *)packing.shuffle[high]));
+		__m128i packed = _mm_shuffle_epi8(difference, _mm_add_epi8(shuffle, high_half));
+
+		write[0] = (uint8)low;
+		write[1] = (uint8)high;
+		write += 2;
+		_mm_storel_epi64((__m128i *)write, packed);
+		write += packing.count[low];
+		_mm_storel_epi64((__m128i *)write, _mm_srli_si128(packed, 8));
+		write += packing.count[high];
+	}
+	return write;
+}
+#endif
+
+size_t compressTrace(const trace_record *records, size_t count, std::vector<uint8> &out)
+{
+	if (count == 0) {
+		out.clear();
+		return 0;
+	}
+	// the SSSE3 packing stores whole halves, up to a record past the last byte
+	out.resize(count * MAX_COMPRESSED_RECORD + sizeof(trace_record));
+	uint8 *write = &out[0];
+
+#ifdef TRACE_SSSE3
+	static const bool ssse3 = hasSsse3();
+	if (ssse3) {
+		out.resize(compressSsse3(records, count, write) - &out[0]);
+		return out.size();
+	}
+#endif
+
+#ifdef CHIP8_SSE2
+	// the whole record in one register, the mask comes from a byte compare
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i pc_mask = _mm_cvtsi32_si128(0xFFFF);
+	const __m128i pc_step = _mm_cvtsi32_si128(2);
+	__m128i previous = zero;
+	for (size_t i = 0; i < count; ++i) {
+		__m128i now = _mm_loadu_si128((const __m128i *)&records[i]);
+		__m128i predicted = _mm_or_si128(_mm_andnot_si128(pc_mask, previous), _mm_and_si128(_mm_add_epi16(previous, pc_step), pc_mask));
+		__m128i difference = _mm_xor_si128(now, predicted);
+		previous = now;
+
+		unsigned int bits = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(difference, zero)) & 0xFFFF;
+		uint8 bytes[16];
+		_mm_storeu_si128((__m128i *)bytes, difference);
+		write[0] = (uint8)bits;
+		write[1] = (uint8)(bits >> 8);
+		write += 2;
+		while (bits != 0) {
+			*write++ = bytes[COUNT_TRAILING_ZEROS_64(bits)];
+			bits &= bits - 1;
+		}
+	}
+#else
+	// the record as two words, only the bytes that differ from the prediction are visited (lowest first)
+	uint64 previous[2] = { 0, 0 };
+	for (size_t i = 0; i < count; ++i) {
+		uint64 now[2];
+		memcpy(now, &records[i], sizeof(now));
+		uint64 difference[2] = { now[0] ^ predictNext(previous[0]), now[1] ^ previous[1] };
+		previous[0] = now[0];
+		previous[1] = now[1];
+
+		uint8 *mask = write;
+		write += 2;
+		uint16 bits = 0;
+		for (int word = 0; word < 2; ++word) {
+			uint64 remaining = difference[word];
+			while (remaining != 0) {
+				int byte = COUNT_TRAILING_ZEROS_64(remaining) >> 3;
+				bits |= (uint16)(1 << (word * 8 + byte));
+				*write++ = (uint8)(remaining >> (byte * 8));
+				remaining &= ~(0xFFULL << (byte * 8));
+			}
+		}
+		mask[0] = (uint8)bits;
+		mask[1] = (uint8)(bits >> 8);
+	}
+#endif
+
+	out.resize(write - &out[0]);
+	return out.size();
+}
+
+bool decompressTrace(const uint8 *in, size_t length, size_t count, trace_record *records)
+{
+	const uint8 *end = in + length;
+
+	uint64 previous[2] = { 0, 0 };
+	for (size_t i = 0; i < count; ++i) {
+		if (end - in < 2) {
+			return false;
+		}
+		uint16 bits = (uint16)(in[0] | in[1] << 8);
+		in += 2;
+
+		uint64 now[2] = { predictNext(previous[0]), previous[1] };
+		for (int word = 0; word < 2; ++word) {
+			uint8 word_bits = (uint8)(bits >> (word * 8));
+			while (word_bits != 0) {
+				if (in == end) {
+					return false;
+				}
+				int byte = COUNT_TRAILING_ZEROS_64(word_bits);
+				now[word] ^= (uint64)*in++ << (byte * 8);
+				word_bits &= (uint8)(word_bits - 1);
+			}
+		}
+		memcpy(&records[i], now, sizeof(now));
+		previous[0] = now[0];
+		previous[1] = now[1];
+	}
+	return in == end;
+}
+
+/**
+ * trace_recorder
+ *
+*/
+
+trace_recorder::trace_recorder()
+	: file(NULL), current(new chunk()), submitted(0), stopping(false), written(0)
+{
+	current->count = 0;
+	cursor = current->records;
+	limit = current->records + CHUNK_RECORDS;
+}
+
+trace_recorder::~trace_recorder()
+{
+	close();
+
+	chunk *buffer;
+	while (spare.pop(buffer)) {
+		delete buffer;
+	}
+	delete current;
+}
+
+bool trace_recorder::open(const char *path)
+{
+	close();
+
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+
+	trace_file_header header = { TRACE_MAGIC, TRACE_VERSION, (uint32_t)sizeof(trace_record), (uint32_t)CHUNK_RECORDS };
+	fwrite(&header, sizeof(header), 1, file);
+
+	current->count = 0;
+	cursor = current->records;
+	submitted = 0;
+	written = 0;
+	index.clear();
+	stopping = false;
+	writer = std::thread(&trace_recorder::run, this);
+	return true;
+}
+
+void trace_recorder::close()
+{
+	if (file == NULL) {
+		return;
+	}
+
+	if (cursor != current->records) {
+		submit();
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+
+	// index + footer, a reader seeks through these instead of walking every chunk
+	trace_file_footer footer;
+	footer.index_offset = TRACE_TELL(file);
+	footer.chunks = index.size();
+	footer.records = written;
+	footer.magic = TRACE_INDEX_MAGIC;
+	footer.reserved = 0;
+	if (!index.empty()) {
+		fwrite(&index[0], sizeof(trace_index_entry), index.size(), file);
+	}
+	fwrite(&footer, sizeof(footer), 1, file);
+
+	fclose(file);
+	file = NULL;
+}
+
+// hands the current chunk to the writer and continues in a spare one
+void trace_recorder::submit()
+{
+	current->count = cursor - current->records;
+	submitted += current->count;
+	while (!full.push(current)) {
+		// the writer is a whole queue behind, let it catch up
+		wake.notify_one();
+		std::this_thread::yield();
+	}
+	wake.notify_one();
+
+	if (!spare.pop(current)) {
+		current = new chunk();
+	}
+	current->count = 0;
+	cursor = current->records;
+	limit = current->records + CHUNK_RECORDS;
+}
+
+void trace_recorder::run()
+{
+	for (;;) {
+		chunk *next;
+		if (full.pop(next)) {
+			writeChunk(*next);
+			if (!spare.push(next)) {
+				delete next;
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(lock);
+		if (stopping && full.empty()) {
+			break;
+		}
+		wake.wait_for(guard, std::chrono::milliseconds(10));
+	}
+	fflush(file);
+}
+
+void trace_recorder::writeChunk(const chunk &full_chunk)
+{
+	compressTrace(full_chunk.records, full_chunk.count, compressed);
+
+	trace_index_entry entry = { written, TRACE_TELL(file) };
+	index.push_back(entry);
+
+	trace_chunk_header header;
+	header.magic = TRACE_CHUNK_MAGIC;
+	header.records = (uint32_t)full_chunk.count;
+	header.bytes = (uint32_t)compressed.size();
+	header.reserved = 0;
+	header.first_record = written;
+	fwrite(&header, sizeof(header), 1, file);
+	if (!compressed.empty()) {
+		fwrite(&compressed[0], 1, compressed.size(), file);
+	}
+	written += full_chunk.count;
+}
+
+/**
+ * trace_reader
+ *
+*/
+
+trace_reader::trace_reader()
+	: file(NULL), total(0)
+{
+}
+
+trace_reader::~trace_reader()
+{
+	close();
+}
+
+bool trace_reader::open(const char *path)
+{
+	close();
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+
+	trace_file_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC ||
+		header.version != TRACE_VERSION || header.record_size != sizeof(trace_record)) {
+		close();
+		return false;
+	}
+
+	if (!readIndex() && !scanChunks()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void trace_reader::close()
+{
+	if (file != NULL) {
+		fclose(file);
+		file = NULL;
+	}
+	index.clear();
+	total = 0;
+}
+
+bool trace_reader::readIndex()
+{
+	trace_file_footer footer;
+	if (TRACE_SEEK_END(file, -(long long)sizeof(footer)) != 0 ||
+		fread(&footer, sizeof(footer), 1, file) != 1 || footer.magic != TRACE_INDEX_MAGIC) {
+		return false;
+	}
+
+	index.resize((size_t)footer.chunks);
+	if (TRACE_SEEK(file, footer.index_offset) != 0 ||
+		(!index.empty() && fread(&index[0], sizeof(trace_index_entry), index.size(), file) != index.size())) {
+		index.clear();
+		return false;
+	}
+	total = footer.records;
+	return true;
+}
+
+// no index (the recording never finished):  walk the chunk headers up to the first incomplete one
+bool trace_reader::scanChunks()
+{
+	index.clear();
+	total = 0;
+
+	uint64 offset = sizeof(trace_file_header);
+	trace_chunk_header header;
+	while (TRACE_SEEK(file, offset) == 0 && fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == TRACE_CHUNK_MAGIC && header.first_record == total) {
+		uint64 next = offset + sizeof(header) + header.bytes;
+		if (TRACE_SEEK(file, next - 1) != 0 || fgetc(file) == EOF) {
+			break;
+		}
+
+		trace_index_entry entry = { total, offset };
+		index.push_back(entry);
+		total += header.records;
+		offset = next;
+	}
+	return true;
+}
+
+size_t trace_reader::chunkOf(uint64 record) const
+{
+	// the last chunk starting at or before 'record'
+	size_t low = 0;
+	size_t high = index.size();
+	while (high - low > 1) {
+		size_t middle = (low + high) / 2;
+		if (index[middle].first_record <= record) {
+			low = middle;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+bool trace_reader::readCompressed(size_t chunk, std::vector<uint8> &bytes)
+{
+	trace_chunk_header header;
+	if (chunk >= index.size() || TRACE_SEEK(file, index[chunk].offset) != 0 ||
+		fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_CHUNK_MAGIC) {
+		return false;
+	}
+
+	bytes.resize(header.bytes);
+	return header.bytes == 0 || fread(&bytes[0], 1, header.bytes, file) == header.bytes;
+}
+
+bool trace_reader::readChunk(size_t chunk, std::vector<trace_record> &records)
+{
+	std::vector<uint8> bytes;
+	if (!readCompressed(chunk, bytes)) {
+		return false;
+	}
+
+	uint64 end = (chunk + 1 < index.size()) ? index[chunk + 1].first_record : total;
+	records.resize((size_t)(end - index[chunk].first_record));
+	return records.empty() || decompressTrace(bytes.empty() ? NULL : &bytes[0], bytes.size(), records.size(), &records[0]);
+}
+
+bool trace_reader::read(uint64 first, size_t count, std::vector<trace_record> &records)
+{
+	records.clear();
+	if (first >= total) {
+		return true;
+	}
+
+	std::vector<trace_record> decoded;
+	for (size_t chunk = chunkOf(first); chunk < index.size() && records.size() < count; ++chunk) {
+		if (!readChunk(chunk, decoded)) {
+			return false;
+		}
+		size_t skip = (size_t)(std::max(first, index[chunk].first_record) - index[chunk].first_record);
+		size_t take = std::min(decoded.size() - skip, count - records.size());
+		records.insert(records.end(), decoded.begin() + skip, decoded.begin() + skip + take);
+	}
+	return true;
+}
@@ -0,0 +1,180 @@
+#pragma once
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Common.h"
+#include "SpscQueue.h"
+
+/**
+ * Execution trace - one fixed size record per executed instruction.
+ *
+ * While a trace is open chip8::emulateCycles runs the traced loop of the engine (idle loops aren't
+ *  fast-forwarded, no superinstructions):  the interpreter records around each emulateCycle, the threaded
+ *  engine's handlers build the record from what they already know (destination register, I, bytes
+ *  written). The JIT has no traced form, its traced runs take the threaded engine. Records go straight
+ *  into the recorder's current chunk, full chunks go to a writer thread which compresses them and appends
+ *  them to the file, the emulation only waits when the writer is a whole queue of chunks behind.
+ *
+ * File (little endian):
+ *      trace_file_header
+ *      chunks:  trace_chunk_header + compressed records, every chunk decodes on its own
+ *      index:   trace_index_entry per chunk, then trace_file_footer
+ *  A trace cut short (crash, kill) has no index, trace_reader then walks the chunk headers instead.
+ *
+ * Compression: each record is XORed with the previous one (with its pc advanced by 2), what is left
+ *  is stored as a 16 bit mask of the non-zero bytes followed by those bytes - 4 to 6 bytes for the
+ *  usual instruction instead of 16.
+*/
+
+enum trace_flags {
+	TRACE_FAULT = 0x01,         // the instruction faulted
+	TRACE_WRAPPED = 0x02        // the memory write wrapped around the end of memory
+};
+
+struct trace_record {
+	uint16 pc;
+	uint16 opcode;              // raw instruction word
+	uint16 I;                   // after the instruction
+	uint16 changed;             // bit n set = V[n] changed
+	uint16 write_address;       // first byte written (write_length != 0)
+	uint8 write_length;         // bytes written to memory
+	uint8 value;                // new value of the lowest changed register
+	uint8 vf;                   // VF after the instruction
+	uint8 sp;
+	uint8 delay_timer;
+	uint8 flags;                // trace_flags
+};
+
+#define TRACE_MAGIC 0x52543843          // "C8TR"
+#define TRACE_CHUNK_MAGIC 0x43543843    // "C8TC"
+#define TRACE_INDEX_MAGIC 0x49543843    // "C8TI"
+#define TRACE_VERSION 1
+
+struct trace_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t chunk_records;
+};
+
+struct trace_chunk_header {
+	uint32_t magic;
+	uint32_t records;
+	uint32_t bytes;             // compressed size following the header
+	uint32_t reserved;
+	uint64 first_record;
+};
+
+struct trace_index_entry {
+	uint64 first_record;
+	uint64 offset;              // of the chunk header
+};
+
+struct trace_file_footer {
+	uint64 index_offset;
+	uint64 chunks;
+	uint64 records;
+	uint32_t magic;
+	uint32_t reserved;
+};
+
+class trace_recorder {
+public:
+	static const size_t CHUNK_RECORDS = 65536;
+
+	trace_recorder();
+	~trace_recorder();
+
+	bool open(const char *path);
+	// writes the last chunk and the index
+	void close();
+
+	// the record as its two little endian words (pc is the low 16 bits of 'low', see trace_record)
+	inline void record(uint64 low, uint64 high) {
+		memcpy(cursor, &low, sizeof(low));
+		memcpy((uint8 *)cursor + sizeof(low), &high, sizeof(high));
+		if (++cursor == limit) {
+			submit();
+		}
+	}
+
+	uint64 recorded() const { return submitted + (cursor - current->records); }
+
+private:
+	trace_recorder(const trace_recorder &);
+	trace_recorder &operator=(const trace_recorder &);
+
+	struct chunk {
+		trace_record records[CHUNK_RECORDS];
+		size_t count;
+	};
+
+	void submit();
+	void run();
+	void writeChunk(const chunk &full);
+
+	FILE *file;
+	chunk *current;
+	// the current chunk's next free record and its end, 'count' is only filled in at submit
+	trace_record *cursor;
+	trace_record *limit;
+	uint64 submitted;
+
+	// chunks travel emulation -> writer through 'full' and come back through 'spare'
+	SpscQueue<chunk *, 16> full;
+	SpscQueue<chunk *, 32> spare;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::atomic<bool> stopping;
+	std::thread writer;
+
+	// writer thread only
+	std::vector<uint8> compressed;
+	std::vector<trace_index_entry> index;
+	uint64 written;
+};
+
+class trace_reader {
+public:
+	trace_reader();
+	~trace_reader();
+
+	bool open(const char *path);
+	void close();
+
+	uint64 records() const { return total; }
+	size_t chunks() const { return index.size(); }
+	uint64 chunkStart(size_t chunk) const { return index[chunk].first_record; }
+	size_t chunkOf(uint64 record) const;
+
+	// the chunk as stored, equal bytes = equal records
+	bool readCompressed(size_t chunk, std::vector<uint8> &bytes);
+	bool readChunk(size_t chunk, std::vector<trace_record> &records);
+
+	// up to 'count' records from 'first' on
+	bool read(uint64 first, size_t count, std::vector<trace_record> &records);
+
+private:
+	trace_reader(const trace_reader &);
+	trace_reader &operator=(const trace_reader &);
+
+	bool readIndex();
+	bool scanChunks();
+
+	FILE *file;
+	std::vector<trace_index_entry> index;
+	uint64 total;
+};
+
+size_t compressTrace(const trace_record *records, size_t count, std::vector<uint8> &out);
+bool decompressTrace(const uint8 *in, size_t length, size_t count, trace_record *records);
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+#ifndef _TRIPLE_BUFFER_H
+#define _TRIPLE_BUFFER_H
+
+#include <atomic>
+#include "Common.h"
+
+// lock-free single producer / single consumer triple buffer
+//  the producer always has a buffer to write into and the consumer always reads the newest
+//  complete one, neither side ever waits on the other. Frames the consumer was too slow for are dropped.
+template <typename T>
+class TripleBuffer {
+
+private:
+    static const uint8 INDEX_MASK = 0x3;
+    static const uint8 FRESH = 0x4;     // set on 'middle' when it holds a buffer the consumer hasn't seen
+
+    T _buffers[3];
+    std::atomic<uint8> _middle;
+    uint8 _back;    // producer owned
+    uint8 _front;   // consumer owned
+
+public:
+    TripleBuffer() : _middle(1), _back(0), _front(2) {}
+
+    // producer:  fill writeBuffer(), then publish() it
+    T &writeBuffer() {
+        return _buffers[_back];
+    }
+
+    void publish() {
+        _back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // consumer:  update() swaps in the newest published buffer, returns false if nothing new
+    bool update() {
+        if ((_middle.load(std::memory_order_acquire) & FRESH) == 0) {
+            return false;
+        }
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const T &readBuffer() const {
+        return _buffers[_front];
+    }
+};
+
+#endif
@@ -0,0 +1,436 @@
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+#include "Common.h"
+#include "Video.h"
+
+#ifdef CHIP8_SSE2
+#include <emmintrin.h>
+#endif
+
+/**
+ * palettes
+ *
+*/
+
+struct named_palette {
+	const char *name;
+	video_palette palette;
+};
+
+// background, plane 0, plane 1, both.  mono matches the old GL colours
+static const named_palette palettes[] = {
+	{ "mono",  { { VIDEO_RGB(0x00, 0x00, 0x00), VIDEO_RGB(0xFF, 0xFF, 0xFF), VIDEO_RGB(0x55, 0x55, 0x55), VIDEO_RGB(0xAA, 0xAA, 0xAA) } } },
+	{ "amber", { { VIDEO_RGB(0x00, 0x00, 0x00), VIDEO_RGB(0xFF, 0xB0, 0x00), VIDEO_RGB(0x80, 0x58, 0x00), VIDEO_RGB(0xC0, 0x84, 0x00) } } },
+	{ "green", { { VIDEO_RGB(0x00, 0x00, 0x00), VIDEO_RGB(0x33, 0xFF, 0x33), VIDEO_RGB(0x1A, 0x80, 0x1A), VIDEO_RGB(0x26, 0xC0, 0x26) } } },
+	{ "octo",  { { VIDEO_RGB(0x99, 0x66, 0x00), VIDEO_RGB(0xFF, 0xCC, 0x00), VIDEO_RGB(0xFF, 0x66, 0x00), VIDEO_RGB(0x66, 0x22, 0x00) } } }
+};
+
+bool frame_scaler::parsePalette(const char *name, video_palette &palette)
+{
+	for (size_t i = 0; i < sizeof(palettes) / sizeof(palettes[0]); ++i) {
+		if (strcmp(name, palettes[i].name) == 0) {
+			palette = palettes[i].palette;
+			return true;
+		}
+	}
+
+	// RRGGBB,RRGGBB,RRGGBB,RRGGBB
+	const char *next = name;
+	for (int colour = 0; colour < 4; ++colour) {
+		for (int digit = 0; digit < 6; ++digit) {
+			if (!isxdigit((unsigned char)next[digit])) {
+				return false;
+			}
+		}
+		uint32_t rgb = (uint32_t)strtoul(std::string(next, 6).c_str(), NULL, 16);
+		palette.colours[colour] = VIDEO_RGB(rgb >> 16, (rgb >> 8) & 0xFF, rgb & 0xFF);
+		next += 6;
+		if (*next != ((colour == 3) ? '\0' : ',')) {
+			return false;
+		}
+		++next;
+	}
+	return true;
+}
+
+/**
+ * frame_scaler
+ *
+*/
+
+frame_scaler::frame_scaler()
+	: scale(0), decay(0), canvas(NULL), shown_hires(false), valid(false), fading(false)
+{
+	palette = palettes[0].palette;
+	memset(glow, 0, sizeof(glow));
+	setScale(1);
+}
+
+frame_scaler::~frame_scaler()
+{
+	delete[] canvas;
+}
+
+void frame_scaler::setScale(int new_scale)
+{
+	new_scale = std::max(1, std::min(new_scale, (int)MAX_SCALE));
+	if (new_scale == scale) {
+		return;
+	}
+	scale = new_scale;
+	delete[] canvas;
+	canvas = new uint32_t[(size_t)width() * height()];
+	valid = false;
+}
+
+void frame_scaler::setPalette(const video_palette &new_palette)
+{
+	palette = new_palette;
+	valid = false;
+}
+
+void frame_scaler::setPersistence(int new_decay)
+{
+	decay = std::max(0, std::min(new_decay, 255));
+	valid = false;
+}
+
+const uint32_t *frame_scaler::render(const gfx_plane gfx[GFX_PLANES], bool hires)
+{
+	if (valid && !fading && hires == shown_hires && memcmp(gfx, shown, sizeof(shown)) == 0) {
+		return canvas;
+	}
+
+	// the phosphor works on unscaled pixels, a mode switch starts it over
+	if (hires != shown_hires) {
+		memset(glow, 0, sizeof(glow));
+	}
+	memcpy(shown, gfx, sizeof(shown));
+	shown_hires = hires;
+	valid = true;
+	fading = false;
+
+	int source_width = hires ? GFX_WIDTH : GFX_LORES_WIDTH;
+	int source_height = hires ? GFX_HEIGHT : GFX_LORES_HEIGHT;
+	int factor = hires ? scale : scale * 2;
+	int stride = width();
+
+	uint32_t *out = canvas;
+	for (int y = 0; y < source_height; ++y) {
+		expandRow(gfx[0][y], gfx[1][y], source_width, row);
+		if (decay != 0) {
+			fading |= fadeRow(row, glow[y], source_width);
+		}
+
+		scaleRow(row, source_width, factor, out);
+		for (int copy = 1; copy < factor; ++copy) {
+			memcpy(out + copy * stride, out, stride * sizeof(uint32_t));
+		}
+		out += factor * stride;
+	}
+	return canvas;
+}
+
+// one palette colour per pixel from the two planes' bits
+void frame_scaler::expandRow(const uint64 *first, const uint64 *second, int width, uint32_t *out) const
+{
+#ifdef CHIP8_SSE2
+	const __m128i bit_mask = _mm_setr_epi8(
+		(char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m128i colour0 = _mm_set1_epi32((int)palette.colours[0]);
+	const __m128i colour1 = _mm_set1_epi32((int)palette.colours[1]);
+	const __m128i colour2 = _mm_set1_epi32((int)palette.colours[2]);
+	const __m128i colour3 = _mm_set1_epi32((int)palette.colours[3]);
+
+	for (int x = 0; x < width; x += 16) {
+		// 16 pixels, the leftmost is the most significant bit:  one 0x00 / 0xFF byte per pixel and plane
+		int shift = 48 - (x & 63);
+		uint64 bits0 = (first[x >> 6] >> shift) & 0xFFFF;
+		uint64 bits1 = (second[x >> 6] >> shift) & 0xFFFF;
+		__m128i spread0 = _mm_set_epi64x((long long)((bits0 & 0xFF) * 0x0101010101010101ULL), (long long)((bits0 >> 8) * 0x0101010101010101ULL));
+		__m128i spread1 = _mm_set_epi64x((long long)((bits1 & 0xFF) * 0x0101010101010101ULL), (long long)((bits1 >> 8) * 0x0101010101010101ULL));
+		__m128i lit0 = _mm_cmpeq_epi8(_mm_and_si128(spread0, bit_mask), bit_mask);
+		__m128i lit1 = _mm_cmpeq_epi8(_mm_and_si128(spread1, bit_mask), bit_mask);
+
+		// widen the byte masks to one dword per pixel, 4 pixels per store
+		__m128i words0[2] = { _mm_unpacklo_epi8(lit0, lit0), _mm_unpackhi_epi8(lit0, lit0) };
+		__m128i words1[2] = { _mm_unpacklo_epi8(lit1, lit1), _mm_unpackhi_epi8(lit1, lit1) };
+		for (int quad = 0; quad < 4; ++quad) {
+			__m128i mask0 = (quad & 1) ? _mm_unpackhi_epi16(words0[quad >> 1], words0[quad >> 1]) : _mm_unpacklo_epi16(words0[quad >> 1], words0[quad >> 1]);
+			__m128i mask1 = (quad & 1) ? _mm_unpackhi_epi16(words1[quad >> 1], words1[quad >> 1]) : _mm_unpacklo_epi16(words1[quad >> 1], words1[quad >> 1]);
+
+			__m128i without1 = _mm_or_si128(_mm_and_si128(mask0, colour1), _mm_andnot_si128(mask0, colour0));
+			__m128i with1 = _mm_or_si128(_mm_and_si128(mask0, colour3), _mm_andnot_si128(mask0, colour2));
+			_mm_storeu_si128((__m128i *)(out + x + quad * 4), _mm_or_si128(_mm_and_si128(mask1, with1), _mm_andnot_si128(mask1, without1)));
+		}
+	}
+#else
+	for (int x = 0; x < width; ++x) {
+		int shift = 63 - (x & 63);
+		int value = (int)((first[x >> 6] >> shift) & 0x1) | (int)((second[x >> 6] >> shift) & 0x1) << 1;
+		out[x] = palette.colours[value];
+	}
+#endif
+}
+
+// keeps the brighter of the new colour and the faded old one (per channel), true while anything still fades
+bool frame_scaler::fadeRow(uint32_t *pixels, uint32_t *previous, int width) const
+{
+	bool changing = false;
+#ifdef CHIP8_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i keep = _mm_set1_epi16((short)decay);
+	for (int x = 0; x < width; x += 4) {
+		__m128i target = _mm_loadu_si128((const __m128i *)(pixels + x));
+		__m128i old = _mm_loadu_si128((const __m128i *)(previous + x));
+		__m128i low = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(old, zero), keep), 8);
+		__m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(old, zero), keep), 8);
+		__m128i now = _mm_max_epu8(_mm_packus_epi16(low, high), target);
+		changing |= (_mm_movemask_epi8(_mm_cmpeq_epi8(now, target)) != 0xFFFF);
+		_mm_storeu_si128((__m128i *)(previous + x), now);
+		_mm_storeu_si128((__m128i *)(pixels + x), now);
+	}
+#else
+	for (int x = 0; x < width; ++x) {
+		uint32_t now = 0;
+		for (int channel = 0; channel < 32; channel += 8) {
+			uint32_t faded = (((previous[x] >> channel) & 0xFF) * decay) >> 8;
+			now |= std::max(faded, (pixels[x] >> channel) & 0xFF) << channel;
+		}
+		changing |= (now != pixels[x]);
+		previous[x] = now;
+		pixels[x] = now;
+	}
+#endif
+	return changing;
+}
+
+// every pixel 'factor' times
+void frame_scaler::scaleRow(const uint32_t *pixels, int width, int factor, uint32_t *out) const
+{
+	if (factor == 1) {
+		memcpy(out, pixels, width * sizeof(uint32_t));
+		return;
+	}
+
+#ifdef CHIP8_SSE2
+	if (factor == 2) {
+		for (int x = 0; x < width; x += 4) {
+			__m128i four = _mm_loadu_si128((const __m128i *)(pixels + x));
+			_mm_storeu_si128((__m128i *)(out + x * 2), _mm_unpacklo_epi32(four, four));
+			_mm_storeu_si128((__m128i *)(out + x * 2 + 4), _mm_unpackhi_epi32(four, four));
+		}
+		return;
+	}
+	if ((factor & 3) == 0) {
+		for (int x = 0; x < width; ++x) {
+			__m128i pixel = _mm_set1_epi32((int)pixels[x]);
+			for (int i = 0; i < factor; i += 4) {
+				_mm_storeu_si128((__m128i *)(out + i), pixel);
+			}
+			out += factor;
+		}
+		return;
+	}
+#endif
+
+	for (int x = 0; x < width; ++x) {
+		std::fill(out, out + factor, pixels[x]);
+		out += factor;
+	}
+}
+
+/**
+ * y4m_sink
+ *
+*/
+
+y4m_sink::y4m_sink()
+	: file(NULL), frame_width(0), frame_height(0), planes(NULL)
+{
+}
+
+y4m_sink::~y4m_sink()
+{
+	close();
+}
+
+bool y4m_sink::open(const char *path, int width, int height)
+{
+	close();
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+
+	frame_width = width;
+	frame_height = height;
+	planes = new uint8[(size_t)width * height * 3];
+	fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, SCREEN_REFRESH_RATE);
+	return true;
+}
+
+bool y4m_sink::write(const uint32_t *rgba, int width, int height)
+{
+	if (file == NULL || width != frame_width || height != frame_height) {
+		return false;
+	}
+
+	// BT.601 studio range.  A scaled frame repeats every row and is mostly runs of a few colours, so a row
+	//  equal to the one above is copied and each run is converted once
+	size_t count = (size_t)width * height;
+	uint8 *y_plane = planes;
+	uint8 *u_plane = planes + count;
+	uint8 *v_plane = planes + count * 2;
+	uint32_t last = ~rgba[0];
+	uint8 y = 0, u = 0, v = 0;
+	for (size_t start = 0; start < count; start += width) {
+		if (start != 0 && memcmp(rgba + start, rgba + start - width, width * sizeof(uint32_t)) == 0) {
+			memcpy(y_plane + start, y_plane + start - width, width);
+			memcpy(u_plane + start, u_plane + start - width, width);
+			memcpy(v_plane + start, v_plane + start - width, width);
+			continue;
+		}
+		for (size_t i = start; i < start + width; ++i) {
+			if (rgba[i] != last) {
+				last = rgba[i];
+				int r = last & 0xFF;
+				int g = (last >> 8) & 0xFF;
+				int b = (last >> 16) & 0xFF;
+				y = (uint8)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				u = (uint8)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				v = (uint8)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+			y_plane[i] = y;
+			u_plane[i] = u;
+			v_plane[i] = v;
+		}
+	}
+
+	return fwrite("FRAME\n", 1, 6, file) == 6 && fwrite(planes, 1, count * 3, file) == count * 3;
+}
+
+void y4m_sink::close()
+{
+	if (file != NULL) {
+		fclose(file);
+		file = NULL;
+	}
+	delete[] planes;
+	planes = NULL;
+}
+
+/**
+ * ppm_sink
+ *
+*/
+
+// a path with one %d (with optional 0 and width) is a per frame file name, anything else is taken literally
+static bool isFramePattern(const std::string &path)
+{
+	size_t percent = path.find('%');
+	if (percent == std::string::npos) {
+		return false;
+	}
+	size_t end = percent + 1;
+	while (end < path.size() && isdigit((unsigned char)path[end])) {
+		++end;
+	}
+	return end < path.size() && path[end] == 'd' && path.find('%', end) == std::string::npos;
+}
+
+ppm_sink::ppm_sink()
+	: numbered(false), file(NULL), frames(0), bytes(NULL), capacity(0)
+{
+}
+
+ppm_sink::~ppm_sink()
+{
+	close();
+}
+
+bool ppm_sink::open(const char *path)
+{
+	close();
+	pattern = path;
+	numbered = isFramePattern(pattern);
+	frames = 0;
+
+	// a sequence creates its files as it goes, try the first one now
+	char name[1024];
+	if (numbered) {
+		snprintf(name, sizeof(name), pattern.c_str(), 0);
+		path = name;
+	}
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+	return true;
+}
+
+bool ppm_sink::write(const uint32_t *rgba, int width, int height)
+{
+	if (numbered && frames != 0) {
+		char name[1024];
+		snprintf(name, sizeof(name), pattern.c_str(), frames);
+		file = fopen(name, "wb");
+	}
+	if (file == NULL) {
+		return false;
+	}
+
+	size_t count = (size_t)width * height;
+	if (count * 3 > capacity) {
+		delete[] bytes;
+		capacity = count * 3;
+		bytes = new uint8[capacity];
+	}
+	for (size_t i = 0; i < count; ++i) {
+		bytes[i * 3] = (uint8)rgba[i];
+		bytes[i * 3 + 1] = (uint8)(rgba[i] >> 8);
+		bytes[i * 3 + 2] = (uint8)(rgba[i] >> 16);
+	}
+
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	bool written = fwrite(bytes, 1, count * 3, file) == count * 3;
+	++frames;
+	if (numbered) {
+		fclose(file);
+		file = NULL;
+	}
+	return written;
+}
+
+void ppm_sink::close()
+{
+	if (file != NULL) {
+		fclose(file);
+		file = NULL;
+	}
+	delete[] bytes;
+	bytes = NULL;
+	capacity = 0;
+}
+
+video_sink *openVideo(const char *path, int width, int height)
+{
+	size_t length = strlen(path);
+	if (length > 4 && strcmp(path + length - 4, ".y4m") == 0) {
+		y4m_sink *y4m = new y4m_sink();
+		if (!y4m->open(path, width, height)) {
+			delete y4m;
+			return NULL;
+		}
+		return y4m;
+	}
+
+	ppm_sink *ppm = new ppm_sink();
+	if (!ppm->open(path)) {
+		delete ppm;
+		return NULL;
+	}
+	return ppm;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#ifndef _VIDEO_H
+#define _VIDEO_H
+
+#include <stdio.h>
+#include <string>
+#include "Common.h"
+#include "Chip8.h"
+
+/**
+ * Video - the packed framebuffer as RGBA pixels, without a GPU.
+ *
+ * frame_scaler expands both planes of a frame into a reusable RGBA buffer (R in the first byte) at an
+ *  integer scale. The canvas is always GFX_WIDTH x GFX_HEIGHT hi-res pixels times the scale, a lo-res
+ *  pixel covers 2x2 of them, so a recording keeps its size across 00FE / 00FF.
+ *
+ *  Each row goes through three steps:
+ *      expand      16 pixels at a time (SSE2), the two plane bits select one of the 4 palette colours
+ *      phosphor    optional, a pixel that went dark keeps 'decay' / 256 of its colour every frame
+ *      scale       every pixel repeated 'scale' times, then the row copied 'scale - 1' times
+ *  A frame equal to the last one (and with nothing still fading) isn't rendered again.
+ *
+ * video_sink takes the rendered frames:
+ *      y4m_sink    YUV4MPEG2 4:4:4 at 60fps, one file (ffmpeg / mpv read it as is)
+ *      ppm_sink    binary PPM, one file per frame when the path has a printf number (frames/%05d.ppm),
+ *                  otherwise every frame appended to one file
+*/
+
+// memory order R, G, B, A on a little endian host
+#define VIDEO_RGB(r, g, b) ((uint32_t)(r) | (uint32_t)(g) << 8 | (uint32_t)(b) << 16 | 0xFF000000u)
+
+// colour per pixel value: plane 0 bit | plane 1 bit << 1
+struct video_palette {
+	uint32_t colours[4];
+};
+
+class frame_scaler {
+public:
+	static const int MAX_SCALE = 16;
+
+	frame_scaler();
+	~frame_scaler();
+
+	void setScale(int scale);
+	void setPalette(const video_palette &palette);
+	// what a dark pixel keeps of its colour every frame in 1/256ths, 0 = no persistence
+	void setPersistence(int decay);
+
+	// the frame in pixels(), width() x height(), rows top down
+	const uint32_t *render(const gfx_plane gfx[GFX_PLANES], bool hires);
+
+	const uint32_t *pixels() const { return canvas; }
+	int width() const { return GFX_WIDTH * scale; }
+	int height() const { return GFX_HEIGHT * scale; }
+	// the phosphor hasn't settled, rendering the same frame again gives a different picture
+	bool isFading() const { return fading; }
+
+	// mono, amber, green, octo or four RRGGBB colours separated by commas
+	static bool parsePalette(const char *name, video_palette &palette);
+
+private:
+	frame_scaler(const frame_scaler &);
+	frame_scaler &operator=(const frame_scaler &);
+
+	void expandRow(const uint64 *first, const uint64 *second, int width, uint32_t *out) const;
+	bool fadeRow(uint32_t *row, uint32_t *glow, int width) const;
+	void scaleRow(const uint32_t *row, int width, int factor, uint32_t *out) const;
+
+	int scale;
+	int decay;
+	video_palette palette;
+	uint32_t *canvas;
+
+	// what the canvas shows
+	gfx_plane shown[GFX_PLANES];
+	bool shown_hires;
+	bool valid;
+	bool fading;
+
+	// unscaled rows:  the frame being built and the phosphor's current colours
+	uint32_t row[GFX_WIDTH];
+	uint32_t glow[GFX_HEIGHT][GFX_WIDTH];
+};
+
+class video_sink {
+public:
+	virtual ~video_sink() {}
+
+	virtual bool write(const uint32_t *rgba, int width, int height) = 0;
+	virtual void close() {}
+};
+
+class y4m_sink : public video_sink {
+public:
+	y4m_sink();
+	~y4m_sink();
+
+	bool open(const char *path, int width, int height);
+	bool write(const uint32_t *rgba, int width, int height);
+	void close();
+
+private:
+	y4m_sink(const y4m_sink &);
+	y4m_sink &operator=(const y4m_sink &);
+
+	FILE *file;
+	int frame_width;
+	int frame_height;
+	uint8 *planes;
+};
+
+class ppm_sink : public video_sink {
+public:
+	ppm_sink();
+	~ppm_sink();
+
+	bool open(const char *path);
+	bool write(const uint32_t *rgba, int width, int height);
+	void close();
+
+private:
+	ppm_sink(const ppm_sink &);
+	ppm_sink &operator=(const ppm_sink &);
+
+	std::string pattern;
+	bool numbered;
+	FILE *file;
+	int frames;
+	uint8 *bytes;
+	size_t capacity;
+};
+
+// y4m_sink for a .y4m path, ppm_sink otherwise, NULL when the file can't be created
+video_sink *openVideo(const char *path, int width, int height);
+
+#endif
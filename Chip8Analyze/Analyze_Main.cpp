@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "Common.h"
+#include "Chip8.h"
+#include "Rom.h"
+#include "Analysis.h"
+
+/**
+ * chip8_analyze - static ROM analyzer
+ *
+ * Recovers the control flow of a ROM without running it (see Analysis.h):  basic blocks, subroutines
+ *  and their call sites, jump tables behind BNNN, and which parts of the ROM are code and which data.
+ *
+ *      chip8_analyze [-m machine] [-q quirks] [-r catalogue] [-o flow file] [-s] <rom>
+ *
+ *  prints the annotated disassembly (-s: only the summary) and writes the flow file, <rom>.flow unless
+ *  -o names another. Chip8 and chip8_batch load <rom>.flow by themselves and start with the program
+ *  decoded (and compiled on the JIT).
+ *
+ *  The machine decides what decodes (SCHIP / XO-CHIP opcodes), the quirk profile where BNNN jumps.
+ *  Both come from -m / -q, then the ROM's catalogue entry, then the defaults.
+*/
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: chip8_analyze [options] <rom>\n"
+		"  -m <machine>  chip8, schip or xochip (default: the catalogue's, otherwise chip8)\n"
+		"  -q <quirks>   modern, vip, schip or xochip (default: the catalogue's, otherwise the machine's)\n"
+		"  -r <file>     ROM catalogue to take the machine and quirks from\n"
+		"  -o <file>     flow file to write (default: <rom>.flow)\n"
+		"  -s            print the summary only, not the listing\n");
+}
+
+int main(int argc, char **argv)
+{
+	chip8::Machine machine = chip8::NUMBER_OF_MACHINES;
+	chip8::QuirkProfile quirks = chip8::NUMBER_OF_QUIRK_PROFILES;
+	const char *catalogue_path = NULL;
+	const char *flow_path = NULL;
+	const char *rom_path = NULL;
+	bool listing = true;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+
+		if (arg == "-m" && has_value)      { if (!chip8::parseMachine(argv[++i], machine)) { usage(); return 1; } }
+		else if (arg == "-q" && has_value) { if (!chip8::parseQuirks(argv[++i], quirks)) { usage(); return 1; } }
+		else if (arg == "-r" && has_value) { catalogue_path = argv[++i]; }
+		else if (arg == "-o" && has_value) { flow_path = argv[++i]; }
+		else if (arg == "-s")              { listing = false; }
+		else if (arg[0] == '-' || rom_path != NULL) {
+			usage();
+			return 1;
+		}
+		else {
+			rom_path = argv[i];
+		}
+	}
+	if (rom_path == NULL) {
+		usage();
+		return 1;
+	}
+
+	rom_image image;
+	if (!image.open(rom_path)) {
+		fprintf(stderr, "Can't read ROM %s\n", rom_path);
+		return 1;
+	}
+
+	rom_catalogue catalogue;
+	if (catalogue_path != NULL && catalogue.load(catalogue_path)) {
+		const rom_entry *entry = catalogue.find(image.hash());
+		if (entry != NULL) {
+			if (machine == chip8::NUMBER_OF_MACHINES)          { machine = entry->machine; }
+			if (quirks == chip8::NUMBER_OF_QUIRK_PROFILES)     { quirks = entry->quirks; }
+		}
+	}
+
+	// a machine of its own, it decodes but never runs
+	chip8 *chip = new chip8();
+	chip->exit_on_fault = false;
+	chip->setMachine(machine == chip8::NUMBER_OF_MACHINES ? chip8::MACHINE_CHIP8 : machine);
+	if (quirks != chip8::NUMBER_OF_QUIRK_PROFILES) {
+		chip->setQuirks(quirks);
+	}
+	if (!chip->loadRom(image.data(), image.size())) {
+		fprintf(stderr, "%s doesn't fit the %s machine\n", rom_path, chip8::machineName(chip->machine));
+		delete chip;
+		return 1;
+	}
+
+	rom_analysis analysis;
+	analysis.analyze(*chip, image.size(), image.hash());
+
+	if (listing) {
+		analysis.disassemble(*chip, stdout);
+	}
+	else {
+		printf("%u blocks, %u subroutines, %u data regions\n", (unsigned)analysis.blocks().size(),
+			(unsigned)analysis.subroutines().size(), (unsigned)analysis.data().size());
+	}
+
+	std::string path = (flow_path != NULL) ? std::string(flow_path) : rom_analysis::flowPath(rom_path);
+	bool saved = analysis.save(path.c_str());
+	if (!saved) {
+		fprintf(stderr, "Can't write flow file %s\n", path.c_str());
+	}
+
+	delete chip;
+	return saved ? 0 : 1;
+}
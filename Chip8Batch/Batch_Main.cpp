@@ -0,0 +1,613 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "Chip8.h"
+#include "Rom.h"
+#include "Log.h"
+#include "Audio.h"
+#include "Video.h"
+#include "Analysis.h"
+#include "Input.h"
+#include "Timer.h"
+#include "ThreadPool.h"
+#include "Lockstep.h"
+#ifdef CHIP8_PROFILE
+#include "Profiler.h"
+#endif
+
+/**
+ * chip8_batch - headless runner
+ *
+ * Runs any number of ROMs (or jobs from a job file) on independent chip8 instances spread
+ *  across a work-stealing thread pool and reports the final machine state of each one.
+ *
+ * Job file:  one job per line, '#' starts a comment
+ *      <rom path> [cycles=N] [seed=N] [engine=interpreter|jit|threaded] [machine=chip8|schip|xochip]
+ *                 [quirks=modern|vip|schip|xochip] [clock=N] [keys=<script>] [replay=<file>] [trace=<file>]
+ *                 [lockstep=instruction|block|frame] [wav=<file>] [video=<file>] [scale=N] [palette=P] [phosphor=N]
+ *
+ *  the machine selects its own quirk profile unless quirks= (or -q) is given
+ *
+ *  engine=jit on a host without the JIT (not x64) ends the job as engine_error
+ *
+ *  with -r <catalogue> a ROM's machine, quirks and clock come from its catalogue entry unless the job
+ *   (or -m / -q) sets them, and ROMs missing from the catalogue are added to it when the batch is done
+ *
+ *  keys script:  comma separated <cycle><+|-><hex key>, e.g. keys=600+5,900-5
+ *                presses key 5 at cycle 600 and releases it at cycle 900
+ *
+ *  replay=  an input log (see Input.h, Chip8 --record= writes one) instead of a keys script, with the
+ *           random seed it was recorded with. A log recorded on another ROM ends the job as replay_error
+ *
+ *  trace=  records every executed instruction of the job to the file (see Trace.h, read it with chip8_trace),
+ *          the job keeps its engine (the JIT's take the threaded engine) but runs without fast-forward
+ *
+ *  wav=    renders the job's sound to a 16 bit mono .wav on the emulated timeline (see Audio.h)
+ *
+ *  video=  writes the screen at every timer tick (60fps of emulated time) as YUV4MPEG2 when the name ends
+ *          in .y4m, otherwise as PPM (one file per frame for a name with %d, e.g. frames/%05d.ppm).
+ *          scale= sets the size (hi-res pixels are N x N, default 4), palette= the colours (mono, amber,
+ *          green, octo or four RRGGBB) and phosphor= (0-255) how much of a dark pixel's colour stays per frame
+ *
+ *  lockstep=  (or -d for every job) runs a reference interpreter next to the job's engine on the same
+ *             input and compares the two after every instruction, basic block or frame (see Lockstep.h).
+ *             The first divergence ends the job with status 'diverged' and a dump of both machines
+ *
+ *  a ROM with a flow file next to it (<rom>.flow, see chip8_analyze) starts with its blocks decoded, and
+ *   compiled when the engine is the JIT
+ *
+ * Builds with CHIP8_PROFILE (the Debug configurations) also take -p <file> and write the opcode / pc
+ *  profile of every job to it, as CSV when the name ends in .csv and JSON otherwise.
+*/
+
+#define DEFAULT_CYCLES 1000000LL
+
+struct batch_job {
+	// request
+	std::string rom;
+	long long cycles;
+	uint32_t seed;
+	chip8::Engine engine;
+	chip8::Machine machine;         // NUMBER_OF_MACHINES = the catalogue's, otherwise chip8
+	chip8::QuirkProfile quirks;     // NUMBER_OF_QUIRK_PROFILES = the catalogue's, otherwise the machine's own
+	int clock;                      // instructions per second, 0 = the catalogue's, otherwise TARGET_CLOCK_SPEED
+	input_log inputs;
+	std::string trace;
+	std::string wav;
+	std::string video;
+	int video_scale;
+	video_palette palette;
+	int phosphor;
+	LockstepGranularity lockstep;   // NUMBER_OF_LOCKSTEP_GRANULARITIES = no reference run
+
+	bool fast_forward;
+	bool fusion;
+
+	// result
+	std::string status;
+	uint64 rom_hash;
+	long long executed;
+	long long idle_cycles;
+	uint16 pc;
+	uint16 I;
+	uint16 sp;
+	uint8 V[chip8::REGISTER_COUNT];
+	uint8 delay_timer;
+	uint8 sound_timer;
+	uint64_t framebuffer_hash;
+	double seconds;
+	std::string profile;
+	std::string divergence;
+};
+
+enum profile_formats { PROFILE_NONE = 0, PROFILE_JSON, PROFILE_CSV };
+static profile_formats profile_format = PROFILE_NONE;
+
+// every job running the same ROM path shares one mapping of it
+static rom_catalogue catalogue;
+
+static const char *engine_names[chip8::NUMBER_OF_ENGINES] = { "interpreter", "jit", "threaded" };
+
+static bool parse_engine(const std::string &name, chip8::Engine &engine)
+{
+	if (name == "interpreter")   { engine = chip8::ENGINE_INTERPRETER; }
+	else if (name == "jit")      { engine = chip8::ENGINE_JIT; }
+	else if (name == "threaded") { engine = chip8::ENGINE_THREADED; }
+	else { return false; }
+	return true;
+}
+
+static bool parse_job(const std::string &line, const batch_job &defaults, batch_job &job)
+{
+	std::stringstream tokens(line);
+	std::string token;
+
+	job = defaults;
+	if (!(tokens >> job.rom)) {
+		return false;
+	}
+
+	while (tokens >> token) {
+		size_t split = token.find('=');
+		std::string name = token.substr(0, split);
+		std::string value = (split == std::string::npos) ? "" : token.substr(split + 1);
+
+		if (name == "cycles")      { job.cycles = atoll(value.c_str()); }
+		else if (name == "seed")   { job.seed = (uint32_t)strtoul(value.c_str(), NULL, 0); }
+		else if (name == "engine") { if (!parse_engine(value, job.engine)) { return false; } }
+		else if (name == "machine") { if (!chip8::parseMachine(value.c_str(), job.machine)) { return false; } }
+		else if (name == "quirks") { if (!chip8::parseQuirks(value.c_str(), job.quirks)) { return false; } }
+		else if (name == "clock")  { job.clock = atoi(value.c_str()); if (job.clock < SCREEN_REFRESH_RATE) { return false; } }
+		else if (name == "keys")   { if (!job.inputs.parse(value)) { return false; } }
+		else if (name == "replay") { if (!job.inputs.load(value.c_str())) { return false; } }
+		else if (name == "trace")  { if (value.empty()) { return false; } job.trace = value; }
+		else if (name == "wav")    { if (value.empty()) { return false; } job.wav = value; }
+		else if (name == "video")  { if (value.empty()) { return false; } job.video = value; }
+		else if (name == "scale")  { job.video_scale = atoi(value.c_str()); if (job.video_scale < 1 || job.video_scale > frame_scaler::MAX_SCALE) { return false; } }
+		else if (name == "palette") { if (!frame_scaler::parsePalette(value.c_str(), job.palette)) { return false; } }
+		else if (name == "phosphor") { job.phosphor = atoi(value.c_str()); if (job.phosphor < 0 || job.phosphor > 255) { return false; } }
+		else if (name == "lockstep") { if (!lockstep_runner::parseGranularity(value.c_str(), job.lockstep)) { return false; } }
+		else { return false; }
+	}
+	return true;
+}
+
+// a machine set up for the job, NULL when the ROM doesn't fit it
+static chip8 *create_machine(const batch_job &job, const rom_image &image)
+{
+	chip8 *emu = new chip8();
+	emu->exit_on_fault = false;
+	emu->fast_forward = job.fast_forward;
+	emu->fusion = job.fusion;
+	emu->setMachine(job.machine);
+	if (job.quirks != chip8::NUMBER_OF_QUIRK_PROFILES) {
+		emu->setQuirks(job.quirks);
+	}
+
+	if (!emu->loadRom(image.data(), image.size())) {
+		delete emu;
+		return NULL;
+	}
+	emu->seedRandom(job.seed);
+
+	// the timers tick every clock / SCREEN_REFRESH_RATE instructions, the key script (or log, which may
+	//  bring its own seed) is scheduled up front
+	emu->setClock(job.clock);
+	job.inputs.replay(*emu);
+	return emu;
+}
+
+static void run_job(batch_job &job)
+{
+	job.executed = 0;
+	job.idle_cycles = 0;
+	job.seconds = 0.0;
+	job.rom_hash = 0;
+
+	std::shared_ptr<const rom_image> image = catalogue.open(job.rom);
+	if (!image) {
+		job.status = "load_error";
+		return;
+	}
+	job.rom_hash = image->hash();
+	if (job.inputs.rom != 0 && job.inputs.rom != job.rom_hash) {
+		job.status = "replay_error";
+		return;
+	}
+
+	// settings the job leaves open come from the catalogue (read only while the jobs run)
+	const rom_entry *entry = catalogue.find(job.rom_hash);
+	if (entry != NULL) {
+		if (job.machine == chip8::NUMBER_OF_MACHINES) { job.machine = entry->machine; }
+		if (job.quirks == chip8::NUMBER_OF_QUIRK_PROFILES) { job.quirks = entry->quirks; }
+		if (job.clock == 0) { job.clock = entry->clock; }
+	}
+	if (job.machine == chip8::NUMBER_OF_MACHINES) { job.machine = chip8::MACHINE_CHIP8; }
+	if (job.clock == 0) { job.clock = TARGET_CLOCK_SPEED; }
+
+	chip8 *emu = create_machine(job, *image);
+	if (emu == NULL) {
+		job.status = "load_error";
+		return;
+	}
+	// a JIT job on a host without the JIT fails instead of quietly running (and being reported as) the interpreter
+	if (!emu->setEngine(job.engine)) {
+		job.status = "engine_error";
+		delete emu;
+		return;
+	}
+
+	// decoded / compiled ahead of time from the ROM's flow file (chip8_analyze), when there is one
+	rom_analysis analysis;
+	if (analysis.load(rom_analysis::flowPath(job.rom).c_str(), job.rom_hash, job.machine)) {
+		emu->prewarm(analysis);
+	}
+
+	if (!job.trace.empty() && !emu->startTrace(job.trace.c_str())) {
+		job.status = "trace_error";
+		delete emu;
+		return;
+	}
+	if (!job.wav.empty()) {
+		wav_sink *wav = new wav_sink();
+		if (!wav->open(job.wav.c_str(), chip8_audio::DEFAULT_SAMPLE_RATE)) {
+			job.status = "audio_error";
+			delete wav;
+			delete emu;
+			return;
+		}
+		emu->startAudio(wav);
+	}
+
+	// frames are rendered and written on this thread, one per timer tick
+	frame_scaler *scaler = NULL;
+	video_sink *video = NULL;
+	if (!job.video.empty()) {
+		scaler = new frame_scaler();
+		scaler->setScale(job.video_scale);
+		scaler->setPalette(job.palette);
+		scaler->setPersistence(job.phosphor);
+		video = openVideo(job.video.c_str(), scaler->width(), scaler->height());
+		if (video == NULL) {
+			job.status = "video_error";
+			delete scaler;
+			delete emu;
+			return;
+		}
+	}
+#ifdef CHIP8_PROFILE
+	if (profile_format != PROFILE_NONE) {
+		emu->enableProfiling();
+	}
+#endif
+
+	// the reference runs the same ROM on the interpreter, the pair only ever advances through 'lockstep'
+	chip8 *reference = NULL;
+	lockstep_runner *lockstep = NULL;
+	if (job.lockstep != NUMBER_OF_LOCKSTEP_GRANULARITIES) {
+		reference = create_machine(job, *image);
+		lockstep = new lockstep_runner(*reference, *emu, job.lockstep);
+	}
+
+	Timer timer;
+	timer.start();
+
+	while (job.executed < job.cycles && !emu->faulted && !(lockstep != NULL && lockstep->diverged())) {
+		long long remaining = job.cycles - job.executed;
+		uint64 frames = emu->frames;
+		int done;
+
+		if (lockstep != NULL) {
+			// the pair steps up to the next scheduled event and both get it at the same cycle
+			int run = (int)std::min<long long>(remaining, emu->cyclesUntilEvent());
+			done = (run > 0) ? lockstep->run(run) : 0;
+			emu->advance(done);
+			reference->advance(done);
+		}
+		else {
+			// timer ticks and key presses are delivered inside run(), with video it returns at every vblank
+			done = emu->run((int)std::min<long long>(remaining, INT_MAX), video != NULL);
+		}
+		job.executed += done;
+
+		if (video != NULL && emu->frames != frames) {
+			video->write(scaler->render(emu->gfx, emu->hires), scaler->width(), scaler->height());
+		}
+	}
+
+	// whatever the granularity, the run ends with everything compared
+	if (lockstep != NULL && !lockstep->diverged()) {
+		lockstep->verify();
+	}
+
+	timer.end();
+	job.seconds = timer.elapsed() / (double)NANO_SECONDS_PER_HZ;
+
+	job.status = emu->faulted ? "fault" : "ok";
+	if (lockstep != NULL && lockstep->diverged()) {
+		job.status = "diverged";
+		job.divergence = lockstep->report();
+	}
+	job.pc = emu->pc;
+	job.I = emu->I;
+	job.sp = emu->sp;
+	memcpy(job.V, emu->V, sizeof(job.V));
+	job.delay_timer = emu->delay_timer;
+	job.sound_timer = emu->sound_timer;
+	job.framebuffer_hash = emu->framebufferHash();
+	job.idle_cycles = (long long)emu->idle_cycles;
+
+#ifdef CHIP8_PROFILE
+	if (profile_format == PROFILE_JSON) {
+		emu->profile->appendJson(job.profile, *emu, job.rom);
+	}
+	else if (profile_format == PROFILE_CSV) {
+		emu->profile->appendCsv(job.profile, *emu, job.rom);
+	}
+#endif
+
+	delete lockstep;
+	delete reference;
+	delete video;
+	delete scaler;
+	delete emu;
+}
+
+static void write_report(FILE *out, const std::vector<batch_job> &jobs)
+{
+	fprintf(out, "rom,status,cycles,pc,I,sp,V,delay_timer,sound_timer,framebuffer_hash,seconds,instructions_per_second,idle_cycles\n");
+
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		const batch_job &job = jobs[i];
+		fprintf(out, "%s,%s,%lld,", job.rom.c_str(), job.status.c_str(), job.executed);
+
+		if (job.status == "load_error" || job.status == "trace_error" || job.status == "audio_error" ||
+			job.status == "video_error" || job.status == "replay_error" || job.status == "engine_error") {
+			fprintf(out, ",,,,,,,,,\n");
+			continue;
+		}
+
+		fprintf(out, "0x%03X,0x%03X,%u,", job.pc, job.I, job.sp);
+		for (int r = 0; r < chip8::REGISTER_COUNT; ++r) {
+			fprintf(out, "%02X", job.V[r]);
+		}
+		fprintf(out, ",%u,%u,%016llx,%.6f,%.0f,%lld\n",
+			job.delay_timer, job.sound_timer, (unsigned long long)job.framebuffer_hash,
+			job.seconds, job.seconds > 0.0 ? job.executed / job.seconds : 0.0, job.idle_cycles);
+	}
+}
+
+static bool write_profiles(const char *path, const std::vector<batch_job> &jobs)
+{
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		return false;
+	}
+
+	if (profile_format == PROFILE_CSV) {
+		fprintf(out, "rom,section,key,count,nanoseconds\n");
+	}
+	else {
+		fprintf(out, "[\n");
+	}
+
+	bool first = true;
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		if (jobs[i].profile.empty()) {
+			continue;
+		}
+		if (profile_format == PROFILE_JSON && !first) {
+			fprintf(out, ",\n");
+		}
+		fwrite(jobs[i].profile.data(), 1, jobs[i].profile.size(), out);
+		first = false;
+	}
+
+	if (profile_format == PROFILE_JSON) {
+		fprintf(out, "\n]\n");
+	}
+	fclose(out);
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: chip8_batch [options] [rom ...]\n"
+		"  -f <file>     job file (one '<rom> [cycles=N] [seed=N] [engine=E] [machine=M] [quirks=Q] [clock=N] [keys=S] [replay=F] [trace=F] [wav=F] [video=F] [scale=N] [palette=P] [phosphor=N] [lockstep=G]' per line)\n"
+		"  -c <cycles>   default instruction budget per job (%lld)\n"
+		"  -s <seed>     default random seed\n"
+		"  -e <engine>   default engine: interpreter, jit or threaded\n"
+		"  -m <machine>  default machine: chip8, schip or xochip (default: the catalogue's, otherwise chip8)\n"
+		"  -q <quirks>   default quirk profile: modern, vip, schip or xochip (default: the catalogue's, otherwise the machine's)\n"
+		"  -r <file>     ROM catalogue to take per ROM settings from, new ROMs are added to it\n"
+		"  -t <threads>  worker threads (default: all hardware threads)\n"
+		"  -d <steps>    check every job's engine against the interpreter after each instruction, block or frame\n"
+		"  -n            run idle loops instead of fast-forwarding them to the next timer tick / input\n"
+		"  -u            run the interpreter without superinstructions (one dispatch per instruction)\n"
+		"  -o <file>     write the CSV report to a file instead of stdout\n"
+		"  -l <file>     write the log to a file instead of stderr\n"
+#ifdef CHIP8_PROFILE
+		"  -p <file>     write per job opcode / pc profiles (.csv = CSV, otherwise JSON)\n"
+#endif
+		,
+		DEFAULT_CYCLES);
+}
+
+int main(int argc, char **argv)
+{
+	batch_job defaults;
+	defaults.cycles = DEFAULT_CYCLES;
+	defaults.seed = 1;
+	defaults.engine = chip8::ENGINE_INTERPRETER;
+	defaults.machine = chip8::NUMBER_OF_MACHINES;
+	defaults.fast_forward = true;
+	defaults.fusion = true;
+	defaults.quirks = chip8::NUMBER_OF_QUIRK_PROFILES;
+	defaults.clock = 0;
+	defaults.lockstep = NUMBER_OF_LOCKSTEP_GRANULARITIES;
+	defaults.video_scale = 4;
+	frame_scaler::parsePalette("mono", defaults.palette);
+	defaults.phosphor = 0;
+
+	std::vector<batch_job> jobs;
+	std::vector<std::string> job_files;
+	std::vector<std::string> roms;
+	unsigned threads = 0;
+	const char *report_path = NULL;
+	const char *profile_path = NULL;
+	const char *catalogue_path = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+
+		if (arg == "-f" && has_value)      { job_files.push_back(argv[++i]); }
+		else if (arg == "-c" && has_value) { defaults.cycles = atoll(argv[++i]); }
+		else if (arg == "-s" && has_value) { defaults.seed = (uint32_t)strtoul(argv[++i], NULL, 0); }
+		else if (arg == "-t" && has_value) { threads = (unsigned)atoi(argv[++i]); }
+		else if (arg == "-n")              { defaults.fast_forward = false; }
+		else if (arg == "-u")              { defaults.fusion = false; }
+		else if (arg == "-o" && has_value) { report_path = argv[++i]; }
+		else if (arg == "-r" && has_value) { catalogue_path = argv[++i]; }
+		else if (arg == "-l" && has_value) {
+			if (!chip8_log::open(argv[++i])) {
+				fprintf(stderr, "Can't write log %s\n", argv[i]);
+				return 1;
+			}
+		}
+#ifdef CHIP8_PROFILE
+		else if (arg == "-p" && has_value) {
+			profile_path = argv[++i];
+			size_t length = strlen(profile_path);
+			profile_format = (length > 4 && strcmp(profile_path + length - 4, ".csv") == 0) ? PROFILE_CSV : PROFILE_JSON;
+		}
+#endif
+		else if (arg == "-m" && has_value) {
+			if (!chip8::parseMachine(argv[++i], defaults.machine)) {
+				usage();
+				return 1;
+			}
+		}
+		else if (arg == "-q" && has_value) {
+			if (!chip8::parseQuirks(argv[++i], defaults.quirks)) {
+				usage();
+				return 1;
+			}
+		}
+		else if (arg == "-d" && has_value) {
+			if (!lockstep_runner::parseGranularity(argv[++i], defaults.lockstep)) {
+				usage();
+				return 1;
+			}
+		}
+		else if (arg == "-e" && has_value) {
+			if (!parse_engine(argv[++i], defaults.engine)) {
+				usage();
+				return 1;
+			}
+		}
+		else if (arg[0] == '-') {
+			usage();
+			return 1;
+		}
+		else {
+			roms.push_back(arg);
+		}
+	}
+
+	for (size_t f = 0; f < job_files.size(); ++f) {
+		std::ifstream file(job_files[f].c_str());
+		if (!file) {
+			fprintf(stderr, "Can't open job file %s\n", job_files[f].c_str());
+			return 1;
+		}
+
+		std::string line;
+		int line_number = 0;
+		while (std::getline(file, line)) {
+			++line_number;
+			line = line.substr(0, line.find('#'));
+			if (line.find_first_not_of(" \t\r") == std::string::npos) {
+				continue;
+			}
+
+			batch_job job;
+			if (!parse_job(line, defaults, job)) {
+				fprintf(stderr, "%s:%d: invalid job\n", job_files[f].c_str(), line_number);
+				return 1;
+			}
+			jobs.push_back(job);
+		}
+	}
+
+	for (size_t r = 0; r < roms.size(); ++r) {
+		batch_job job = defaults;
+		job.rom = roms[r];
+		jobs.push_back(job);
+	}
+
+	if (jobs.empty()) {
+		usage();
+		return 1;
+	}
+
+	// a catalogue that doesn't exist yet starts out empty
+	if (catalogue_path != NULL) {
+		catalogue.load(catalogue_path);
+	}
+
+	// run everything, each job writes only its own slot of 'jobs'
+	Timer timer;
+	timer.start();
+	unsigned workers;
+	{
+		thread_pool pool(threads);
+		workers = pool.size();
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			batch_job *job = &jobs[i];
+			pool.submit([job]() { run_job(*job); });
+		}
+		pool.wait();
+	}
+	timer.end();
+
+	if (catalogue_path != NULL) {
+		size_t known = catalogue.size();
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			if (jobs[i].status != "load_error" && catalogue.find(jobs[i].rom_hash) == NULL) {
+				rom_entry entry;
+				entry.hash = jobs[i].rom_hash;
+				entry.name = rom_catalogue::entryName(jobs[i].rom);
+				catalogue.update(entry);
+			}
+		}
+		if (catalogue.size() != known && !catalogue.save(catalogue_path)) {
+			fprintf(stderr, "Can't write catalogue %s\n", catalogue_path);
+		}
+	}
+
+	FILE *out = stdout;
+	if (report_path != NULL) {
+		out = fopen(report_path, "w");
+		if (out == NULL) {
+			fprintf(stderr, "Can't write report %s\n", report_path);
+			return 1;
+		}
+	}
+	write_report(out, jobs);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	// the state dump of every divergence
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		if (!jobs[i].divergence.empty()) {
+			fprintf(stderr, "%s (%s): %s", jobs[i].rom.c_str(), engine_names[jobs[i].engine], jobs[i].divergence.c_str());
+		}
+	}
+
+	if (profile_path != NULL && !write_profiles(profile_path, jobs)) {
+		fprintf(stderr, "Can't write profile %s\n", profile_path);
+		return 1;
+	}
+
+	// summary
+	long long total = 0;
+	int failed = 0;
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		total += jobs[i].executed;
+		failed += (jobs[i].status != "ok") ? 1 : 0;
+	}
+	double seconds = timer.elapsed() / (double)NANO_SECONDS_PER_HZ;
+	fprintf(stderr, "%u jobs (%d failed) on %u threads, %lld instructions in %.3fs (%.0f instructions/sec)\n",
+		(unsigned)jobs.size(), failed, workers, total, seconds, seconds > 0.0 ? total / seconds : 0.0);
+
+	return failed ? 2 : 0;
+}
@@ -0,0 +1,346 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "Lockstep.h"
+
+static const char *granularity_names[NUMBER_OF_LOCKSTEP_GRANULARITIES] = { "instruction", "block", "frame" };
+
+// printf into a std::string
+static void append(std::string &out, const char *format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (length > 0) {
+		out.append(buffer, (length < (int)sizeof(buffer)) ? length : sizeof(buffer) - 1);
+	}
+}
+
+static inline uint64 mix(uint64 hash, uint64 value)
+{
+	hash ^= value;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	return hash ^ (hash >> 32);
+}
+
+static inline uint64 load64(const uint8 *bytes)
+{
+	uint64 word;
+	memcpy(&word, bytes, sizeof(word));
+	return word;
+}
+
+// the index is part of the hash, equal pages at different addresses don't cancel out in the fold
+static uint64 hashPage(const uint8 *page, int index)
+{
+	uint64 hash = mix(0x9E3779B97F4A7C15ULL, (uint64)index);
+	for (int offset = 0; offset < lockstep_runner::PAGE_SIZE; offset += 8) {
+		hash = mix(hash, load64(page + offset));
+	}
+	return hash;
+}
+
+// everything but memory and the framebuffer (idle_cycles and drawFlag are bookkeeping, not machine state)
+static uint64 hashCore(const chip8 &chip)
+{
+	uint64 hash = mix(0, (uint64)chip.pc | (uint64)chip.I << 16 | (uint64)chip.sp << 32 |
+		(uint64)chip.vblank << 40 | (uint64)chip.delay_timer << 48 | (uint64)chip.sound_timer << 56);
+	hash = mix(hash, (uint64)chip.hires | (uint64)chip.planes << 8 | (uint64)chip.faulted << 16 |
+		(uint64)chip.pitch << 24 | (uint64)chip.random_state << 32);
+	hash = mix(hash, load64(&chip.V[0]));
+	hash = mix(hash, load64(&chip.V[8]));
+	for (int level = 0; level < chip8::STACK_LEVELS; level += 4) {
+		hash = mix(hash, load64((const uint8 *)&chip.stack[level]));
+	}
+	hash = mix(hash, load64(&chip.rpl[0]));
+	hash = mix(hash, load64(&chip.rpl[8]));
+	hash = mix(hash, load64(&chip.audio_pattern[0]));
+	hash = mix(hash, load64(&chip.audio_pattern[8]));
+	hash = mix(hash, load64(&chip.key[0]));
+	return mix(hash, load64(&chip.key[8]));
+}
+
+// 00E0, DXYN, the scrolls and the resolution switches
+static inline bool touchesDisplay(uint16 opcode)
+{
+	return (opcode & 0xF000) == 0xD000 || opcode == 0x00E0 || (opcode & 0xFFE0) == 0x00C0 ||
+		opcode == 0x00FB || opcode == 0x00FC || opcode == 0x00FE || opcode == 0x00FF;
+}
+
+// jumps, calls, returns, skips, the key wait and exit end a basic block
+static inline bool endsBlock(uint16 opcode)
+{
+	switch (opcode >> 12) {
+	case 0x0: return opcode == 0x00EE || opcode == 0x00FD;
+	case 0x5: return (opcode & 0x000F) == 0x0;
+	case 0x1: case 0x2: case 0x3: case 0x4: case 0x9: case 0xB: case 0xE:
+		return true;
+	case 0xF: return (opcode & 0x00FF) == 0x0A;
+	default:
+		return false;
+	}
+}
+
+lockstep_runner::lockstep_runner(chip8 &reference, chip8 &candidate, LockstepGranularity granularity)
+	: reference(reference), candidate(candidate), granularity(granularity), dirty_display(false),
+	  instructions(0), compared(0), next_full_check(0), divergence(DIVERGENCE_NONE),
+	  cycles_reference(0), cycles_candidate(0)
+{
+	reference.fast_forward = false;
+	memset(dirty_pages, 0, sizeof(dirty_pages));
+	memset(history, 0, sizeof(history));
+	verify();
+}
+
+bool lockstep_runner::parseGranularity(const char *name, LockstepGranularity &granularity)
+{
+	for (int i = 0; i < NUMBER_OF_LOCKSTEP_GRANULARITIES; ++i) {
+		if (strcmp(name, granularity_names[i]) == 0) {
+			granularity = (LockstepGranularity)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *lockstep_runner::granularityName(LockstepGranularity granularity)
+{
+	return (granularity < NUMBER_OF_LOCKSTEP_GRANULARITIES) ? granularity_names[granularity] : "unknown";
+}
+
+int lockstep_runner::run(int cycles)
+{
+	int done = 0;
+	while (done < cycles && !diverged()) {
+		int step = stepLength(cycles - done);
+		cycles_reference = stepReference(step);
+		cycles_candidate = candidate.emulateCycles(step);
+		instructions += cycles_reference;
+		done += cycles_reference;
+
+		if (cycles_reference != cycles_candidate) {
+			divergence = DIVERGENCE_CYCLES;
+			break;
+		}
+		if (instructions >= next_full_check) {
+			verify();
+		}
+		else {
+			compare();
+		}
+
+		// both faulted
+		if (cycles_reference == 0) {
+			break;
+		}
+	}
+	return done;
+}
+
+int lockstep_runner::stepLength(int remaining) const
+{
+	switch (granularity) {
+	case LOCKSTEP_INSTRUCTION:
+		return 1;
+
+	case LOCKSTEP_BLOCK: {
+		// follow the reference's straight line code, F000 NNNN is a single 4 byte instruction on XO-CHIP
+		uint16 address = reference.pc;
+		int length = 0;
+		while (length < remaining) {
+			uint16 opcode = reference.memory[address] << 8 | reference.memory[(uint16)(address + 1)];
+			++length;
+			if (endsBlock(opcode)) {
+				break;
+			}
+			address += (opcode == 0xF000 && reference.machine == chip8::MACHINE_XOCHIP) ? 4 : 2;
+		}
+		return length;
+	}
+
+	case LOCKSTEP_FRAME:
+	default:
+		return remaining;
+	}
+}
+
+// chip8::emulateCycles' interpreter loop, noting what each instruction is about to touch
+int lockstep_runner::stepReference(int cycles)
+{
+	for (int i = 0; i < cycles; ++i) {
+		if (reference.faulted) {
+			return i;
+		}
+
+		uint16 pc = reference.pc;
+		uint16 opcode = reference.memory[pc] << 8 | reference.memory[(uint16)(pc + 1)];
+		history_entry &entry = history[(instructions + i) % HISTORY];
+		entry.pc = pc;
+		entry.opcode = opcode;
+
+		uint16 written = reference.memoryWriteLength(opcode);
+		if (written != 0) {
+			markWritten(reference.I, written);
+		}
+		dirty_display |= touchesDisplay(opcode);
+
+		reference.emulateCycle();
+	}
+	return cycles;
+}
+
+void lockstep_runner::markWritten(uint16 address, uint16 length)
+{
+	// may wrap around the end of memory
+	int first = address / PAGE_SIZE;
+	int last = ((address + length - 1) & (chip8::MEMORY_SIZE - 1)) / PAGE_SIZE;
+	for (int page = first; ; page = (page + 1) % PAGES) {
+		dirty_pages[page / 64] |= 1ULL << (page % 64);
+		if (page == last) {
+			break;
+		}
+	}
+}
+
+void lockstep_runner::rehashPage(const chip8 &chip, digest &state, int page)
+{
+	uint64 hash = hashPage(&chip.memory[page * PAGE_SIZE], page);
+	state.memory ^= state.pages[page] ^ hash;
+	state.pages[page] = hash;
+}
+
+void lockstep_runner::hashAll(chip8 &chip, digest &state)
+{
+	state.core = hashCore(chip);
+	state.memory = 0;
+	for (int page = 0; page < PAGES; ++page) {
+		state.pages[page] = hashPage(&chip.memory[page * PAGE_SIZE], page);
+		state.memory ^= state.pages[page];
+	}
+	state.display = chip.framebufferHash();
+}
+
+bool lockstep_runner::compare()
+{
+	++compared;
+	sides[0].core = hashCore(reference);
+	sides[1].core = hashCore(candidate);
+
+	for (int word = 0; word < PAGES / 64; ++word) {
+		uint64 pages = dirty_pages[word];
+		while (pages != 0) {
+			int page = word * 64 + COUNT_TRAILING_ZEROS_64(pages);
+			rehashPage(reference, sides[0], page);
+			rehashPage(candidate, sides[1], page);
+			pages &= pages - 1;
+		}
+		dirty_pages[word] = 0;
+	}
+
+	if (dirty_display) {
+		sides[0].display = reference.framebufferHash();
+		sides[1].display = candidate.framebufferHash();
+		dirty_display = false;
+	}
+
+	if (sides[0].core != sides[1].core)             { divergence = DIVERGENCE_CORE; }
+	else if (sides[0].memory != sides[1].memory)    { divergence = DIVERGENCE_MEMORY; }
+	else if (sides[0].display != sides[1].display)  { divergence = DIVERGENCE_DISPLAY; }
+	return !diverged();
+}
+
+bool lockstep_runner::verify()
+{
+	hashAll(reference, sides[0]);
+	hashAll(candidate, sides[1]);
+	memset(dirty_pages, 0, sizeof(dirty_pages));
+	dirty_display = false;
+	next_full_check = instructions + FULL_CHECK_INTERVAL;
+	return compare();
+}
+
+/**
+ * report
+ *
+*/
+
+static void appendRow(std::string &out, const char *name, unsigned a, unsigned b, const char *format)
+{
+	append(out, "  %c %-13s", (a != b) ? '*' : ' ', name);
+	append(out, format, a);
+	out += "  ";
+	append(out, format, b);
+	out += "\n";
+}
+
+static void appendBytes(std::string &out, const char *name, const uint8 *a, const uint8 *b, int count)
+{
+	append(out, "  %c %-13s", (memcmp(a, b, count) != 0) ? '*' : ' ', name);
+	for (int i = 0; i < count; ++i) {
+		append(out, "%02X", a[i]);
+	}
+	out += "  ";
+	for (int i = 0; i < count; ++i) {
+		append(out, "%02X", b[i]);
+	}
+	out += "\n";
+}
+
+std::string lockstep_runner::report() const
+{
+	static const char *reasons[] = { "none", "instruction count", "registers", "memory", "display" };
+	std::string out;
+
+	append(out, "diverged after %llu instructions (%s, %s steps, %llu comparisons), reference / candidate:\n",
+		(unsigned long long)instructions, reasons[divergence], granularity_names[granularity], (unsigned long long)compared);
+
+	if (divergence == DIVERGENCE_CYCLES) {
+		appendRow(out, "executed", (unsigned)cycles_reference, (unsigned)cycles_candidate, "%-8u");
+	}
+	appendRow(out, "pc", reference.pc, candidate.pc, "%03X     ");
+	appendRow(out, "I", reference.I, candidate.I, "%03X     ");
+	appendRow(out, "sp", reference.sp, candidate.sp, "%-8u");
+	appendRow(out, "delay_timer", reference.delay_timer, candidate.delay_timer, "%-8u");
+	appendRow(out, "sound_timer", reference.sound_timer, candidate.sound_timer, "%-8u");
+	appendRow(out, "vblank", reference.vblank, candidate.vblank, "%-8u");
+	appendRow(out, "hires", reference.hires, candidate.hires, "%-8u");
+	appendRow(out, "planes", reference.planes, candidate.planes, "%-8u");
+	appendRow(out, "faulted", reference.faulted, candidate.faulted, "%-8u");
+	appendRow(out, "random_state", reference.random_state, candidate.random_state, "%08X");
+	appendBytes(out, "V", reference.V, candidate.V, chip8::REGISTER_COUNT);
+	appendBytes(out, "stack", (const uint8 *)reference.stack, (const uint8 *)candidate.stack, sizeof(reference.stack));
+	appendBytes(out, "rpl", reference.rpl, candidate.rpl, chip8::REGISTER_COUNT);
+
+	// the first few bytes that differ
+	int differing = 0;
+	for (uint32_t address = 0; address < chip8::MEMORY_SIZE; ++address) {
+		if (reference.memory[address] != candidate.memory[address]) {
+			if (differing < 8) {
+				append(out, "  * mem[%04X]     %02X        %02X\n", address, reference.memory[address], candidate.memory[address]);
+			}
+			++differing;
+		}
+	}
+	if (differing > 8) {
+		append(out, "  * ... %d bytes of memory differ\n", differing);
+	}
+
+	for (int plane = 0; plane < GFX_PLANES; ++plane) {
+		for (int y = 0; y < GFX_HEIGHT; ++y) {
+			if (memcmp(reference.gfx[plane][y], candidate.gfx[plane][y], sizeof(reference.gfx[plane][y])) != 0) {
+				append(out, "  * display      plane %d differs from row %d on\n", plane, y);
+				break;
+			}
+		}
+	}
+
+	out += "  last instructions of the reference:\n";
+	uint64 first = (instructions > HISTORY) ? instructions - HISTORY : 0;
+	for (uint64 i = first; i < instructions; ++i) {
+		const history_entry &entry = history[i % HISTORY];
+		append(out, "    %12llu  %03X  %04X\n", (unsigned long long)i, entry.pc, entry.opcode);
+	}
+	return out;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef _LOCKSTEP_H
+#define _LOCKSTEP_H
+
+#include <string>
+#include "Common.h"
+#include "Chip8.h"
+
+/**
+ * Lockstep differential runner
+ *
+ * Runs a reference machine (stepped here, one emulateCycle at a time, i.e. the opcode_0x* routines)
+ *  and a candidate machine (on whatever engine it has selected) over the same instructions and
+ *  compares the two after every step.  A step is one instruction, one basic block of the reference
+ *  (up to and including the next jump, call, return or skip) or the whole batch handed to run().
+ *
+ * Comparing two 64K machines after every instruction would cost far more than running them, so each
+ *  side keeps a digest instead:
+ *      core     - registers, stack, timers, display mode, random state, rehashed every step (~100 bytes)
+ *      memory   - hashes of 256 byte pages folded together, only the pages the reference wrote in the
+ *                 step (FX33, FX55, 5XY2) are rehashed, on both sides
+ *      display  - framebufferHash(), only after steps that drew, cleared or scrolled
+ *  Every FULL_CHECK_INTERVAL instructions (and in verify()) every page and the display are rehashed,
+ *  which catches a candidate writing where the reference didn't.
+ *
+ * The first step whose digests differ stops the run, report() then describes both machines.
+ *  The reference steps every instruction (no idle loop fast-forward), the candidate keeps the job's
+ *  setting:  fast-forward only skips whole passes of a loop, so it has to agree with stepping after
+ *  every step too.
+*/
+
+enum lockstep_granularities {
+	LOCKSTEP_INSTRUCTION = 0,
+	LOCKSTEP_BLOCK,
+	LOCKSTEP_FRAME,
+	NUMBER_OF_LOCKSTEP_GRANULARITIES
+};
+
+typedef enum lockstep_granularities LockstepGranularity;
+
+class lockstep_runner {
+public:
+	static const int PAGE_SIZE = 256;
+	static const int PAGES = chip8::MEMORY_SIZE / PAGE_SIZE;
+	static const uint64 FULL_CHECK_INTERVAL = 65536;
+	static const int HISTORY = 16;
+
+	// both machines loaded, configured and seeded the same way
+	lockstep_runner(chip8 &reference, chip8 &candidate, LockstepGranularity granularity);
+
+	// runs up to 'cycles' instructions on both, fewer once they diverge (or fault).
+	//  emulated time is the caller's business, same as for emulateCycles:  no further than the next event
+	//  (chip8::cyclesUntilEvent) and both machines advance() by what ran
+	int run(int cycles);
+
+	// full comparison of both machines, false (and diverged) when they differ
+	bool verify();
+
+	bool diverged() const { return divergence != DIVERGENCE_NONE; }
+	uint64 executed() const { return instructions; }
+	uint64 checks() const { return compared; }
+
+	// both machines side by side at the divergence and the reference's last instructions
+	std::string report() const;
+
+	static bool parseGranularity(const char *name, LockstepGranularity &granularity);
+	static const char *granularityName(LockstepGranularity granularity);
+
+private:
+	enum divergences {
+		DIVERGENCE_NONE = 0,
+		DIVERGENCE_CYCLES,
+		DIVERGENCE_CORE,
+		DIVERGENCE_MEMORY,
+		DIVERGENCE_DISPLAY
+	};
+
+	struct digest {
+		uint64 core;
+		uint64 memory;
+		uint64 display;
+		uint64 pages[PAGES];
+	};
+
+	struct history_entry {
+		uint16 pc;
+		uint16 opcode;
+	};
+
+	int stepLength(int remaining) const;
+	int stepReference(int cycles);
+	void markWritten(uint16 address, uint16 length);
+	bool compare();
+	void hashAll(chip8 &chip, digest &state);
+	void rehashPage(const chip8 &chip, digest &state, int page);
+
+	chip8 &reference;
+	chip8 &candidate;
+	LockstepGranularity granularity;
+
+	digest sides[2];
+
+	// what the reference touched in the current step
+	uint64 dirty_pages[PAGES / 64];
+	bool dirty_display;
+
+	history_entry history[HISTORY];
+	uint64 instructions;
+	uint64 compared;
+	uint64 next_full_check;
+	divergences divergence;
+	int cycles_reference;
+	int cycles_candidate;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "ThreadPool.h"
+
+thread_pool::thread_pool(unsigned workers) : queued(0), pending(0), next_queue(0), stopping(false)
+{
+	if (workers == 0) {
+		workers = std::thread::hardware_concurrency();
+	}
+	if (workers == 0) {
+		workers = 1;
+	}
+
+	for (unsigned i = 0; i < workers; ++i) {
+		queues.push_back(new worker_queue());
+	}
+	for (unsigned i = 0; i < workers; ++i) {
+		threads.push_back(std::thread(&thread_pool::run, this, i));
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> guard(idle_lock);
+		stopping = true;
+	}
+	work_available.notify_all();
+
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+	for (size_t i = 0; i < queues.size(); ++i) {
+		delete queues[i];
+	}
+}
+
+unsigned thread_pool::size() const
+{
+	return (unsigned)threads.size();
+}
+
+void thread_pool::submit(task work)
+{
+	worker_queue *queue = queues[next_queue++ % queues.size()];
+
+	++pending;
+
+	// counted before it is visible so 'queued' never drops below zero, the idle lock orders
+	//  the count against a worker that is about to go to sleep
+	{
+		std::lock_guard<std::mutex> guard(idle_lock);
+		++queued;
+	}
+	{
+		std::lock_guard<std::mutex> guard(queue->lock);
+		queue->tasks.push_back(work);
+	}
+	work_available.notify_one();
+}
+
+void thread_pool::wait()
+{
+	std::unique_lock<std::mutex> guard(idle_lock);
+	while (pending != 0) {
+		all_done.wait(guard);
+	}
+}
+
+// own queue first (newest task, still warm in cache), then steal the oldest task of another worker
+bool thread_pool::take(unsigned index, task &work)
+{
+	{
+		worker_queue *own = queues[index];
+		std::lock_guard<std::mutex> guard(own->lock);
+		if (!own->tasks.empty()) {
+			work = own->tasks.back();
+			own->tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < queues.size(); ++i) {
+		worker_queue *victim = queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim->lock);
+		if (!victim->tasks.empty()) {
+			work = victim->tasks.front();
+			victim->tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void thread_pool::run(unsigned index)
+{
+	for (;;) {
+		task work;
+		if (take(index, work)) {
+			--queued;
+			work();
+
+			if (--pending == 0) {
+				std::lock_guard<std::mutex> guard(idle_lock);
+				all_done.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(idle_lock);
+		while (queued == 0 && !stopping) {
+			work_available.wait(guard);
+		}
+		if (stopping && queued == 0) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing thread pool
+ *
+ * Every worker owns a queue. Submitted tasks are dealt round robin across the queues, a worker
+ *  takes new work from the back of its own queue and steals from the front of the others
+ *  once it runs dry, so long jobs on one worker don't leave the rest of the machine idle.
+*/
+class thread_pool {
+public:
+	typedef std::function<void()> task;
+
+	// workers = 0 -> one per hardware thread
+	explicit thread_pool(unsigned workers = 0);
+	~thread_pool();
+
+	void submit(task work);
+
+	// block until every submitted task has finished
+	void wait();
+
+	unsigned size() const;
+
+private:
+	struct worker_queue {
+		std::mutex lock;
+		std::deque<task> tasks;
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<worker_queue *> queues;
+
+	std::atomic<size_t> queued;     // tasks waiting in a queue
+	std::atomic<size_t> pending;    // tasks submitted and not finished
+	std::atomic<unsigned> next_queue;
+	bool stopping;
+
+	std::mutex idle_lock;
+	std::condition_variable work_available;
+	std::condition_variable all_done;
+
+	void run(unsigned index);
+	bool take(unsigned index, task &work);
+};
+
+#endif
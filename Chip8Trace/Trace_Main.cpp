@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include "Common.h"
+#include "Trace.h"
+
+/**
+ * chip8_trace - offline execution trace analyzer
+ *
+ * Reads the traces written by 'Chip8 --trace=<file>' or a chip8_batch job with trace=<file> (see Trace.h).
+ *  Only the chunks that are needed are read and decoded, so seeking in or diffing a multi-GB trace
+ *  costs about as much as the records printed.
+ *
+ *      chip8_trace info <trace>
+ *      chip8_trace dump <trace> [first record] [count]
+ *      chip8_trace find <trace> <pc in hex> [max hits]
+ *      chip8_trace diff <trace a> <trace b> [context records]
+ *
+ *  diff skips every chunk pair whose stored bytes are equal and decodes only the chunk holding the
+ *  first divergence, then prints the records leading up to it and the two differing records.
+*/
+
+#define DEFAULT_DUMP_COUNT 32
+#define DEFAULT_FIND_HITS 32
+#define DEFAULT_CONTEXT 8
+
+static void print_record(uint64 index, const trace_record &record, const char *prefix)
+{
+	printf("%s%12llu  %03X  %04X  I=%03X  sp=%-2u dt=%-3u VF=%02X",
+		prefix, (unsigned long long)index, record.pc, record.opcode, record.I, record.sp, record.delay_timer, record.vf);
+
+	if (record.changed != 0) {
+		int lowest = COUNT_TRAILING_ZEROS_64(record.changed);
+		printf("  V%X=%02X", lowest, record.value);
+		int others = 0;
+		for (int r = lowest + 1; r < 16; ++r) {
+			others += (record.changed >> r) & 1;
+		}
+		if (others != 0) {
+			printf(" (+%d changed)", others);
+		}
+	}
+	if (record.write_length != 0) {
+		printf("  mem[%03X..%03X]", record.write_address, (record.write_address + record.write_length - 1) & 0xFFFF);
+	}
+	if (record.flags & TRACE_FAULT) {
+		printf("  FAULT");
+	}
+	printf("\n");
+}
+
+static void print_differences(const trace_record &a, const trace_record &b)
+{
+	printf("differs in:");
+	if (a.pc != b.pc)                       { printf(" pc"); }
+	if (a.opcode != b.opcode)               { printf(" opcode"); }
+	if (a.I != b.I)                         { printf(" I"); }
+	if (a.changed != b.changed)             { printf(" changed_registers"); }
+	if (a.value != b.value)                 { printf(" register_value"); }
+	if (a.vf != b.vf)                       { printf(" VF"); }
+	if (a.sp != b.sp)                       { printf(" sp"); }
+	if (a.delay_timer != b.delay_timer)     { printf(" delay_timer"); }
+	if (a.write_address != b.write_address || a.write_length != b.write_length) { printf(" memory_write"); }
+	if (a.flags != b.flags)                 { printf(" flags"); }
+	printf("\n");
+}
+
+static int info(trace_reader &trace)
+{
+	printf("records %llu\nchunks  %u\n", (unsigned long long)trace.records(), (unsigned)trace.chunks());
+
+	std::vector<uint8> bytes;
+	uint64 compressed = 0;
+	for (size_t c = 0; c < trace.chunks(); ++c) {
+		if (!trace.readCompressed(c, bytes)) {
+			fprintf(stderr, "chunk %u unreadable\n", (unsigned)c);
+			return 1;
+		}
+		compressed += bytes.size();
+	}
+	printf("bytes   %llu (%.2f per record, %.1fx)\n", (unsigned long long)compressed,
+		trace.records() ? (double)compressed / trace.records() : 0.0,
+		compressed ? (double)trace.records() * sizeof(trace_record) / compressed : 0.0);
+	return 0;
+}
+
+static int dump(trace_reader &trace, uint64 first, size_t count)
+{
+	std::vector<trace_record> records;
+	if (!trace.read(first, count, records)) {
+		fprintf(stderr, "trace unreadable\n");
+		return 1;
+	}
+	for (size_t i = 0; i < records.size(); ++i) {
+		print_record(first + i, records[i], "");
+	}
+	return 0;
+}
+
+static int find(trace_reader &trace, uint16 pc, size_t max_hits)
+{
+	std::vector<trace_record> records;
+	size_t hits = 0;
+	for (size_t c = 0; c < trace.chunks() && hits < max_hits; ++c) {
+		if (!trace.readChunk(c, records)) {
+			fprintf(stderr, "chunk %u unreadable\n", (unsigned)c);
+			return 1;
+		}
+		for (size_t i = 0; i < records.size() && hits < max_hits; ++i) {
+			if (records[i].pc == pc) {
+				print_record(trace.chunkStart(c) + i, records[i], "");
+				++hits;
+			}
+		}
+	}
+	return 0;
+}
+
+static int diff(trace_reader &a, trace_reader &b, size_t context)
+{
+	// whole chunks first:  equal stored bytes at the same position mean equal records
+	std::vector<uint8> bytes_a, bytes_b;
+	size_t chunk = 0;
+	size_t common = std::min(a.chunks(), b.chunks());
+	while (chunk < common && a.chunkStart(chunk) == b.chunkStart(chunk)) {
+		if (!a.readCompressed(chunk, bytes_a) || !b.readCompressed(chunk, bytes_b)) {
+			fprintf(stderr, "chunk %u unreadable\n", (unsigned)chunk);
+			return 1;
+		}
+		if (bytes_a != bytes_b) {
+			break;
+		}
+		++chunk;
+	}
+
+	// then record by record from the first chunk that differs
+	uint64 position = (chunk < a.chunks()) ? a.chunkStart(chunk) : a.records();
+	std::vector<trace_record> records_a, records_b;
+	for (;;) {
+		if (!a.read(position, trace_recorder::CHUNK_RECORDS, records_a) || !b.read(position, trace_recorder::CHUNK_RECORDS, records_b)) {
+			fprintf(stderr, "trace unreadable\n");
+			return 1;
+		}
+		size_t length = std::min(records_a.size(), records_b.size());
+		size_t i = 0;
+		while (i < length && memcmp(&records_a[i], &records_b[i], sizeof(trace_record)) == 0) {
+			++i;
+		}
+
+		if (i < length) {
+			uint64 divergence = position + i;
+			printf("first divergence at record %llu\n", (unsigned long long)divergence);
+
+			uint64 from = (divergence > context) ? divergence - context : 0;
+			std::vector<trace_record> before;
+			if (a.read(from, (size_t)(divergence - from), before)) {
+				for (size_t r = 0; r < before.size(); ++r) {
+					print_record(from + r, before[r], "  ");
+				}
+			}
+			print_record(divergence, records_a[i], "a ");
+			print_record(divergence, records_b[i], "b ");
+			print_differences(records_a[i], records_b[i]);
+			return 2;
+		}
+		if (records_a.size() != records_b.size() || records_a.empty()) {
+			break;
+		}
+		position += length;
+	}
+
+	if (a.records() != b.records()) {
+		printf("no divergence in the first %llu records, %s ends there (the other has %llu)\n",
+			(unsigned long long)std::min(a.records(), b.records()), (a.records() < b.records()) ? "a" : "b",
+			(unsigned long long)std::max(a.records(), b.records()));
+		return 2;
+	}
+	printf("traces match (%llu records)\n", (unsigned long long)a.records());
+	return 0;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: chip8_trace info <trace>\n"
+		"       chip8_trace dump <trace> [first record] [count (%d)]\n"
+		"       chip8_trace find <trace> <pc in hex> [max hits (%d)]\n"
+		"       chip8_trace diff <trace a> <trace b> [context records (%d)]\n",
+		DEFAULT_DUMP_COUNT, DEFAULT_FIND_HITS, DEFAULT_CONTEXT);
+}
+
+static bool open_trace(trace_reader &trace, const char *path)
+{
+	if (!trace.open(path)) {
+		fprintf(stderr, "Can't read trace %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+
+	std::string command = argv[1];
+	trace_reader trace;
+	if (!open_trace(trace, argv[2])) {
+		return 1;
+	}
+
+	if (command == "info") {
+		return info(trace);
+	}
+	if (command == "dump") {
+		uint64 first = (argc > 3) ? strtoull(argv[3], NULL, 0) : 0;
+		size_t count = (argc > 4) ? (size_t)strtoul(argv[4], NULL, 0) : DEFAULT_DUMP_COUNT;
+		return dump(trace, first, count);
+	}
+	if (command == "find" && argc > 3) {
+		uint16 pc = (uint16)strtoul(argv[3], NULL, 16);
+		size_t hits = (argc > 4) ? (size_t)strtoul(argv[4], NULL, 0) : DEFAULT_FIND_HITS;
+		return find(trace, pc, hits);
+	}
+	if (command == "diff" && argc > 3) {
+		trace_reader other;
+		if (!open_trace(other, argv[3])) {
+			return 1;
+		}
+		size_t context = (argc > 4) ? (size_t)strtoul(argv[4], NULL, 0) : DEFAULT_CONTEXT;
+		return diff(trace, other, context);
+	}
+
+	usage();
+	return 1;
+}